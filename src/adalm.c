@@ -20,6 +20,9 @@
 
 #include "adalm.h"
 
+#include <errno.h>
+#include <poll.h>
+
 const char *DEV_NAME = "ad9361-phy";
 const char *RX_DEV_NAME = "cf-ad9361-lpc";
 const char *TX_DEV_NAME = "cf-ad9361-dds-core-lpc";
@@ -29,6 +32,11 @@ struct iio_device *phy;
 struct iio_device *tx, *rx;
 struct iio_channel *tx0_i, *tx0_q, *rx0_i, *rx0_q;
 struct iio_buffer *txbuf;
+struct iio_buffer *rxbuf;
+struct iio_channel *tx_lo;
+
+/* Failed pushes since the last one that succeeded */
+static int push_errors;
 
 void adalm_shutdown()
 {
@@ -36,6 +44,7 @@ void adalm_shutdown()
     {
         iio_buffer_destroy(txbuf);
     }
+    adalm_rx_stop();
 
     adalm_disable_tx();
     adalm_disable_rx();
@@ -74,11 +83,11 @@ void adalm_enable_rx()
 {
     if (rx0_i)
     {
-        iio_channel_disable(rx0_i);
+        iio_channel_enable(rx0_i);
     }
     if (rx0_q)
     {
-        iio_channel_disable(rx0_q);
+        iio_channel_enable(rx0_q);
     }
 }
 
@@ -86,22 +95,94 @@ void adalm_disable_rx()
 {
     if (rx0_i)
     {
-        iio_channel_enable(rx0_i);
+        iio_channel_disable(rx0_i);
     }
     if (rx0_q)
     {
-        iio_channel_enable(rx0_q);
+        iio_channel_disable(rx0_q);
+    }
+}
+
+/** Create the TX buffer.  Returns 0 on success or -1 on error. */
+static int create_tx_buffer(int buf_len, int kernel_buffers)
+{
+    if (kernel_buffers > 0)
+    {
+        // Must be set before the buffer is created
+        int ret = iio_device_set_kernel_buffers_count(tx, kernel_buffers);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Warning: Could not set kernel buffer count to %d (%d)\n", kernel_buffers, ret);
+        }
+    }
+
+    txbuf = iio_device_create_buffer(tx, buf_len, false);
+    if (!txbuf)
+    {
+        perror("Error: Could not create TX buffer");
+        return -1;
     }
+    return 0;
 }
 
-void adalm_init(const char *uri, double samp_rate, long gain, long tx_freq, int buf_len)
+void adalm_resize(int buf_len, int kernel_buffers)
 {
+    if (txbuf)
+    {
+        iio_buffer_destroy(txbuf);
+        txbuf = NULL;
+    }
+    if (create_tx_buffer(buf_len, kernel_buffers) < 0)
+    {
+        beacon_exit(1);
+    }
+}
+
+static double elapsed_ms(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double ms = (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1e6;
+    *since = now;
+    return ms;
+}
+
+int adalm_init(const char *uri, double samp_rate, long gain, long tx_freq, int buf_len, int kernel_buffers)
+{
+    struct timespec step;
+    double context_ms, freq_ms, gain_ms, rate_ms, buffer_ms;
+    long long current_freq = 0, current_rate = 0;
+    double current_gain = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &step);
+
     ctx = iio_create_context_from_uri(uri);
+    if (!ctx)
+    {
+        perror("Error: Could not create IIO context");
+        return -1;
+    }
     phy = iio_context_find_device(ctx, DEV_NAME);
+    tx = iio_context_find_device(ctx, TX_DEV_NAME);
+    rx = iio_context_find_device(ctx, RX_DEV_NAME);
+    if (!phy || !tx || !rx)
+    {
+        fprintf(stderr, "Error: The IIO context has no AD9361\n");
+        return -1;
+    }
+    context_ms = elapsed_ms(&step);
+
+    // Each setting is read back first and only written if it differs, since
+    // a restarted beacon usually finds the device already configured.
 
     // Set frequency
-    iio_channel_attr_write_longlong(
-        iio_device_find_channel(phy, "altvoltage1", true), "frequency", tx_freq);
+    tx_lo = iio_device_find_channel(phy, "altvoltage1", true);
+    bool set_freq = iio_channel_attr_read_longlong(tx_lo, "frequency", &current_freq) < 0 || current_freq != tx_freq;
+    if (set_freq)
+    {
+        iio_channel_attr_write_longlong(tx_lo, "frequency", tx_freq);
+    }
+    freq_ms = elapsed_ms(&step);
 
     // Set gain
     double attenuation = gain - 89.75;
@@ -115,13 +196,24 @@ void adalm_init(const char *uri, double samp_rate, long gain, long tx_freq, int
     }
 
     //iio_channel_attr_write(iio_device_find_channel(phy, "voltage0", true), "gain_control_mode", "manual");
-    iio_channel_attr_write_longlong(iio_device_find_channel(phy, "voltage0", true), "hardwaregain", attenuation);
-
-    // Set baseband sampling rate
-    ad9361_set_bb_rate(phy, samp_rate);
+    struct iio_channel *phy_tx = iio_device_find_channel(phy, "voltage0", true);
+    bool set_gain = iio_channel_attr_read_double(phy_tx, "hardwaregain", &current_gain) < 0 ||
+                    current_gain != (long long)attenuation;
+    if (set_gain)
+    {
+        iio_channel_attr_write_longlong(phy_tx, "hardwaregain", attenuation);
+    }
+    gain_ms = elapsed_ms(&step);
 
-    tx = iio_context_find_device(ctx, TX_DEV_NAME);
-    rx = iio_context_find_device(ctx, RX_DEV_NAME);
+    // Set baseband sampling rate.  This also loads the FIR filters, which
+    // is the slowest part of setup.
+    bool set_rate = iio_channel_attr_read_longlong(phy_tx, "sampling_frequency", &current_rate) < 0 ||
+                    current_rate != (long long)samp_rate;
+    if (set_rate)
+    {
+        ad9361_set_bb_rate(phy, samp_rate);
+    }
+    rate_ms = elapsed_ms(&step);
 
     tx0_i = iio_device_find_channel(tx, "voltage0", true);
     tx0_q = iio_device_find_channel(tx, "voltage1", true);
@@ -132,17 +224,233 @@ void adalm_init(const char *uri, double samp_rate, long gain, long tx_freq, int
     adalm_disable_rx();
     adalm_enable_tx();
 
-    txbuf = iio_device_create_buffer(tx, buf_len, false);
-    if (!txbuf)
+    if (create_tx_buffer(buf_len, kernel_buffers) < 0)
     {
-        perror("Error: Could not create TX buffer");
-        shutdown(1);
+        return -1;
+    }
+    buffer_ms = elapsed_ms(&step);
+
+    fprintf(stderr, "Device Setup: Context: %0.1f ms, Frequency: %0.1f ms%s, Gain: %0.1f ms%s, Sampling Rate: %0.1f ms%s, Buffer: %0.1f ms\n",
+            context_ms, freq_ms, set_freq ? "" : " (unchanged)", gain_ms, set_gain ? "" : " (unchanged)",
+            rate_ms, set_rate ? "" : " (unchanged)", buffer_ms);
+    return 0;
+}
+
+double adalm_store_profiles(const long *freqs, int count)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Tuning to each frequency runs the full VCO calibration once; storing
+    // the result lets later hops skip it.
+    for (int profile = 0; profile < count; profile++)
+    {
+        if (iio_channel_attr_write_longlong(tx_lo, "frequency", freqs[profile]) < 0 ||
+            iio_channel_attr_write_longlong(tx_lo, "fastlock_store", profile) < 0)
+        {
+            fprintf(stderr, "Error: Could not store fastlock profile %d for %ld Hz\n", profile, freqs[profile]);
+            return -1.0;
+        }
+    }
+    if (adalm_recall_profile(0) < 0)
+    {
+        return -1.0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+double adalm_recall_profile(int profile)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = iio_channel_attr_write_longlong(tx_lo, "fastlock_recall", profile);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error: Could not recall fastlock profile %d (%d)\n", profile, ret);
+        return -1.0;
+    }
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void adalm_rx_tune(long freq)
+{
+    struct iio_channel *rx_lo = iio_device_find_channel(phy, "altvoltage0", true);
+    long long current = 0;
+    if (iio_channel_attr_read_longlong(rx_lo, "frequency", &current) < 0 || current != freq)
+    {
+        iio_channel_attr_write_longlong(rx_lo, "frequency", freq);
+    }
+}
+
+int adalm_rx_start(int buf_len)
+{
+    // A fresh buffer holds samples from now on rather than from whenever
+    // RX was last used
+    adalm_rx_stop();
+    adalm_enable_rx();
+    rxbuf = iio_device_create_buffer(rx, buf_len, false);
+    if (!rxbuf)
+    {
+        perror("Error: Could not create RX buffer");
+        adalm_disable_rx();
+        return -1;
+    }
+    return 0;
+}
+
+long adalm_receive(complex *iq, int iq_len)
+{
+    ssize_t nbytes_rx = iio_buffer_refill(rxbuf);
+    if (nbytes_rx < 0)
+    {
+        fprintf(stderr, "Error refilling buf %d\n", (int)nbytes_rx);
+        return -1;
+    }
+
+    ptrdiff_t p_inc = iio_buffer_step(rxbuf);
+    char *p_end = iio_buffer_end(rxbuf);
+    long index = 0;
+    for (char *p_dat = (char *)iio_buffer_first(rxbuf, rx0_i); p_dat < p_end && index < iq_len; p_dat += p_inc)
+    {
+        // 12-bit samples, sign extended
+        double i = ((int16_t *)p_dat)[0];
+        double q = ((int16_t *)p_dat)[1];
+        iq[index++] = q + i * I;
     }
+    return index;
 }
 
-void adalm_transmit(complex *iq, int iq_len)
+void adalm_rx_stop()
 {
+    if (rxbuf)
+    {
+        iio_buffer_destroy(rxbuf);
+        rxbuf = NULL;
+        adalm_disable_rx();
+    }
+}
+
+/** Push the filled TX buffer.  Returns the number of seconds spent waiting for the device, or -1 if the push failed. */
+static double push_tx()
+{
+    struct timespec push_start, push_end;
+    clock_gettime(CLOCK_MONOTONIC, &push_start);
     ssize_t nbytes_tx;
+    while ((nbytes_tx = iio_buffer_push(txbuf)) == -EAGAIN)
+    {
+        // A non-blocking buffer with no room waits as a blocking one would
+        struct pollfd room = {iio_buffer_get_poll_fd(txbuf), POLLOUT, 0};
+        poll(&room, 1, -1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &push_end);
+    if (nbytes_tx < 0)
+    {
+        fprintf(stderr, "Error pushing buf %d\n", (int)nbytes_tx);
+        if (++push_errors >= ADALM_MAX_PUSH_ERRORS)
+        {
+            beacon_exit(1);
+        }
+        return -1.0;
+    }
+    push_errors = 0;
+    return (push_end.tv_sec - push_start.tv_sec) + (push_end.tv_nsec - push_start.tv_nsec) / 1e9;
+}
+
+int adalm_tx_poll_fd()
+{
+    int fd = iio_buffer_get_poll_fd(txbuf);
+    if (fd < 0 || iio_buffer_set_blocking_mode(txbuf, false) < 0)
+    {
+        return -1;
+    }
+    return fd;
+}
+
+/** Returns a sample on the IQ_FULL_SCALE scale clamped to 12 bits and MSB aligned, as adalm_transmit() sends them. */
+static int16_t dac_sample(double value)
+{
+    long sample = lround(value);
+    sample = sample > IQ_FULL_SCALE - 1 ? IQ_FULL_SCALE - 1 : sample < -IQ_FULL_SCALE ? -IQ_FULL_SCALE : sample;
+    return (int16_t)(sample * 16);
+}
+
+/** Returns the float in the given little endian bits. */
+static float le_float(uint32_t bits)
+{
+    union
+    {
+        float f;
+        uint32_t u;
+    } value;
+    value.u = le32toh(bits);
+    return value.f;
+}
+
+/** Fill the TX buffer straight from packed samples, padding with silence past len. */
+static void fill_packed(enum iq_format format, const void *buf, long len)
+{
+    const int16_t *buf16 = buf;
+    const uint32_t *buf32 = buf;
+    ptrdiff_t p_inc = iio_buffer_step(txbuf);
+    char *p_end = iio_buffer_end(txbuf);
+    long index = 0;
+    for (char *p_dat = (char *)iio_buffer_first(txbuf, tx0_i); p_dat < p_end; p_dat += p_inc)
+    {
+        int16_t i = 0, q = 0;
+        if (index < len)
+        {
+            switch (format)
+            {
+            case FORMAT_CS16:
+                // Already MSB aligned, the low 4 bits are dropped by the DAC
+                i = (int16_t)le16toh(buf16[index * 2]);
+                q = (int16_t)le16toh(buf16[index * 2 + 1]);
+                break;
+            case FORMAT_CF32:
+                i = dac_sample(le_float(buf32[index * 2]) * IQ_FULL_SCALE);
+                q = dac_sample(le_float(buf32[index * 2 + 1]) * IQ_FULL_SCALE);
+                break;
+            default:
+                i = dac_sample((int32_t)le32toh(buf32[index * 2]));
+                q = dac_sample((int32_t)le32toh(buf32[index * 2 + 1]));
+                break;
+            }
+        }
+        ((int16_t *)p_dat)[0] = i;
+        ((int16_t *)p_dat)[1] = q;
+        index++;
+    }
+}
+
+double adalm_transmit_packed(enum iq_format format, const void *buf, long len)
+{
+    fill_packed(format, buf, len);
+    return push_tx();
+}
+
+int adalm_transmit_cyclic(enum iq_format format, const void *buf, long len)
+{
+    if (txbuf)
+    {
+        iio_buffer_destroy(txbuf);
+        txbuf = NULL;
+    }
+    // The device repeats a cyclic buffer on its own after the first push
+    txbuf = iio_device_create_buffer(tx, len, true);
+    if (!txbuf)
+    {
+        perror("Error: Could not create cyclic TX buffer");
+        return -1;
+    }
+    fill_packed(format, buf, len);
+    return push_tx() < 0 ? -1 : 0;
+}
+
+double adalm_transmit(complex *iq, int iq_len)
+{
     char *p_dat, *p_end;
     ptrdiff_t p_inc;
     int index = 0;
@@ -151,7 +459,7 @@ void adalm_transmit(complex *iq, int iq_len)
     // WRITE: Get pointers to TX buf and write IQ to TX buf port 0
     p_inc = iio_buffer_step(txbuf);
     p_end = iio_buffer_end(txbuf);
-    for (p_dat = (char *)iio_buffer_first(txbuf, tx0_i); p_dat < p_end; p_dat += p_inc)
+    for (p_dat = (char *)iio_buffer_first(txbuf, tx0_i); p_dat < p_end && index < iq_len; p_dat += p_inc)
     {
         i = cimag(iq[index]);
         q = creal(iq[index]);
@@ -164,11 +472,5 @@ void adalm_transmit(complex *iq, int iq_len)
         index++;
     }
 
-    // Schedule TX buffer
-    nbytes_tx = iio_buffer_push(txbuf);
-    if (nbytes_tx < 0)
-    {
-        fprintf(stderr, "Error pushing buf %d\n", (int)nbytes_tx);
-        shutdown(1);
-    }
+    return push_tx();
 }
@@ -24,21 +24,57 @@
 
 #include "../config.h"
 #include "global.h"
+#include "iq.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <math.h>
 #include <complex.h>
+#include <time.h>
 
 #include <iio.h>
 #include <ad9361.h>
 
+/* Consecutive failed pushes after which the device is given up on */
+#define ADALM_MAX_PUSH_ERRORS 10
+
+/* Full scale of the 12-bit RX samples */
+#define ADALM_RX_FULL_SCALE 2048
+
+/* Longest recording, in samples, that is played from a cyclic buffer */
+#define ADALM_MAX_CYCLIC_SAMPLES 4194304
+
+/* Number of fastlock profiles the AD9361 can hold */
+#define ADALM_MAX_PROFILES 8
+
 void adalm_enable_tx();
 void adalm_disable_tx();
 void adalm_enable_rx();
 void adalm_disable_rx();
-void adalm_init(const char *uri, double samp_rate, long gain, long tx_freq, int buf_len);
-void adalm_transmit(complex *iq, int iq_len);
+/** Open the device and configure TX, leaving settings it already has alone.  Returns 0 on success or -1 on error. */
+int adalm_init(const char *uri, double samp_rate, long gain, long tx_freq, int buf_len, int kernel_buffers);
+/** Recreate the TX buffer with a new length and number of kernel buffers (0 leaves the driver default). */
+void adalm_resize(int buf_len, int kernel_buffers);
+/** Make pushes to the TX buffer non-blocking and return a descriptor that polls writable when the device has room for a block.  Returns -1 if the backend has none, as only local contexts do, leaving pushes blocking.  The descriptor changes when the buffer is recreated. */
+int adalm_tx_poll_fd();
+/** Send one block.  Returns the number of seconds spent waiting for the device to accept it, or -1 if the push failed. */
+double adalm_transmit(complex *iq, int iq_len);
+/** Send one block of packed samples, padded with silence to the buffer length.  Returns as adalm_transmit(). */
+double adalm_transmit_packed(enum iq_format format, const void *buf, long len);
+/** Replace the TX buffer with a cyclic one holding len packed samples, which the device repeats until shutdown.  Returns 0 on success or -1 on error. */
+int adalm_transmit_cyclic(enum iq_format format, const void *buf, long len);
+/** Store a fastlock profile for each TX frequency, in order, and switch to the first.  Returns the number of seconds spent, or -1 on error. */
+double adalm_store_profiles(const long *freqs, int count);
+/** Switch the TX LO to a stored fastlock profile.  Returns the number of seconds spent, or -1 on error. */
+double adalm_recall_profile(int profile);
+/** Tune the RX LO. */
+void adalm_rx_tune(long freq);
+/** Start receiving in blocks of buf_len samples.  Returns 0 on success or -1 on error. */
+int adalm_rx_start(int buf_len);
+/** Receive up to one block, in the layout used by pack_iq().  Returns the number of samples or -1 on error. */
+long adalm_receive(complex *iq, int iq_len);
+/** Stop receiving. */
+void adalm_rx_stop();
 void adalm_shutdown();
 
 #endif /* !FILE_ADALM_H_SEEN */
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+struct arena *arena_create(size_t size, bool hugepages)
+{
+    struct arena *arena = malloc(sizeof(struct arena));
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+    arena->used = 0;
+    arena->hugepages = false;
+    arena->base = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (hugepages)
+    {
+        // Only works if huge pages have been reserved (vm.nr_hugepages)
+        arena->size = (size + ARENA_HUGEPAGE_SIZE - 1) / ARENA_HUGEPAGE_SIZE * ARENA_HUGEPAGE_SIZE;
+        arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        arena->hugepages = arena->base != MAP_FAILED;
+    }
+#endif
+    if (arena->base == MAP_FAILED)
+    {
+        // Anonymous mappings are page aligned, which covers ARENA_ALIGN
+        arena->size = size > 0 ? size : 1;
+        arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena->base == MAP_FAILED)
+        {
+            free(arena);
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugepages)
+        {
+            // Let transparent huge pages back it instead
+            madvise(arena->base, arena->size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    return arena;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    size = ARENA_ALIGNED(size);
+    if (size > arena->size - arena->used)
+    {
+        return NULL;
+    }
+    void *ptr = arena->base + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+void arena_destroy(struct arena *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+    munmap(arena->base, arena->size);
+    free(arena);
+}
@@ -0,0 +1,58 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File arena.h */
+#ifndef FILE_ARENA_H_SEEN
+#define FILE_ARENA_H_SEEN
+
+#include "../config.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Alignment of every allocation, one cache line and wide enough for any SIMD load */
+#define ARENA_ALIGN 64
+
+/* Size of the huge pages an arena can be backed by */
+#define ARENA_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/** Round a size up to the arena alignment. */
+#define ARENA_ALIGNED(size) (((size) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+/** A single mapping that allocations are carved from in order and released all at once. */
+struct arena
+{
+    char *base;
+    size_t size;
+    size_t used;
+    bool hugepages;
+};
+
+/** Map an arena of at least size bytes, backed by huge pages if asked and available.  Returns NULL on error. */
+struct arena *arena_create(size_t size, bool hugepages);
+
+/** Returns size bytes aligned to ARENA_ALIGN, or NULL if the arena is full. */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/** Unmap an arena and everything allocated from it. */
+void arena_destroy(struct arena *arena);
+
+#endif /* !FILE_ARENA_H_SEEN */
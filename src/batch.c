@@ -0,0 +1,577 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "batch.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Longest manifest line and most columns */
+#define BATCH_LINE_LEN 4096
+#define BATCH_MAX_FIELDS 16
+
+struct batch_entry
+{
+    struct beacon_params params;
+    enum iq_format format;
+    char *path;
+    char *message;
+    double seconds;
+    long long total_samples;
+    // Raw output, opened and sized up front, or -1 for .bcn output
+    int fd;
+};
+
+/** A block of an entry, or the whole entry when len is 0 (.bcn output is written in order). */
+struct batch_unit
+{
+    long entry;
+    long long start;
+    long len;
+};
+
+/** One worker's share of the units.  The owner takes from the head and other workers steal from the tail. */
+struct batch_queue
+{
+    pthread_mutex_t lock;
+    struct batch_unit *units;
+    long head;
+    long tail;
+};
+
+struct batch_job
+{
+    struct batch_entry *entries;
+    long entry_count;
+    struct batch_queue *queues;
+    int threads;
+    long block_len;
+    atomic_bool failed;
+    atomic_long steals;
+};
+
+struct batch_worker
+{
+    struct batch_job *job;
+    int id;
+};
+
+/** Split a CSV line in place.  Fields may be double quoted, with "" for a quote.  Returns the number of fields. */
+static int split_csv(char *line, char **fields, int max)
+{
+    int count = 0;
+    char *p = line;
+
+    while (count < max)
+    {
+        char *out = p;
+        fields[count++] = p;
+        if (*p == '"')
+        {
+            p++;
+            while (*p != '\0')
+            {
+                if (*p == '"' && p[1] == '"')
+                {
+                    *out++ = '"';
+                    p += 2;
+                }
+                else if (*p == '"')
+                {
+                    p++;
+                    break;
+                }
+                else
+                {
+                    *out++ = *p++;
+                }
+            }
+        }
+        while (*p != '\0' && *p != ',')
+        {
+            *out++ = *p++;
+        }
+        bool more = *p == ',';
+        *out = '\0';
+        if (!more)
+        {
+            break;
+        }
+        p++;
+    }
+    return count;
+}
+
+/** Set one field of an entry from the manifest.  Returns -1 if the value is invalid. */
+static int set_field(struct batch_entry *entry, const char *name, const char *value)
+{
+    if (strcmp(name, "path") == 0)
+    {
+        entry->path = strdup(value);
+    }
+    else if (strcmp(name, "message") == 0)
+    {
+        entry->message = strdup(value);
+    }
+    else if (strcmp(name, "duration") == 0)
+    {
+        entry->seconds = atof(value);
+    }
+    else if (strcmp(name, "wpm") == 0)
+    {
+        entry->params.wpm = atoi(value);
+    }
+    else if (strcmp(name, "tone") == 0)
+    {
+        entry->params.tone_freq = atol(value);
+    }
+    else if (strcmp(name, "carrier") == 0)
+    {
+        entry->params.carrier_freq = atol(value);
+    }
+    else if (strcmp(name, "sampling_rate") == 0)
+    {
+        entry->params.samp_rate = atol(value);
+    }
+    else if (strcmp(name, "padding") == 0)
+    {
+        entry->params.padding = atoi(value);
+    }
+    else if (strcmp(name, "modulation_index") == 0)
+    {
+        entry->params.modulation_index = atof(value);
+    }
+    else if (strcmp(name, "modulation") == 0)
+    {
+        if (strcasecmp(value, "AM") == 0)
+        {
+            entry->params.modulation = MOD_AM;
+        }
+        else if (strcasecmp(value, "FM") == 0)
+        {
+            entry->params.modulation = MOD_FM;
+        }
+        else if (strcasecmp(value, "CW") == 0)
+        {
+            entry->params.modulation = MOD_CW;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    else if (strcmp(name, "format") == 0)
+    {
+        int format = iq_format_from_name(value);
+        if (format < 0)
+        {
+            return -1;
+        }
+        entry->format = format;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static bool same_params(const struct beacon_params *a, const struct beacon_params *b)
+{
+    return a->samp_rate == b->samp_rate && a->carrier_freq == b->carrier_freq &&
+           a->tone_freq == b->tone_freq && a->wpm == b->wpm && a->padding == b->padding &&
+           a->modulation == b->modulation && a->modulation_index == b->modulation_index &&
+           a->hugepages == b->hugepages && strcmp(a->message, b->message) == 0;
+}
+
+static void free_entries(struct batch_entry *entries, long count)
+{
+    for (long index = 0; index < count; index++)
+    {
+        if (entries[index].fd >= 0)
+        {
+            close(entries[index].fd);
+        }
+        free(entries[index].path);
+        free(entries[index].message);
+    }
+    free(entries);
+}
+
+/** Read the manifest.  Returns the entries, or NULL on error. */
+static struct batch_entry *read_manifest(const char *manifest, const struct beacon_params *defaults, enum iq_format format, double seconds, long *count)
+{
+    FILE *in = fopen(manifest, "r");
+    if (in == NULL)
+    {
+        perror("Error: Could not open manifest");
+        return NULL;
+    }
+
+    char line[BATCH_LINE_LEN];
+    char header[BATCH_LINE_LEN];
+    char *columns[BATCH_MAX_FIELDS];
+    char *fields[BATCH_MAX_FIELDS];
+    int column_count = 0;
+    struct batch_entry *entries = NULL;
+    long entry_count = 0;
+    int line_number = 0;
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), in) != NULL)
+    {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+        if (column_count == 0)
+        {
+            strcpy(header, line);
+            column_count = split_csv(header, columns, BATCH_MAX_FIELDS);
+            continue;
+        }
+
+        struct batch_entry *grown = realloc(entries, sizeof(struct batch_entry) * (entry_count + 1));
+        if (grown == NULL)
+        {
+            ok = false;
+            break;
+        }
+        entries = grown;
+        struct batch_entry *entry = &entries[entry_count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->params = *defaults;
+        entry->format = format;
+        entry->seconds = seconds;
+        entry->fd = -1;
+
+        int field_count = split_csv(line, fields, BATCH_MAX_FIELDS);
+        for (int index = 0; index < field_count && index < column_count && ok; index++)
+        {
+            if (fields[index][0] != '\0' && set_field(entry, columns[index], fields[index]) < 0)
+            {
+                fprintf(stderr, "Error: %s:%d: Invalid %s: %s\n", manifest, line_number, columns[index], fields[index]);
+                ok = false;
+            }
+        }
+        if (!ok)
+        {
+            break;
+        }
+        if (entry->path == NULL || entry->message == NULL)
+        {
+            fprintf(stderr, "Error: %s:%d: Each entry needs a path and a message\n", manifest, line_number);
+            ok = false;
+            break;
+        }
+        entry->params.message = entry->message;
+        entry->total_samples = (long long)(entry->seconds * entry->params.samp_rate);
+
+        // Catch bad parameters before any rendering starts
+        struct beacon *ctx = beacon_create(&entry->params);
+        if (ctx == NULL || entry->total_samples <= 0)
+        {
+            fprintf(stderr, "Error: %s:%d: Invalid signal parameters\n", manifest, line_number);
+            ok = false;
+        }
+        beacon_destroy(ctx);
+    }
+    fclose(in);
+
+    if (!ok)
+    {
+        free_entries(entries, entry_count);
+        return NULL;
+    }
+    *count = entry_count;
+    return entries;
+}
+
+/** Take a unit from this worker's queue, or steal one from another.  Returns false when there is no work left. */
+static bool next_unit(struct batch_job *job, int id, struct batch_unit *unit)
+{
+    struct batch_queue *own = &job->queues[id];
+    pthread_mutex_lock(&own->lock);
+    bool found = own->head < own->tail;
+    if (found)
+    {
+        *unit = own->units[own->head++];
+    }
+    pthread_mutex_unlock(&own->lock);
+    if (found)
+    {
+        return true;
+    }
+
+    // Nothing new is ever queued, so once every queue is empty the work is done
+    for (int offset = 1; offset < job->threads; offset++)
+    {
+        struct batch_queue *victim = &job->queues[(id + offset) % job->threads];
+        pthread_mutex_lock(&victim->lock);
+        found = victim->head < victim->tail;
+        if (found)
+        {
+            *unit = victim->units[--victim->tail];
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (found)
+        {
+            atomic_fetch_add(&job->steals, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int write_block(int fd, const char *buf, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t written = pwrite(fd, buf + done, size - done, offset + done);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        done += written;
+    }
+    return 0;
+}
+
+/** Worker thread.  The context is kept between units and only rebuilt when the parameters change. */
+static void *batch_worker(void *arg)
+{
+    struct batch_worker *worker = arg;
+    struct batch_job *job = worker->job;
+    char *buf = malloc(job->block_len * sizeof(complex));
+    struct beacon *ctx = NULL;
+    const struct beacon_params *ctx_params = NULL;
+    struct batch_unit unit;
+
+    if (buf == NULL)
+    {
+        atomic_store(&job->failed, true);
+    }
+
+    while (!atomic_load(&job->failed) && next_unit(job, worker->id, &unit))
+    {
+        struct batch_entry *entry = &job->entries[unit.entry];
+
+        if (unit.len == 0)
+        {
+            FILE *out = fopen(entry->path, "wb");
+            if (out == NULL || render_bcn(out, &entry->params, entry->format, entry->total_samples, job->block_len) < 0)
+            {
+                fprintf(stderr, "Error: Could not write %s\n", entry->path);
+                atomic_store(&job->failed, true);
+            }
+            if (out != NULL && fclose(out) != 0)
+            {
+                atomic_store(&job->failed, true);
+            }
+            continue;
+        }
+
+        if (ctx_params == NULL || !same_params(ctx_params, &entry->params))
+        {
+            beacon_destroy(ctx);
+            ctx = beacon_create(&entry->params);
+            ctx_params = &entry->params;
+            if (ctx == NULL)
+            {
+                fprintf(stderr, "Error: Could not create render context\n");
+                atomic_store(&job->failed, true);
+                break;
+            }
+        }
+        if (beacon_tell(ctx) != unit.start)
+        {
+            beacon_seek(ctx, unit.start);
+        }
+        beacon_render(ctx, buf, unit.len, entry->format);
+
+        size_t sample_size = iq_sample_size(entry->format);
+        if (write_block(entry->fd, buf, unit.len * sample_size, unit.start * sample_size) < 0)
+        {
+            perror("Error: Could not write IQ data");
+            atomic_store(&job->failed, true);
+        }
+    }
+
+    beacon_destroy(ctx);
+    free(buf);
+    return NULL;
+}
+
+int render_batch(const char *manifest, const struct beacon_params *defaults, enum iq_format format, double seconds, long block_len, int threads)
+{
+    struct batch_job job;
+    struct timespec started, finished;
+    long entry_count = 0;
+
+    job.entries = read_manifest(manifest, defaults, format, seconds, &entry_count);
+    if (job.entries == NULL)
+    {
+        return -1;
+    }
+    job.entry_count = entry_count;
+    job.block_len = block_len;
+    atomic_init(&job.failed, false);
+    atomic_init(&job.steals, 0);
+
+    // Open and size every raw output so blocks can be written in place, and
+    // count the work
+    long long total_samples = 0;
+    double total_bytes = 0;
+    long unit_count = 0;
+    for (long index = 0; index < entry_count; index++)
+    {
+        struct batch_entry *entry = &job.entries[index];
+        total_samples += entry->total_samples;
+        total_bytes += (double)entry->total_samples * iq_sample_size(entry->format);
+        if (is_bcn_path(entry->path))
+        {
+            unit_count++;
+            continue;
+        }
+        unit_count += (entry->total_samples + block_len - 1) / block_len;
+        entry->fd = open(entry->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        off_t size = entry->total_samples * iq_sample_size(entry->format);
+        if (entry->fd < 0 || (posix_fallocate(entry->fd, 0, size) != 0 && ftruncate(entry->fd, size) < 0))
+        {
+            fprintf(stderr, "Error: Could not create %s: %s\n", entry->path, strerror(errno));
+            free_entries(job.entries, entry_count);
+            return -1;
+        }
+    }
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > unit_count)
+    {
+        threads = unit_count > 0 ? unit_count : 1;
+    }
+    job.threads = threads;
+
+    // Deal the units out in contiguous runs so each worker mostly moves
+    // forward through the same entry and can keep its context
+    struct batch_queue queues[threads];
+    job.queues = queues;
+    long per_worker = (unit_count + threads - 1) / threads;
+    long entry = 0;
+    long long start = 0;
+    for (int id = 0; id < threads; id++)
+    {
+        queues[id].units = malloc(sizeof(struct batch_unit) * (per_worker > 0 ? per_worker : 1));
+        if (queues[id].units == NULL)
+        {
+            // No worker has started yet, so only the queues so far need undoing
+            fprintf(stderr, "Error: Could not allocate the work queues\n");
+            for (int done = 0; done < id; done++)
+            {
+                pthread_mutex_destroy(&queues[done].lock);
+                free(queues[done].units);
+            }
+            free_entries(job.entries, entry_count);
+            return -1;
+        }
+        pthread_mutex_init(&queues[id].lock, NULL);
+        queues[id].head = 0;
+        queues[id].tail = 0;
+        while (queues[id].tail < per_worker && entry < entry_count)
+        {
+            struct batch_unit *unit = &queues[id].units[queues[id].tail++];
+            unit->entry = entry;
+            unit->start = start;
+            if (job.entries[entry].fd < 0)
+            {
+                unit->len = 0;
+                start = job.entries[entry].total_samples;
+            }
+            else
+            {
+                unit->len = job.entries[entry].total_samples - start < block_len ? job.entries[entry].total_samples - start : block_len;
+                start += unit->len;
+            }
+            if (start >= job.entries[entry].total_samples)
+            {
+                entry++;
+                start = 0;
+            }
+        }
+    }
+
+    fprintf(stderr, "Rendering %ld files, %lld samples, Threads: %d\n", entry_count, total_samples, threads);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    pthread_t threads_started[threads];
+    struct batch_worker workers[threads];
+    int started_threads = 0;
+    for (; started_threads < threads; started_threads++)
+    {
+        workers[started_threads].job = &job;
+        workers[started_threads].id = started_threads;
+        if (pthread_create(&threads_started[started_threads], NULL, batch_worker, &workers[started_threads]) != 0)
+        {
+            fprintf(stderr, "Error: Could not start render thread\n");
+            atomic_store(&job.failed, true);
+            break;
+        }
+    }
+    for (int index = 0; index < started_threads; index++)
+    {
+        pthread_join(threads_started[index], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    for (int id = 0; id < threads; id++)
+    {
+        pthread_mutex_destroy(&queues[id].lock);
+        free(queues[id].units);
+    }
+    free_entries(job.entries, entry_count);
+
+    if (atomic_load(&job.failed))
+    {
+        return -1;
+    }
+
+    double elapsed = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    fprintf(stderr, "Rendered %ld files in %0.3f s (%0.3f Ms/s, %0.3f MB/s raw), Steals: %ld\n",
+            entry_count, elapsed, total_samples / elapsed / 1e6, total_bytes / elapsed / 1e6, atomic_load(&job.steals));
+    return 0;
+}
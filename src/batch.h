@@ -0,0 +1,40 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File batch.h */
+#ifndef FILE_BATCH_H_SEEN
+#define FILE_BATCH_H_SEEN
+
+#include "../config.h"
+#include "beacon.h"
+#include "iq.h"
+#include "render.h"
+
+/** Render every entry of a CSV manifest into its own file on a pool of threads worker threads.
+
+    The first line names the columns: path, message, duration, wpm, tone,
+    carrier, sampling_rate, padding, modulation, modulation_index and
+    format.  Only path and message are required; the others take their
+    values from defaults, format and seconds.  Returns 0 on success or -1
+    on error. */
+int render_batch(const char *manifest, const struct beacon_params *defaults, enum iq_format format, double seconds, long block_len, int threads);
+
+#endif /* !FILE_BATCH_H_SEEN */
@@ -0,0 +1,803 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "bcn.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <endian.h>
+#include <sys/types.h>
+
+/* Samples the writer holds back so a period can be found before it is encoded */
+#define BCN_LOOKAHEAD (2 * BCN_MAX_PERIOD)
+
+struct bcn_pattern
+{
+    char *data;
+    long len;
+};
+
+struct bcn_writer
+{
+    FILE *out;
+    enum iq_format format;
+    size_t sample_size;
+    long samp_rate;
+    bool failed;
+
+    // Samples not yet encoded
+    char *buf;
+    long buf_pos;
+    long buf_len;
+    long buf_cap;
+
+    // The record being extended, and the sample it starts at
+    uint32_t pending;
+    uint32_t pattern;
+    uint64_t offset;
+    uint64_t count;
+    uint64_t start;
+    char *literal;
+
+    struct bcn_pattern *patterns;
+    uint64_t *pattern_offsets;
+    uint32_t pattern_count;
+
+    struct bcn_index_entry *index;
+    uint64_t index_len;
+    uint64_t index_cap;
+    uint64_t next_index;
+
+    uint64_t samples;
+    uint64_t file_offset;
+};
+
+struct bcn_reader
+{
+    FILE *in;
+    struct bcn_header header;
+    size_t sample_size;
+
+    struct bcn_pattern *patterns;
+    uint32_t pattern_cap;
+
+    // The seek index in host order, or NULL if the file has none
+    struct bcn_index_entry *entries;
+    uint64_t entry_count;
+
+    // The record being read and how far into it
+    uint32_t type;
+    uint32_t pattern;
+    uint64_t offset;
+    uint64_t left;
+    bool ended;
+};
+
+static void write_bytes(struct bcn_writer *writer, const void *data, size_t size)
+{
+    if (size > 0 && fwrite(data, size, 1, writer->out) != 1)
+    {
+        writer->failed = true;
+    }
+    writer->file_offset += size;
+}
+
+static void write_record(struct bcn_writer *writer, uint32_t type, uint32_t pattern, uint64_t offset, uint64_t count)
+{
+    struct bcn_record record;
+    record.type = htole32(type);
+    record.pattern = htole32(pattern);
+    record.offset = htole64(offset);
+    record.count = htole64(count);
+    write_bytes(writer, &record, sizeof(record));
+}
+
+static bool is_zero(const char *sample, size_t sample_size)
+{
+    for (size_t index = 0; index < sample_size; index++)
+    {
+        if (sample[index] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Write out the pending record, adding an index entry if one is due. */
+static void flush_pending(struct bcn_writer *writer)
+{
+    if (writer->pending == 0)
+    {
+        return;
+    }
+    if (writer->count > 0)
+    {
+        if (writer->start >= writer->next_index)
+        {
+            if (writer->index_len == writer->index_cap)
+            {
+                writer->index_cap = writer->index_cap > 0 ? writer->index_cap * 2 : 64;
+                struct bcn_index_entry *index = realloc(writer->index, sizeof(struct bcn_index_entry) * writer->index_cap);
+                if (index == NULL)
+                {
+                    writer->failed = true;
+                    return;
+                }
+                writer->index = index;
+            }
+            writer->index[writer->index_len].sample = writer->start;
+            writer->index[writer->index_len].offset = writer->file_offset;
+            writer->index_len++;
+            writer->next_index = writer->start - writer->start % BCN_INDEX_INTERVAL + BCN_INDEX_INTERVAL;
+        }
+        write_record(writer, writer->pending, writer->pattern, writer->offset, writer->count);
+        if (writer->pending == BCN_LITERAL)
+        {
+            write_bytes(writer, writer->literal, writer->count * writer->sample_size);
+        }
+    }
+    writer->pending = 0;
+}
+
+static void start_pending(struct bcn_writer *writer, uint32_t type, uint32_t pattern, uint64_t offset)
+{
+    flush_pending(writer);
+    writer->pending = type;
+    writer->pattern = pattern;
+    writer->offset = offset;
+    writer->count = 0;
+    writer->start = writer->samples;
+}
+
+/** Returns how many of the samples continue the pending silence or repeat. */
+static long extend_pending(struct bcn_writer *writer, const char *samples, long len)
+{
+    size_t sample_size = writer->sample_size;
+    long done = 0;
+
+    if (writer->pending == BCN_SILENCE)
+    {
+        while (done < len && is_zero(samples + done * sample_size, sample_size))
+        {
+            done++;
+        }
+        return done;
+    }
+
+    // Compare a whole stretch of the pattern at a time, and only go sample
+    // by sample to find where a mismatch is
+    struct bcn_pattern *pattern = &writer->patterns[writer->pattern];
+    long phase = (writer->offset + writer->count) % pattern->len;
+    while (done < len)
+    {
+        long span = pattern->len - phase;
+        if (span > len - done)
+        {
+            span = len - done;
+        }
+        const char *expected = pattern->data + phase * sample_size;
+        const char *actual = samples + done * sample_size;
+        if (memcmp(expected, actual, span * sample_size) != 0)
+        {
+            long same = 0;
+            while (memcmp(expected + same * sample_size, actual + same * sample_size, sample_size) == 0)
+            {
+                same++;
+            }
+            return done + same;
+        }
+        done += span;
+        phase = 0;
+    }
+    return done;
+}
+
+/** Returns the shortest period the samples repeat with for a useful length, or 0 if there is none. */
+static long find_period(struct bcn_writer *writer, const char *samples, long len)
+{
+    size_t sample_size = writer->sample_size;
+    long max_period = len / 2 < BCN_MAX_PERIOD ? len / 2 : BCN_MAX_PERIOD;
+
+    for (long period = 1; period <= max_period; period++)
+    {
+        const char *next = samples + period * sample_size;
+        if (memcmp(samples, next, sample_size) != 0 || memcmp(samples, next, period * sample_size) != 0)
+        {
+            continue;
+        }
+        // Count how far the repetition goes on
+        long run = 2 * period;
+        while (run < len && memcmp(samples + (run - period) * sample_size, samples + run * sample_size, sample_size) == 0)
+        {
+            run++;
+        }
+        return run >= BCN_MIN_RUN ? period : 0;
+    }
+    return 0;
+}
+
+/** Returns the number of an existing pattern the samples are a rotation of and the rotation, or defines a new pattern.  Returns -1 if there is no room for more. */
+static long find_pattern(struct bcn_writer *writer, const char *samples, long period, uint64_t *offset)
+{
+    size_t sample_size = writer->sample_size;
+
+    for (uint32_t index = 0; index < writer->pattern_count; index++)
+    {
+        struct bcn_pattern *pattern = &writer->patterns[index];
+        if (pattern->len != period)
+        {
+            continue;
+        }
+        for (long rotation = 0; rotation < period; rotation++)
+        {
+            const char *tail = pattern->data + rotation * sample_size;
+            long tail_len = period - rotation;
+            if (memcmp(tail, samples, sample_size) == 0 &&
+                memcmp(tail, samples, tail_len * sample_size) == 0 &&
+                memcmp(pattern->data, samples + tail_len * sample_size, rotation * sample_size) == 0)
+            {
+                *offset = rotation;
+                return index;
+            }
+        }
+    }
+
+    if (writer->pattern_count == BCN_MAX_PATTERNS)
+    {
+        return -1;
+    }
+    struct bcn_pattern *patterns = realloc(writer->patterns, sizeof(struct bcn_pattern) * (writer->pattern_count + 1));
+    uint64_t *offsets = realloc(writer->pattern_offsets, sizeof(uint64_t) * (writer->pattern_count + 1));
+    if (patterns != NULL)
+    {
+        writer->patterns = patterns;
+    }
+    if (offsets != NULL)
+    {
+        writer->pattern_offsets = offsets;
+    }
+    char *data = malloc(period * sample_size);
+    if (patterns == NULL || offsets == NULL || data == NULL)
+    {
+        free(data);
+        writer->failed = true;
+        return -1;
+    }
+    memcpy(data, samples, period * sample_size);
+
+    uint32_t number = writer->pattern_count++;
+    writer->patterns[number].data = data;
+    writer->patterns[number].len = period;
+    writer->pattern_offsets[number] = writer->file_offset;
+    write_record(writer, BCN_PATTERN, number, 0, period);
+    write_bytes(writer, data, period * sample_size);
+    *offset = 0;
+    return number;
+}
+
+/** Encode buffered samples.  Unless final, enough is held back to find the next period. */
+static void encode(struct bcn_writer *writer, bool final)
+{
+    size_t sample_size = writer->sample_size;
+
+    while (writer->buf_pos < writer->buf_len && !writer->failed)
+    {
+        const char *samples = writer->buf + writer->buf_pos * sample_size;
+        long avail = writer->buf_len - writer->buf_pos;
+
+        if (writer->pending == BCN_SILENCE || writer->pending == BCN_REPEAT)
+        {
+            long used = extend_pending(writer, samples, avail);
+            writer->buf_pos += used;
+            writer->count += used;
+            writer->samples += used;
+            if (used == avail)
+            {
+                // The run may carry on into the next samples written
+                break;
+            }
+            flush_pending(writer);
+            continue;
+        }
+
+        if (!final && avail < BCN_LOOKAHEAD)
+        {
+            break;
+        }
+
+        long zeros = 0;
+        while (zeros < avail && zeros < BCN_MIN_RUN && is_zero(samples + zeros * sample_size, sample_size))
+        {
+            zeros++;
+        }
+        if (zeros == BCN_MIN_RUN)
+        {
+            start_pending(writer, BCN_SILENCE, 0, 0);
+            continue;
+        }
+
+        long period = find_period(writer, samples, avail);
+        if (period > 0)
+        {
+            // The pattern record has to come after any pending literal
+            flush_pending(writer);
+            uint64_t offset;
+            long pattern = find_pattern(writer, samples, period, &offset);
+            if (pattern >= 0)
+            {
+                start_pending(writer, BCN_REPEAT, pattern, offset);
+                continue;
+            }
+        }
+
+        // Nothing to compress here, so move on by a short literal stretch
+        if (writer->pending != BCN_LITERAL || writer->count == BCN_LITERAL_LEN)
+        {
+            start_pending(writer, BCN_LITERAL, 0, 0);
+        }
+        long len = avail < BCN_MIN_RUN ? avail : BCN_MIN_RUN;
+        if ((uint64_t)len > BCN_LITERAL_LEN - writer->count)
+        {
+            len = BCN_LITERAL_LEN - writer->count;
+        }
+        memcpy(writer->literal + writer->count * sample_size, samples, len * sample_size);
+        writer->count += len;
+        writer->buf_pos += len;
+        writer->samples += len;
+    }
+
+    // Move what is left to the front of the buffer
+    long left = writer->buf_len - writer->buf_pos;
+    memmove(writer->buf, writer->buf + writer->buf_pos * sample_size, left * sample_size);
+    writer->buf_len = left;
+    writer->buf_pos = 0;
+}
+
+static void write_header(struct bcn_writer *writer, uint64_t samples, uint64_t index_offset)
+{
+    struct bcn_header header;
+    header.magic = htole32(BCN_MAGIC);
+    header.version = htole16(BCN_VERSION);
+    header.format = htole16(writer->format);
+    header.samp_rate = htole64(writer->samp_rate);
+    header.samples = htole64(samples);
+    header.index_offset = htole64(index_offset);
+    write_bytes(writer, &header, sizeof(header));
+}
+
+struct bcn_writer *bcn_create(FILE *out, enum iq_format format, long samp_rate)
+{
+    struct bcn_writer *writer = calloc(1, sizeof(struct bcn_writer));
+    if (writer == NULL)
+    {
+        return NULL;
+    }
+    writer->out = out;
+    writer->format = format;
+    writer->sample_size = iq_sample_size(format);
+    writer->samp_rate = samp_rate;
+    writer->literal = malloc(BCN_LITERAL_LEN * writer->sample_size);
+    if (writer->literal == NULL)
+    {
+        free(writer);
+        return NULL;
+    }
+    write_header(writer, 0, 0);
+    return writer;
+}
+
+int bcn_write(struct bcn_writer *writer, const void *buf, long nsamples)
+{
+    if (writer->buf_len + nsamples > writer->buf_cap)
+    {
+        long cap = writer->buf_len + nsamples + BCN_LOOKAHEAD;
+        char *grown = realloc(writer->buf, cap * writer->sample_size);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        writer->buf = grown;
+        writer->buf_cap = cap;
+    }
+    memcpy(writer->buf + writer->buf_len * writer->sample_size, buf, nsamples * writer->sample_size);
+    writer->buf_len += nsamples;
+    encode(writer, false);
+    return writer->failed ? -1 : 0;
+}
+
+uint64_t bcn_written(const struct bcn_writer *writer)
+{
+    return writer->file_offset;
+}
+
+int bcn_close(struct bcn_writer *writer)
+{
+    encode(writer, true);
+    flush_pending(writer);
+    write_record(writer, BCN_END, 0, 0, 0);
+
+    uint64_t index_offset = writer->file_offset;
+    struct bcn_index_header index_header;
+    index_header.magic = htole32(BCN_INDEX_MAGIC);
+    index_header.patterns = htole32(writer->pattern_count);
+    index_header.entries = htole64(writer->index_len);
+    write_bytes(writer, &index_header, sizeof(index_header));
+    for (uint64_t index = 0; index < writer->index_len; index++)
+    {
+        struct bcn_index_entry entry;
+        entry.sample = htole64(writer->index[index].sample);
+        entry.offset = htole64(writer->index[index].offset);
+        write_bytes(writer, &entry, sizeof(entry));
+    }
+    for (uint32_t index = 0; index < writer->pattern_count; index++)
+    {
+        uint64_t offset = htole64(writer->pattern_offsets[index]);
+        write_bytes(writer, &offset, sizeof(offset));
+    }
+
+    // Point the header at the index.  A stream that cannot be rewound is
+    // still readable from start to end.
+    uint64_t end = writer->file_offset;
+    if (fflush(writer->out) == 0 && fseeko(writer->out, 0, SEEK_SET) == 0)
+    {
+        write_header(writer, writer->samples, index_offset);
+        fflush(writer->out);
+        fseeko(writer->out, end, SEEK_SET);
+    }
+    writer->file_offset = end;
+
+    int ret = writer->failed || ferror(writer->out) ? -1 : 0;
+    for (uint32_t index = 0; index < writer->pattern_count; index++)
+    {
+        free(writer->patterns[index].data);
+    }
+    free(writer->patterns);
+    free(writer->pattern_offsets);
+    free(writer->index);
+    free(writer->literal);
+    free(writer->buf);
+    free(writer);
+    return ret;
+}
+
+static bool read_record(struct bcn_reader *reader, struct bcn_record *record)
+{
+    if (fread(record, sizeof(*record), 1, reader->in) != 1)
+    {
+        return false;
+    }
+    record->type = le32toh(record->type);
+    record->pattern = le32toh(record->pattern);
+    record->offset = le64toh(record->offset);
+    record->count = le64toh(record->count);
+    return true;
+}
+
+/** Read the samples of a pattern record into the pattern table. */
+static bool load_pattern(struct bcn_reader *reader, struct bcn_record *record)
+{
+    if (record->pattern >= BCN_MAX_PATTERNS || record->count == 0 || record->count > BCN_MAX_PERIOD)
+    {
+        return false;
+    }
+    if (record->pattern >= reader->pattern_cap)
+    {
+        uint32_t cap = record->pattern + 1;
+        struct bcn_pattern *patterns = realloc(reader->patterns, sizeof(struct bcn_pattern) * cap);
+        if (patterns == NULL)
+        {
+            return false;
+        }
+        memset(patterns + reader->pattern_cap, 0, sizeof(struct bcn_pattern) * (cap - reader->pattern_cap));
+        reader->patterns = patterns;
+        reader->pattern_cap = cap;
+    }
+    struct bcn_pattern *pattern = &reader->patterns[record->pattern];
+    free(pattern->data);
+    pattern->len = record->count;
+    pattern->data = malloc(pattern->len * reader->sample_size);
+    return pattern->data != NULL && fread(pattern->data, reader->sample_size, pattern->len, reader->in) == (size_t)pattern->len;
+}
+
+/** Move on to the next record with samples.  Returns false at the end or on error. */
+static bool next_record(struct bcn_reader *reader)
+{
+    struct bcn_record record;
+    while (read_record(reader, &record))
+    {
+        switch (record.type)
+        {
+        case BCN_PATTERN:
+            if (!load_pattern(reader, &record))
+            {
+                return false;
+            }
+            break;
+        case BCN_REPEAT:
+            if (record.pattern >= reader->pattern_cap || reader->patterns[record.pattern].data == NULL)
+            {
+                return false;
+            }
+            // Fall through
+        case BCN_SILENCE:
+        case BCN_LITERAL:
+            reader->type = record.type;
+            reader->pattern = record.pattern;
+            reader->offset = record.offset;
+            reader->left = record.count;
+            return true;
+        case BCN_END:
+            reader->ended = true;
+            return false;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+/** Load the index and every pattern into the reader.  Returns 0 on success or -1 if the file has no usable index. */
+static int load_index(struct bcn_reader *reader)
+{
+    struct bcn_index_header index_header;
+    if (reader->header.index_offset == 0 ||
+        fseeko(reader->in, reader->header.index_offset, SEEK_SET) != 0 ||
+        fread(&index_header, sizeof(index_header), 1, reader->in) != 1 ||
+        le32toh(index_header.magic) != BCN_INDEX_MAGIC)
+    {
+        return -1;
+    }
+    uint32_t pattern_count = le32toh(index_header.patterns);
+    uint64_t entry_count = le64toh(index_header.entries);
+    struct bcn_index_entry *entries = malloc(sizeof(struct bcn_index_entry) * (entry_count + 1));
+    uint64_t *pattern_offsets = malloc(sizeof(uint64_t) * (pattern_count + 1));
+    if (entries == NULL || pattern_offsets == NULL ||
+        fread(entries, sizeof(struct bcn_index_entry), entry_count, reader->in) != entry_count ||
+        fread(pattern_offsets, sizeof(uint64_t), pattern_count, reader->in) != pattern_count)
+    {
+        free(entries);
+        free(pattern_offsets);
+        return -1;
+    }
+    for (uint64_t index = 0; index < entry_count; index++)
+    {
+        entries[index].sample = le64toh(entries[index].sample);
+        entries[index].offset = le64toh(entries[index].offset);
+    }
+
+    int ret = 0;
+    for (uint32_t index = 0; index < pattern_count && ret == 0; index++)
+    {
+        struct bcn_record record;
+        if (fseeko(reader->in, le64toh(pattern_offsets[index]), SEEK_SET) != 0 ||
+            !read_record(reader, &record) || record.type != BCN_PATTERN || !load_pattern(reader, &record))
+        {
+            ret = -1;
+        }
+    }
+    free(pattern_offsets);
+    if (ret < 0)
+    {
+        free(entries);
+        return -1;
+    }
+    reader->entries = entries;
+    reader->entry_count = entry_count;
+    return 0;
+}
+
+struct bcn_reader *bcn_open(FILE *in)
+{
+    struct bcn_reader *reader = calloc(1, sizeof(struct bcn_reader));
+    if (reader == NULL)
+    {
+        return NULL;
+    }
+    reader->in = in;
+    struct bcn_header *header = &reader->header;
+    if (fread(header, sizeof(*header), 1, in) != 1 ||
+        le32toh(header->magic) != BCN_MAGIC || le16toh(header->version) != BCN_VERSION)
+    {
+        free(reader);
+        return NULL;
+    }
+    header->format = le16toh(header->format);
+    header->samp_rate = le64toh(header->samp_rate);
+    header->samples = le64toh(header->samples);
+    header->index_offset = le64toh(header->index_offset);
+    if (header->format > FORMAT_CF32)
+    {
+        free(reader);
+        return NULL;
+    }
+    reader->sample_size = iq_sample_size(header->format);
+
+    // Seeks use the index from here on, so read it now and go back to the
+    // records.  A file that can't be rewound (a pipe) is read in order.
+    if (header->index_offset != 0)
+    {
+        load_index(reader);
+        if (fseeko(in, sizeof(struct bcn_header), SEEK_SET) != 0 && reader->entries != NULL)
+        {
+            bcn_free(reader);
+            return NULL;
+        }
+    }
+    return reader;
+}
+
+struct bcn_info bcn_reader_info(const struct bcn_reader *reader)
+{
+    struct bcn_info info;
+    info.format = reader->header.format;
+    info.samp_rate = reader->header.samp_rate;
+    info.samples = reader->header.samples;
+    return info;
+}
+
+long bcn_read(struct bcn_reader *reader, void *buf, long nsamples)
+{
+    size_t sample_size = reader->sample_size;
+    char *out = buf;
+    long done = 0;
+
+    while (done < nsamples)
+    {
+        if (reader->left == 0)
+        {
+            if (reader->ended || !next_record(reader))
+            {
+                if (!reader->ended)
+                {
+                    return done > 0 ? done : -1;
+                }
+                break;
+            }
+            continue;
+        }
+
+        long len = nsamples - done;
+        if ((uint64_t)len > reader->left)
+        {
+            len = reader->left;
+        }
+        char *dest = out + done * sample_size;
+
+        switch (reader->type)
+        {
+        case BCN_SILENCE:
+            memset(dest, 0, len * sample_size);
+            break;
+        case BCN_LITERAL:
+            if (fread(dest, sample_size, len, reader->in) != (size_t)len)
+            {
+                return -1;
+            }
+            break;
+        default:
+        {
+            // Unroll the pattern from the current phase
+            struct bcn_pattern *pattern = &reader->patterns[reader->pattern];
+            long phase = reader->offset % pattern->len;
+            long copied = 0;
+            while (copied < len)
+            {
+                long span = pattern->len - phase;
+                if (span > len - copied)
+                {
+                    span = len - copied;
+                }
+                memcpy(dest + copied * sample_size, pattern->data + phase * sample_size, span * sample_size);
+                copied += span;
+                phase = 0;
+            }
+            reader->offset += len;
+            break;
+        }
+        }
+        reader->left -= len;
+        done += len;
+    }
+    return done;
+}
+
+int bcn_seek(struct bcn_reader *reader, uint64_t sample)
+{
+    if (reader->entries == NULL || sample > reader->header.samples)
+    {
+        return -1;
+    }
+
+    // Start from the last indexed record at or before the sample
+    uint64_t position = 0;
+    off_t offset = sizeof(struct bcn_header);
+    uint64_t low = 0, high = reader->entry_count;
+    while (low < high)
+    {
+        uint64_t mid = (low + high) / 2;
+        if (reader->entries[mid].sample <= sample)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    if (low > 0)
+    {
+        position = reader->entries[low - 1].sample;
+        offset = reader->entries[low - 1].offset;
+    }
+
+    if (fseeko(reader->in, offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    reader->left = 0;
+    reader->ended = false;
+
+    // Skip whole records, then into the one holding the sample
+    while (position < sample || reader->left == 0)
+    {
+        if (!next_record(reader))
+        {
+            return reader->ended && position == sample ? 0 : -1;
+        }
+        uint64_t skip = sample - position;
+        if (skip > reader->left)
+        {
+            skip = reader->left;
+        }
+        if (reader->type == BCN_LITERAL && fseeko(reader->in, skip * reader->sample_size, SEEK_CUR) != 0)
+        {
+            return -1;
+        }
+        if (reader->type == BCN_REPEAT)
+        {
+            reader->offset += skip;
+        }
+        reader->left -= skip;
+        position += skip;
+        if (position == sample && reader->left > 0)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+void bcn_free(struct bcn_reader *reader)
+{
+    if (reader == NULL)
+    {
+        return;
+    }
+    for (uint32_t index = 0; index < reader->pattern_cap; index++)
+    {
+        free(reader->patterns[index].data);
+    }
+    free(reader->patterns);
+    free(reader->entries);
+    free(reader);
+}
@@ -0,0 +1,152 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File bcn.h */
+#ifndef FILE_BCN_H_SEEN
+#define FILE_BCN_H_SEEN
+
+#include "../config.h"
+#include "beacon.h"
+#include "iq.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+  A .bcn file holds packed IQ samples in a compact form that suits keyed CW.
+  All values are little endian.
+
+  The file starts with a bcn_header, followed by records.  Each record is a
+  bcn_record followed, for patterns and literals, by packed samples:
+
+    BCN_PATTERN  defines pattern number `pattern` as the `count` samples that follow
+    BCN_SILENCE  `count` zero samples
+    BCN_REPEAT   `count` samples of pattern `pattern` repeated, starting `offset` samples into it
+    BCN_LITERAL  the `count` samples that follow, as is
+    BCN_END      the end of the samples
+
+  After BCN_END comes the seek index: a bcn_index_header, the bcn_index_entry
+  list, then the file offset of each pattern record.  header.index_offset
+  points at it, or is 0 if the file could not be rewritten when it was
+  closed (e.g. a pipe).  The records alone are enough to stream the file.
+*/
+
+/* "BCNF" and "BIDX" */
+#define BCN_MAGIC 0x464e4342
+#define BCN_INDEX_MAGIC 0x58444942
+#define BCN_VERSION 1
+
+/* Longest period searched for, in samples */
+#define BCN_MAX_PERIOD 65536
+
+/* Shortest run of silence or repeats stored as its own record */
+#define BCN_MIN_RUN 64
+
+/* Most samples in one literal record */
+#define BCN_LITERAL_LEN 4096
+
+/* Most patterns in one file */
+#define BCN_MAX_PATTERNS 65536
+
+/* Samples between seek index entries */
+#define BCN_INDEX_INTERVAL 1048576
+
+enum bcn_record_type
+{
+    BCN_PATTERN = 1,
+    BCN_SILENCE,
+    BCN_REPEAT,
+    BCN_LITERAL,
+    BCN_END
+};
+
+struct bcn_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t format;
+    uint64_t samp_rate;
+    uint64_t samples;
+    uint64_t index_offset;
+};
+
+struct bcn_record
+{
+    uint32_t type;
+    uint32_t pattern;
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct bcn_index_header
+{
+    uint32_t magic;
+    uint32_t patterns;
+    uint64_t entries;
+};
+
+/** A record that starts at the given sample. */
+struct bcn_index_entry
+{
+    uint64_t sample;
+    uint64_t offset;
+};
+
+/** What a reader found in a file header. */
+struct bcn_info
+{
+    enum iq_format format;
+    long samp_rate;
+    /** Total samples, or 0 if the file has no index */
+    uint64_t samples;
+};
+
+struct bcn_writer;
+struct bcn_reader;
+
+/** Start writing a .bcn file of the given format to out, which must be open for writing.  Returns NULL on error. */
+struct bcn_writer *bcn_create(FILE *out, enum iq_format format, long samp_rate);
+
+/** Add packed samples to the file.  Returns 0 on success or -1 on error. */
+int bcn_write(struct bcn_writer *writer, const void *buf, long nsamples);
+
+/** Returns the number of bytes written so far. */
+uint64_t bcn_written(const struct bcn_writer *writer);
+
+/** Write out everything buffered, the index and the final header, and free the writer.  Does not close the file.  Returns 0 on success or -1 on error. */
+int bcn_close(struct bcn_writer *writer);
+
+/** Start reading a .bcn file from in.  Returns NULL if it is not a .bcn file. */
+struct bcn_reader *bcn_open(FILE *in);
+
+/** Returns the format, sampling rate and length of the file. */
+struct bcn_info bcn_reader_info(const struct bcn_reader *reader);
+
+/** Read up to nsamples packed samples.  Returns the number read, 0 at the end of the file, or -1 on error. */
+long bcn_read(struct bcn_reader *reader, void *buf, long nsamples);
+
+/** Move to the given sample using the index.  Returns 0 on success or -1 if the file has no index or the sample is past the end. */
+int bcn_seek(struct bcn_reader *reader, uint64_t sample);
+
+/** Free a reader.  Does not close the file. */
+void bcn_free(struct bcn_reader *reader);
+
+#endif /* !FILE_BCN_H_SEEN */
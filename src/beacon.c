@@ -0,0 +1,412 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "beacon.h"
+#include "iq.h"
+#include "cw.h"
+
+/* Samples rendered per pass through the signal chain */
+#define BEACON_CHUNK_LEN 4096
+
+struct beacon
+{
+    struct arena *arena;
+    struct beacon_params params;
+    char *message;
+    long dit_len;
+    long key_offset;
+    long long sample;
+    bool *pattern;
+    int pattern_len;
+    struct iq_state *carrier_state;
+    struct iq_state *idle_state;
+    struct iq_state *tone_state;
+    struct iq_state *keyed_state;
+    complex *iq;
+
+    // Raised cosine rise of the key in CW mode, edge_len samples long.  Live
+    // keying remembers when the key last changed and the level it ramps from.
+    double *edge;
+    long edge_len;
+    bool keyed_down;
+    long long key_changed;
+    double edge_from;
+};
+
+struct beacon *beacon_create(const struct beacon_params *params)
+{
+    if (params->samp_rate <= 0 || params->message == NULL ||
+        params->tone_freq <= 0 || params->samp_rate < 2 * params->tone_freq ||
+        params->carrier_freq <= 0 || params->samp_rate < 2 * params->carrier_freq ||
+        params->wpm <= 0 || calc_dit_len(params->samp_rate, params->wpm) <= 0 ||
+        params->padding < 0 ||
+        (params->modulation == MOD_CW && params->samp_rate < 2 * (params->carrier_freq + params->tone_freq)))
+    {
+        return NULL;
+    }
+
+    // Everything the context renders from comes out of one arena, sized here
+    int cw_len = strlen(params->message) * CW_MAX_CHAR_LEN + params->padding * 7 + 1;
+    size_t size = ARENA_ALIGNED(sizeof(struct beacon)) +
+                  ARENA_ALIGNED(strlen(params->message) + 1) +
+                  ARENA_ALIGNED(sizeof(bool) * cw_len) +
+                  ARENA_ALIGNED(sizeof(complex) * BEACON_CHUNK_LEN) +
+                  2 * iq_state_size(params->carrier_freq, params->samp_rate) +
+                  iq_state_size(params->tone_freq, params->samp_rate);
+    long edge_max = 0;
+    if (params->modulation == MOD_CW)
+    {
+        edge_max = (long)(params->samp_rate * BEACON_CW_EDGE_MS / 1000);
+        size += exact_iq_state_size(params->carrier_freq + params->tone_freq, params->samp_rate) +
+                ARENA_ALIGNED(sizeof(double) * edge_max);
+    }
+    struct arena *arena = arena_create(size, params->hugepages);
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    struct beacon *ctx = arena_alloc(arena, sizeof(struct beacon));
+    memset(ctx, 0, sizeof(struct beacon));
+    ctx->arena = arena;
+    ctx->params = *params;
+    ctx->message = arena_alloc(arena, strlen(params->message) + 1);
+    strcpy(ctx->message, params->message);
+    ctx->params.message = ctx->message;
+    ctx->pattern = arena_alloc(arena, sizeof(bool) * cw_len);
+    ctx->iq = arena_alloc(arena, sizeof(complex) * BEACON_CHUNK_LEN);
+    ctx->pattern_len = generate_cw_pattern(ctx->pattern, cw_len, params->message, params->padding);
+    if (ctx->pattern_len == 0)
+    {
+        // Nothing to key and no padding: the message has no length
+        arena_destroy(arena);
+        return NULL;
+    }
+
+    // Build the sample tables up front rather than on the first render
+    ctx->carrier_state = create_iq_state(params->carrier_freq, params->samp_rate, arena);
+    ctx->carrier_state = generate_carrier(params->carrier_freq, params->samp_rate, ctx->iq, 0, ctx->carrier_state);
+    ctx->tone_state = create_iq_state(params->tone_freq, params->samp_rate, arena);
+    ctx->tone_state = generate_tone(params->tone_freq, params->samp_rate, NULL, 0, ctx->tone_state);
+
+    // The carrier that remains while the key is up, see modulate_am()
+    ctx->idle_state = create_iq_state(params->carrier_freq, params->samp_rate, arena);
+    ctx->idle_state = generate_carrier(params->carrier_freq, params->samp_rate, ctx->iq, 0, ctx->idle_state);
+    scale_iq_state(ctx->idle_state, params->modulation_index / 10);
+
+    // The keyed tone already sits at its final frequency and amplitude, so
+    // in CW mode rendering is a table copy.  A table of whole cycles keeps it
+    // on frequency where one period isn't a whole number of samples.
+    if (params->modulation == MOD_CW)
+    {
+        ctx->keyed_state = create_exact_iq_state(params->carrier_freq + params->tone_freq, params->samp_rate, arena);
+        ctx->keyed_state = generate_carrier(params->carrier_freq + params->tone_freq, params->samp_rate, ctx->iq, 0, ctx->keyed_state);
+        scale_iq_state(ctx->keyed_state, params->modulation_index);
+    }
+
+    // Keying starts at the first zero crossing of the tone and changes every
+    // whole number of half periods after that, so the keying state at any
+    // sample can be computed directly.
+    long tone_period = ctx->tone_state->table.len;
+    ctx->dit_len = calc_element_len(calc_dit_len(params->samp_rate, params->wpm), tone_period);
+    ctx->key_offset = tone_period >= 4 ? tone_period / 4 - 1 : 0;
+
+    // Each edge fits in the first element after a key change
+    if (params->modulation == MOD_CW)
+    {
+        ctx->edge_len = edge_max < ctx->dit_len ? edge_max : ctx->dit_len;
+        ctx->edge = arena_alloc(arena, sizeof(double) * edge_max);
+        for (long index = 0; index < ctx->edge_len; index++)
+        {
+            ctx->edge[index] = 0.5 - 0.5 * cos(PI * index / ctx->edge_len);
+        }
+    }
+    beacon_seek(ctx, 0);
+
+    return ctx;
+}
+
+/** Render a span where the key is down: the tone modulated onto the carrier, or the keyed tone in CW mode. */
+static void render_key_down(struct beacon *ctx, complex *iq, long len)
+{
+    struct beacon_params *params = &ctx->params;
+
+    if (params->modulation == MOD_CW)
+    {
+        ctx->keyed_state = generate_carrier(params->carrier_freq + params->tone_freq, params->samp_rate, iq, len, ctx->keyed_state);
+        return;
+    }
+
+    // The modulators read the carrier and tone where they sit in their rings
+    long span = ctx->carrier_state->iq.span < ctx->tone_state->samples.span ? ctx->carrier_state->iq.span : ctx->tone_state->samples.span;
+    for (long done = 0, part; done < len; done += part)
+    {
+        part = len - done < span ? len - done : span;
+        const complex *carrier = carrier_window(ctx->carrier_state, part);
+        const double *tone = tone_window(ctx->tone_state, part);
+        switch (params->modulation)
+        {
+        case MOD_FM:
+            modulate_fm(iq + done, carrier, tone, part, params->modulation_index);
+            break;
+        default:
+            modulate_am(iq + done, carrier, tone, part, params->modulation_index);
+            break;
+        }
+    }
+}
+
+/** Render a span where the key is up.  With no tone the modulators reduce to a constant for FM and the scaled carrier for AM, so neither the tone nor the modulation product is computed.  CW mode is silent. */
+static void render_key_up(struct beacon *ctx, complex *iq, long len)
+{
+    struct beacon_params *params = &ctx->params;
+
+    switch (params->modulation)
+    {
+    case MOD_FM:
+        for (long index = 0; index < len; index++)
+        {
+            iq[index] = 1.0;
+        }
+        break;
+    case MOD_CW:
+        memset(iq, 0, sizeof(complex) * len);
+        break;
+    default:
+        ctx->idle_state = generate_carrier(params->carrier_freq, params->samp_rate, iq, len, ctx->idle_state);
+        break;
+    }
+}
+
+/** Render len samples starting at the given absolute sample with the key held in one state. */
+static void render_span(struct beacon *ctx, complex *iq, long long sample, long len, bool key_down)
+{
+    seek_iq_state(ctx->carrier_state, sample);
+    seek_iq_state(ctx->idle_state, sample);
+    seek_iq_state(ctx->tone_state, sample);
+    if (ctx->keyed_state != NULL)
+    {
+        seek_iq_state(ctx->keyed_state, sample);
+    }
+
+    if (key_down)
+    {
+        for (long span = 0; span < len; span += BEACON_CHUNK_LEN)
+        {
+            long chunk = len - span;
+            if (chunk > BEACON_CHUNK_LEN)
+            {
+                chunk = BEACON_CHUNK_LEN;
+            }
+            render_key_down(ctx, iq + span, chunk);
+        }
+    }
+    else
+    {
+        render_key_up(ctx, iq, len);
+    }
+}
+
+/** Returns the envelope of a key edge since samples after the key changed, ramping from the level from. */
+static double edge_level(const struct beacon *ctx, long long since, bool key_down, double from)
+{
+    double rise = since >= 0 && since < ctx->edge_len ? ctx->edge[since] : 1.0;
+    return key_down ? from + (1.0 - from) * rise : from * (1.0 - rise);
+}
+
+/** Render len samples with the key held in one state, since samples after it changed.  In CW mode the keyed tone is ramped from the level from over the first edge_len samples, so the key doesn't click. */
+static void render_keyed_span(struct beacon *ctx, complex *iq, long long sample, long len, bool key_down, long long since, double from)
+{
+    if (since >= 0 && since < ctx->edge_len)
+    {
+        long ramp = ctx->edge_len - since < len ? ctx->edge_len - since : len;
+        render_span(ctx, iq, sample, ramp, true);
+        for (long index = 0; index < ramp; index++)
+        {
+            iq[index] *= edge_level(ctx, since + index, key_down, from);
+        }
+        iq += ramp;
+        sample += ramp;
+        len -= ramp;
+    }
+    if (len > 0)
+    {
+        render_span(ctx, iq, sample, len, key_down);
+    }
+}
+
+long beacon_render_iq(struct beacon *ctx, beacon_iq *iq, long nsamples)
+{
+    long done = 0;
+
+    // Walk the keying timeline one element at a time so that each span is
+    // either entirely key down or entirely key up.
+    while (done < nsamples)
+    {
+        long long sample = ctx->sample + done;
+        struct cw_state cw = cw_state_at(sample, ctx->dit_len, ctx->key_offset, ctx->pattern, ctx->pattern_len);
+
+        long len = nsamples - done;
+        if (len > cw.samples_left)
+        {
+            len = cw.samples_left;
+        }
+
+        // Edges sit at the start of the first element after a key change
+        long long since = -1;
+        long long elapsed = sample - ctx->key_offset;
+        if (elapsed >= 0)
+        {
+            long long current = elapsed / ctx->dit_len;
+            bool previous = current > 0 && ctx->pattern[(current - 1) % ctx->pattern_len];
+            if (previous != cw.value)
+            {
+                since = elapsed % ctx->dit_len;
+            }
+        }
+        render_keyed_span(ctx, iq + done, sample, len, cw.value, since, cw.value ? 0.0 : 1.0);
+        done += len;
+    }
+    ctx->sample += nsamples;
+    return nsamples;
+}
+
+long beacon_render_keyed(struct beacon *ctx, beacon_iq *iq, long nsamples, int key_down)
+{
+    // A change part way through an edge ramps on from where that edge got to
+    if ((key_down != 0) != ctx->keyed_down)
+    {
+        ctx->edge_from = edge_level(ctx, ctx->sample - ctx->key_changed, ctx->keyed_down, ctx->edge_from);
+        ctx->key_changed = ctx->sample;
+        ctx->keyed_down = key_down != 0;
+    }
+    render_keyed_span(ctx, iq, ctx->sample, nsamples, ctx->keyed_down, ctx->sample - ctx->key_changed, ctx->edge_from);
+    ctx->sample += nsamples;
+    return nsamples;
+}
+
+long beacon_render(struct beacon *ctx, void *buf, long nsamples, enum iq_format format)
+{
+    size_t sample_size = iq_sample_size(format);
+
+    for (long done = 0; done < nsamples; done += BEACON_CHUNK_LEN)
+    {
+        long len = nsamples - done;
+        if (len > BEACON_CHUNK_LEN)
+        {
+            len = BEACON_CHUNK_LEN;
+        }
+        beacon_render_iq(ctx, ctx->iq, len);
+        pack_iq(format, (char *)buf + done * sample_size, ctx->iq, len);
+    }
+    return nsamples;
+}
+
+void beacon_seek(struct beacon *ctx, long long sample)
+{
+    // Rendering positions the sample tables from the keying timeline.  Live
+    // keying carries on from a steady key.
+    ctx->sample = sample;
+    ctx->key_changed = sample - ctx->edge_len;
+}
+
+long long beacon_tell(const struct beacon *ctx)
+{
+    return ctx->sample;
+}
+
+long long beacon_next_cycle(const struct beacon *ctx)
+{
+    // The first repetition starts at the key offset and each one is a whole
+    // number of elements long
+    long long cycle_len = (long long)ctx->dit_len * ctx->pattern_len;
+    long long elapsed = ctx->sample - ctx->key_offset;
+    long long cycles = elapsed < 0 ? 0 : elapsed / cycle_len;
+    return ctx->key_offset + (cycles + 1) * cycle_len;
+}
+
+/** Returns the least common multiple of a and b, or 0 if it overflows. */
+static long long lcm(long long a, long long b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+    long long x = a, y = b;
+    while (y != 0)
+    {
+        long long t = x % y;
+        x = y;
+        y = t;
+    }
+    long long multiple;
+    return __builtin_mul_overflow(a / x, b, &multiple) ? 0 : multiple;
+}
+
+long long beacon_period(const struct beacon *ctx, long long *start)
+{
+    // From the first key change on, the keying repeats every cycle and each
+    // sample table every table length
+    *start = ctx->key_offset;
+    long long period = lcm((long long)ctx->dit_len * ctx->pattern_len, ctx->carrier_state->table.len);
+    period = lcm(period, ctx->tone_state->table.len);
+    if (ctx->keyed_state != NULL)
+    {
+        period = lcm(period, ctx->keyed_state->table.len);
+    }
+    return period;
+}
+
+size_t beacon_footprint(const struct beacon *ctx)
+{
+    return ctx->arena->size;
+}
+
+int beacon_hugepages(const struct beacon *ctx)
+{
+    return ctx->arena->hugepages;
+}
+
+long beacon_dit_len(const struct beacon *ctx)
+{
+    return ctx->dit_len;
+}
+
+double beacon_keyed_freq(const struct beacon *ctx)
+{
+    return ctx->keyed_state != NULL ? iq_state_freq(ctx->keyed_state, ctx->params.samp_rate) : 0;
+}
+
+void beacon_destroy(struct beacon *ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+    // Mirrored rings are mapped apart from the arena
+    destroy_iq_state(ctx->carrier_state);
+    destroy_iq_state(ctx->idle_state);
+    destroy_iq_state(ctx->tone_state);
+    destroy_iq_state(ctx->keyed_state);
+
+    // The context itself lives in its arena
+    arena_destroy(ctx->arena);
+}
@@ -0,0 +1,116 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File beacon.h */
+#ifndef FILE_BEACON_H_SEEN
+#define FILE_BEACON_H_SEEN
+
+#ifdef __cplusplus
+#include <complex>
+typedef std::complex<double> beacon_iq;
+extern "C" {
+#else
+#include <complex.h>
+typedef double complex beacon_iq;
+#endif
+
+#include <stddef.h>
+
+/* Rise and fall time of the key in CW mode, in milliseconds */
+#define BEACON_CW_EDGE_MS 5.0
+
+enum modulation
+{
+    MOD_AM,
+    MOD_FM,
+    /** A single complex exponential at carrier_freq + tone_freq, switched on and off by the keying */
+    MOD_CW
+};
+
+enum iq_format
+{
+    FORMAT_CI32,
+    FORMAT_CS16,
+    FORMAT_CF32
+};
+
+/** Parameters of the rendered signal. */
+struct beacon_params
+{
+    long samp_rate;
+    long carrier_freq;
+    long tone_freq;
+    int wpm;
+    const char *message;
+    int padding;
+    enum modulation modulation;
+    double modulation_index;
+    /** Nonzero to back the context's memory with 2 MB huge pages where available */
+    int hugepages;
+};
+
+/** A rendering context.  Contexts share no state, so separate contexts may be used from separate threads. */
+struct beacon;
+
+/** Create a rendering context.  The message is copied.  Returns NULL if the parameters are invalid (including a message with nothing to send in Morse code and no padding) or memory could not be allocated. */
+struct beacon *beacon_create(const struct beacon_params *params);
+
+/** Render the next nsamples samples of the signal.  Returns the number of samples rendered. */
+long beacon_render_iq(struct beacon *ctx, beacon_iq *iq, long nsamples);
+
+/** Render the next nsamples samples with the key held down (nonzero) or up, ignoring the message.  For keying live. */
+long beacon_render_keyed(struct beacon *ctx, beacon_iq *iq, long nsamples, int key_down);
+
+/** Render the next nsamples samples of the signal packed in the given format.  Returns the number of samples rendered. */
+long beacon_render(struct beacon *ctx, void *buf, long nsamples, enum iq_format format);
+
+/** Move to the given absolute sample index.  Rendering from any index gives the same samples as rendering up to it from the start. */
+void beacon_seek(struct beacon *ctx, long long sample);
+
+/** Returns the absolute index of the next sample to be rendered. */
+long long beacon_tell(const struct beacon *ctx);
+
+/** Returns the absolute index of the sample at which the message next starts over. */
+long long beacon_next_cycle(const struct beacon *ctx);
+
+/** Returns the number of samples after which the signal repeats exactly, from the sample stored in start onward, or 0 if that does not fit in a long long. */
+long long beacon_period(const struct beacon *ctx, long long *start);
+
+/** Returns the number of bytes of memory the context renders from. */
+size_t beacon_footprint(const struct beacon *ctx);
+
+/** Returns nonzero if the context's memory is backed by huge pages. */
+int beacon_hugepages(const struct beacon *ctx);
+
+/** Returns the number of samples per dit, rounded up to a whole number of tone half periods. */
+long beacon_dit_len(const struct beacon *ctx);
+
+/** Returns the frequency of the keyed tone in CW mode, or 0 in other modes. */
+double beacon_keyed_freq(const struct beacon *ctx);
+
+/** Free a rendering context. */
+void beacon_destroy(struct beacon *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !FILE_BEACON_H_SEEN */
@@ -20,91 +20,50 @@
 
 #include "cw.h"
 
-const char *cw = "A.-B-...C-.-.D-..E.F..-.G--.H....I..J.---K-.-L.-..M--N-.O---P.--.Q--.-R.-.S...T-U..-V...-W.--X-..-Y-.--Z--..1.----2..---3...--4....-5.....6-....7--...8---..9----.0----- _";
 // Dits per word, based on "PARIS ".
-const int DITS_PER_WORD = 50;
+static const int DITS_PER_WORD = 50;
+
+/** Append count copies of value to the pattern.  Returns false, appending nothing, if they don't fit. */
+static bool append(bool *pattern, int buffer_len, int *pos, bool value, int count)
+{
+    if (buffer_len - *pos < count)
+    {
+        return false;
+    }
+    for (int slot = 0; slot < count; slot++)
+    {
+        pattern[(*pos)++] = value;
+    }
+    return true;
+}
 
 /** Converts the given message into a pattern and stores it in the provided pattern array.  Returns the number of values stored in the pattern array. */
 int generate_cw_pattern(bool *pattern, int buffer_len, const char *message, int final_padding_spaces)
 {
     int pos = 0;
-    int message_len = strlen(message);
-    for (int i = 0; i < message_len; i++)
+    bool room = true;
+    for (const char *c = message; *c != '\0' && room; c++)
     {
-        char *c = strchr(cw, toupper(message[i]));
-        if (c != NULL)
+        uint16_t code = morse_table[(unsigned char)*c];
+        if (code == 0)
         {
-            bool done = false;
-            while (!done)
-            {
-                c++;
-                switch (*c)
-                {
-                case '.':
-                    // on for 1 time slot for dit
-                    if (buffer_len - pos < 1)
-                    {
-                        done = true;
-                    }
-                    else
-                    {
-                        pattern[pos++] = true;
-                    }
-                    break;
-                case '-':
-                    // on for 3 time slots for dah
-                    if (buffer_len - pos < 3)
-                    {
-                        done = true;
-                    }
-                    else
-                    {
-                        pattern[pos++] = true;
-                        pattern[pos++] = true;
-                        pattern[pos++] = true;
-                    }
-                    break;
-                case '_':
-                    // off for 7 time slots between words
-                    // we only add 4 here because another 3 will be added below
-                    if (buffer_len - pos < 4)
-                    {
-                        done = true;
-                    }
-                    else
-                    {
-                        pattern[pos++] = false;
-                        pattern[pos++] = false;
-                        pattern[pos++] = false;
-                        pattern[pos++] = false;
-                    }
-                    break;
-                default:
-                    done = true;
-                    break;
-                };
-                // off for 1 time slot between dits and dahs
-                if (buffer_len - pos < 1)
-                {
-                    break;
-                }
-                else
-                {
-                    pattern[pos++] = false;
-                }
-            }
-            // off for 3 time slots between letters
-            // we only add 2 here because 1 was added above
-            if (buffer_len - pos < 2)
-            {
-                break;
-            }
-            else
-            {
-                pattern[pos++] = false;
-                pattern[pos++] = false;
-            }
+            continue;
         }
+        if (code == MORSE_WORD_SPACE)
+        {
+            // off between words: the 4 slots that end the previous
+            // character and 8 more
+            room = append(pattern, buffer_len, &pos, false, 4) && append(pattern, buffer_len, &pos, false, 4);
+            continue;
+        }
+        for (int element = 0; element < MORSE_LEN(code) && room; element++)
+        {
+            // on for 1 time slot for dit or 3 for dah, then off for 1 between them
+            room = append(pattern, buffer_len, &pos, true, MORSE_IS_DAH(code, element) ? 3 : 1) &&
+                   append(pattern, buffer_len, &pos, false, 1);
+        }
+        // off for 3 more time slots between letters
+        room = room && append(pattern, buffer_len, &pos, false, 3);
     }
     // off for 7 time slots between words
     int padding = 7 * final_padding_spaces;
@@ -119,19 +78,51 @@ int generate_cw_pattern(bool *pattern, int buffer_len, const char *message, int
 long calc_dit_len(long samp_rate, int wpm)
 {
     long dits_per_sec = wpm * DITS_PER_WORD / 60;
+    if (dits_per_sec <= 0)
+    {
+        return 0;
+    }
     long samples_per_dit = samp_rate / dits_per_sec;
     return samples_per_dit;
 }
 
+long calc_element_len(long dit_len, long tone_period)
+{
+    long half_period = tone_period / 2;
+    if (half_period <= 0)
+    {
+        return dit_len;
+    }
+    return (dit_len + half_period - 1) / half_period * half_period;
+}
+
+struct cw_state cw_state_at(long long sample, long element_len, long offset, bool *pattern, int pattern_len)
+{
+    struct cw_state state;
+    if (sample < offset)
+    {
+        // Key up until the tone first crosses zero
+        state.element = 0;
+        state.value = false;
+        state.samples_left = offset - sample;
+        return state;
+    }
+    long long elapsed = sample - offset;
+    long long current = elapsed / element_len;
+    state.element = (current + 1) % pattern_len;
+    state.value = pattern[current % pattern_len];
+    state.samples_left = element_len - elapsed % element_len;
+    return state;
+}
+
 struct cw_state modulate_cw(double *samples, int samples_len, int dit_len, bool *pattern, int pattern_len, struct cw_state state)
 {
     for (int index = 0; index < samples_len; index++)
     {
-        double i = samples[index];
-
-        if (state.samples_left < 1 && i > -0.000001 && i < 0.00001)
+        if (state.samples_left < 1)
         {
-            // Move to next element when i is 0
+            // Move to the next element.  Elements are a whole number of tone
+            // half periods long, so this always happens at a zero crossing.
             state.value = pattern[state.element];
             state.samples_left = dit_len;
             state.element = (state.element + 1) % pattern_len;
@@ -23,12 +23,16 @@
 #define FILE_CW_H_SEEN
 
 #include "../config.h"
+#include "tables.h"
 
 #include <stdbool.h>
 #include <complex.h>
 #include <ctype.h>
 #include <string.h>
 
+/** The most pattern values a single character can produce: seven dahs and the gaps after them. */
+#define CW_MAX_CHAR_LEN 31
+
 struct cw_state
 {
     int element;
@@ -39,10 +43,16 @@ struct cw_state
 /** Converts the given message into a pattern and stores it in the provided pattern array.  Returns the number of values stored in the pattern array. */
 int generate_cw_pattern(bool *pattern, int buffer_len, const char *message, int final_padding_spaces);
 
-/** Calculate the number of samples per dit. */
+/** Calculate the number of samples per dit.  Returns 0 if the speed is too slow to represent. */
 long calc_dit_len(long samp_rate, int wpm);
 
-/** Modulate a CW signal on to the provided tone samples with the given CW message. */
+/** Round the dit length up to a whole number of tone half periods, so that keying always changes at a zero crossing of the tone. */
+long calc_element_len(long dit_len, long tone_period);
+
+/** Compute the keying state at an absolute sample index, for a pattern whose first element starts offset samples in. */
+struct cw_state cw_state_at(long long sample, long element_len, long offset, bool *pattern, int pattern_len);
+
+/** Modulate a CW signal on to the provided tone samples with the given CW message.  Each element lasts dit_len samples. */
 struct cw_state modulate_cw(double *samples, int samples_len, int dit_len, bool *pattern, int pattern_len, struct cw_state state);
 
 #endif /* !FILE_CW_H_SEEN */
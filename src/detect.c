@@ -0,0 +1,98 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "detect.h"
+
+void detector_init(struct detector *detector, long samp_rate, long low, long high)
+{
+    detector->segment_len = samp_rate / DETECT_BIN_SPACING;
+    detector->bins = (high - low) / DETECT_BIN_SPACING + 1;
+    if (detector->bins > DETECT_MAX_BINS)
+    {
+        detector->bins = DETECT_MAX_BINS;
+    }
+
+    // Spread the bins evenly if the band is wider than the bank
+    double step = detector->bins > 1 ? (double)(high - low) / (detector->bins - 1) : 0;
+    for (int bin = 0; bin < detector->bins; bin++)
+    {
+        double freq = low + bin * step;
+        double w = 2.0 * M_PI * freq / samp_rate;
+        detector->coeff[bin] = 2.0 * cos(w);
+        detector->cos_w[bin] = cos(w);
+        detector->sin_w[bin] = sin(w);
+    }
+}
+
+double detector_power(const struct detector *detector, const complex *iq, long len, double full_scale)
+{
+    int bins = detector->bins;
+    long segment_len = detector->segment_len < len ? detector->segment_len : len;
+    double power[DETECT_MAX_BINS] = {0};
+    int segments = 0;
+
+    for (long start = 0; start + segment_len <= len; start += segment_len)
+    {
+        double s1_re[DETECT_MAX_BINS] = {0}, s1_im[DETECT_MAX_BINS] = {0};
+        double s2_re[DETECT_MAX_BINS] = {0}, s2_im[DETECT_MAX_BINS] = {0};
+
+        for (long index = start; index < start + segment_len; index++)
+        {
+            double x_re = cimag(iq[index]);
+            double x_im = creal(iq[index]);
+            for (int bin = 0; bin < bins; bin++)
+            {
+                double re = x_re + detector->coeff[bin] * s1_re[bin] - s2_re[bin];
+                double im = x_im + detector->coeff[bin] * s1_im[bin] - s2_im[bin];
+                s2_re[bin] = s1_re[bin];
+                s2_im[bin] = s1_im[bin];
+                s1_re[bin] = re;
+                s1_im[bin] = im;
+            }
+        }
+
+        // The bin output is s1 - e^-jw * s2
+        for (int bin = 0; bin < bins; bin++)
+        {
+            double c = detector->cos_w[bin], s = detector->sin_w[bin];
+            double y_re = s1_re[bin] - (c * s2_re[bin] + s * s2_im[bin]);
+            double y_im = s1_im[bin] - (c * s2_im[bin] - s * s2_re[bin]);
+            power[bin] += y_re * y_re + y_im * y_im;
+        }
+        segments++;
+    }
+
+    double strongest = 0;
+    for (int bin = 0; bin < bins; bin++)
+    {
+        if (power[bin] > strongest)
+        {
+            strongest = power[bin];
+        }
+    }
+    if (segments == 0 || strongest <= 0)
+    {
+        return -INFINITY;
+    }
+    // A tone of amplitude A gives a bin magnitude of A * segment_len
+    double scale = full_scale * segment_len;
+    return 10.0 * log10(strongest / segments / (scale * scale));
+}
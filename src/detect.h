@@ -0,0 +1,63 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File detect.h */
+#ifndef FILE_DETECT_H_SEEN
+#define FILE_DETECT_H_SEEN
+
+#include "../config.h"
+#include "beacon.h"
+
+#include <math.h>
+#include <complex.h>
+
+/* Most frequencies one detector checks */
+#define DETECT_MAX_BINS 128
+
+/* Spacing of the checked frequencies in Hz.  Each is measured over 1 / spacing seconds. */
+#define DETECT_BIN_SPACING 50
+
+/** A bank of Goertzel filters spread across a band, used to measure how much energy is in it.
+
+    The filter state is kept as separate arrays so that the per-sample update
+    runs across all of the frequencies at once, which the compiler turns into
+    SIMD code. */
+struct detector
+{
+    int bins;
+    long segment_len;
+    double coeff[DETECT_MAX_BINS];
+    double cos_w[DETECT_MAX_BINS];
+    double sin_w[DETECT_MAX_BINS];
+};
+
+/** Set up a detector for the band from low to high Hz, relative to the center of the IQ data. */
+void detector_init(struct detector *detector, long samp_rate, long low, long high);
+
+/** Returns the power of the strongest frequency in the band in dB relative to a tone of amplitude full_scale.
+
+    The IQ data uses the same layout as pack_iq(): the imaginary part holds I
+    and the real part Q.  Samples are measured in segments of 1 /
+    DETECT_BIN_SPACING seconds and the segments are averaged, so len should
+    be at least one segment long. */
+double detector_power(const struct detector *detector, const complex *iq, long len, double full_scale);
+
+#endif /* !FILE_DETECT_H_SEEN */
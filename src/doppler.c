@@ -0,0 +1,322 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "doppler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+/** Add a point to the end of the profile.  Returns 0 on success or -1 if out of memory. */
+static int add_point(struct doppler *doppler, double time, double offset, int *capacity)
+{
+    if (doppler->count == *capacity)
+    {
+        *capacity = *capacity > 0 ? *capacity * 2 : 256;
+        double *times = realloc(doppler->times, sizeof(double) * *capacity);
+        if (times != NULL)
+        {
+            doppler->times = times;
+        }
+        double *offsets = realloc(doppler->offsets, sizeof(double) * *capacity);
+        if (offsets != NULL)
+        {
+            doppler->offsets = offsets;
+        }
+        if (times == NULL || offsets == NULL)
+        {
+            return -1;
+        }
+    }
+    doppler->times[doppler->count] = time;
+    doppler->offsets[doppler->count] = offset;
+    doppler->count++;
+    return 0;
+}
+
+static void init_doppler(struct doppler *doppler, long samp_rate)
+{
+    memset(doppler, 0, sizeof(struct doppler));
+    doppler->samp_rate = samp_rate;
+}
+
+int doppler_load(struct doppler *doppler, const char *path, long samp_rate)
+{
+    init_doppler(doppler, samp_rate);
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+    {
+        perror("Error: Could not open Doppler profile");
+        return -1;
+    }
+
+    char line[256];
+    int capacity = 0, number = 0;
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        number++;
+        char *cursor = line + strspn(line, " \t");
+        if (*cursor == '#' || *cursor == '\n' || *cursor == '\0')
+        {
+            continue;
+        }
+        char *start = cursor, *end;
+        double time = strtod(start, &end);
+        double offset = strtod(end, &cursor);
+        if (end == start || cursor == end || (doppler->count > 0 && time <= doppler->times[doppler->count - 1]))
+        {
+            fprintf(stderr, "Error: %s:%d: expected \"seconds offset_hz\" with increasing times\n", path, number);
+            fclose(in);
+            doppler_free(doppler);
+            return -1;
+        }
+        if (add_point(doppler, time, offset, &capacity) < 0)
+        {
+            fprintf(stderr, "Error: Could not allocate the Doppler profile\n");
+            fclose(in);
+            doppler_free(doppler);
+            return -1;
+        }
+    }
+    fclose(in);
+    if (doppler->count == 0)
+    {
+        fprintf(stderr, "Error: %s holds no points\n", path);
+        return -1;
+    }
+
+    // A profile from a pass prediction is in wall clock time
+    if (doppler->times[0] > DOPPLER_EPOCH_TIMES)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        doppler->start = now.tv_sec + now.tv_nsec / 1e9;
+    }
+    return 0;
+}
+
+int doppler_pass(struct doppler *doppler, double tca, double min_range, double speed, long tx_freq, long samp_rate)
+{
+    init_doppler(doppler, samp_rate);
+    if (tca <= 0 || min_range <= 0 || speed <= 0)
+    {
+        return -1;
+    }
+    int capacity = 0;
+    for (double time = 0; time <= 2 * tca; time += DOPPLER_PASS_STEP)
+    {
+        // Range rate along a straight line, approaching (negative) before tca
+        double along = speed * (time - tca);
+        double range_rate = speed * along / sqrt(min_range * min_range + along * along);
+        if (add_point(doppler, time, tx_freq * range_rate / DOPPLER_C, &capacity) < 0)
+        {
+            doppler_free(doppler);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int doppler_ramp(struct doppler *doppler, double offset, double drift, long samp_rate)
+{
+    init_doppler(doppler, samp_rate);
+    int capacity = 0;
+    if (add_point(doppler, 0, offset, &capacity) < 0 ||
+        add_point(doppler, DOPPLER_RAMP_SPAN, offset + drift * DOPPLER_RAMP_SPAN, &capacity) < 0)
+    {
+        doppler_free(doppler);
+        return -1;
+    }
+    return 0;
+}
+
+/** Returns the offset, its slope in Hz per second, and the time until which they hold, at the given profile time. */
+static double segment_at(const struct doppler *doppler, double time, double *slope, double *end)
+{
+    int last = doppler->count - 1;
+    *slope = 0;
+    if (time < doppler->times[0])
+    {
+        *end = doppler->times[0];
+        return doppler->offsets[0];
+    }
+    if (time >= doppler->times[last])
+    {
+        *end = INFINITY;
+        return doppler->offsets[last];
+    }
+
+    int low = 0, high = last;
+    while (high - low > 1)
+    {
+        int mid = (low + high) / 2;
+        if (doppler->times[mid] <= time)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    *slope = (doppler->offsets[high] - doppler->offsets[low]) / (doppler->times[high] - doppler->times[low]);
+    *end = doppler->times[high];
+    return doppler->offsets[low] + *slope * (time - doppler->times[low]);
+}
+
+double doppler_offset_at(const struct doppler *doppler, double seconds)
+{
+    double slope, end;
+    return segment_at(doppler, doppler->start + seconds, &slope, &end);
+}
+
+/** Returns the length of the next run, at most max samples, over which the offset follows one line, and stores the line. */
+static long next_run(const struct doppler *doppler, long long sample, long max, double *offset, double *slope)
+{
+    double samp_rate = doppler->samp_rate;
+    double end;
+    *offset = segment_at(doppler, doppler->start + sample / samp_rate, slope, &end);
+    double left = ceil((end - doppler->start) * samp_rate - sample);
+    if (left < 1)
+    {
+        left = 1;
+    }
+    return left < max ? (long)left : max;
+}
+
+/** Advance a phase in cycles by a run of the given length. */
+static double advance_phase(double phase, double offset, double slope, long len, double samp_rate)
+{
+    double seconds = len / samp_rate;
+    return fmod(phase + offset * seconds + 0.5 * slope * seconds * seconds, 1.0);
+}
+
+void doppler_apply(struct doppler *doppler, complex *iq, long len)
+{
+    double samp_rate = doppler->samp_rate;
+    long done = 0;
+    while (done < len)
+    {
+        double offset, slope;
+        long run = next_run(doppler, doppler->sample + done, len - done, &offset, &slope);
+
+        // The layout keeps I in the imaginary part, so rotating by -theta
+        // moves the signal up by theta
+        double theta = -2 * M_PI * doppler->phase;
+        double step = -2 * M_PI * (offset + 0.5 * slope / samp_rate) / samp_rate;
+        double chirp = -2 * M_PI * slope / (samp_rate * samp_rate);
+        double z_re = cos(theta), z_im = sin(theta);
+        double w_re = cos(step), w_im = sin(step);
+        double dw_re = cos(chirp), dw_im = sin(chirp);
+
+        complex *current = iq + done;
+        for (long index = 0; index < run; index++)
+        {
+            double x_re = creal(current[index]), x_im = cimag(current[index]);
+            current[index] = (x_re * z_re - x_im * z_im) + (x_re * z_im + x_im * z_re) * I;
+            double next_re = z_re * w_re - z_im * w_im;
+            z_im = z_re * w_im + z_im * w_re;
+            z_re = next_re;
+            next_re = w_re * dw_re - w_im * dw_im;
+            w_im = w_re * dw_im + w_im * dw_re;
+            w_re = next_re;
+        }
+        doppler->phase = advance_phase(doppler->phase, offset, slope, run, samp_rate);
+        done += run;
+    }
+    doppler->sample += len;
+}
+
+/** The reference: the same shift with the analytic phase of every sample passed through cos() and sin(). */
+static void apply_reference(struct doppler *doppler, complex *iq, long len)
+{
+    long double samp_rate = doppler->samp_rate;
+    long done = 0;
+    while (done < len)
+    {
+        double offset, slope;
+        long run = next_run(doppler, doppler->sample + done, len - done, &offset, &slope);
+        for (long index = 0; index < run; index++)
+        {
+            long double seconds = index / samp_rate;
+            long double phase = doppler->phase + offset * seconds + 0.5L * slope * seconds * seconds;
+            iq[done + index] *= cexpl(-2 * M_PI * I * phase);
+        }
+        doppler->phase = advance_phase(doppler->phase, offset, slope, run, doppler->samp_rate);
+        done += run;
+    }
+    doppler->sample += len;
+}
+
+void doppler_check(const struct doppler *doppler, double seconds, long block_len, FILE *out)
+{
+    struct doppler fast = *doppler, reference = *doppler;
+    complex *a = malloc(sizeof(complex) * block_len);
+    complex *b = malloc(sizeof(complex) * block_len);
+    if (a == NULL || b == NULL)
+    {
+        free(a);
+        free(b);
+        return;
+    }
+
+    long long total = (long long)(seconds * doppler->samp_rate);
+    double max_error = 0, fast_time = 0, reference_time = 0;
+    struct timespec t0, t1, t2;
+    for (long long done = 0; done < total; done += block_len)
+    {
+        long len = total - done < block_len ? total - done : block_len;
+        for (long index = 0; index < len; index++)
+        {
+            a[index] = b[index] = 1.0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        doppler_apply(&fast, a, len);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        apply_reference(&reference, b, len);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        fast_time += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        reference_time += (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+
+        for (long index = 0; index < len; index++)
+        {
+            double error = fabs(carg(a[index] * conj(b[index])));
+            if (error > max_error)
+            {
+                max_error = error;
+            }
+        }
+    }
+    fprintf(out, "Doppler Check: %0.3f s, Max Phase Error: %0.3g degrees, Rotator: %0.1f Ms/s, Reference: %0.1f Ms/s\n",
+            seconds, max_error * 180 / M_PI, total / fast_time / 1e6, total / reference_time / 1e6);
+    free(a);
+    free(b);
+}
+
+void doppler_free(struct doppler *doppler)
+{
+    free(doppler->times);
+    free(doppler->offsets);
+    doppler->times = NULL;
+    doppler->offsets = NULL;
+    doppler->count = 0;
+}
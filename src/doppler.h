@@ -0,0 +1,90 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File doppler.h */
+#ifndef FILE_DOPPLER_H_SEEN
+#define FILE_DOPPLER_H_SEEN
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <complex.h>
+
+/* Timestamps above this are seconds since the epoch rather than since the start */
+#define DOPPLER_EPOCH_TIMES 1000000000.0
+
+/* Spacing in seconds of the points computed for --doppler-pass */
+#define DOPPLER_PASS_STEP 1.0
+
+/* Length in seconds of the profile built by doppler_ramp(), after which the offset holds */
+#define DOPPLER_RAMP_SPAN 1e7
+
+/* Speed of light in km/s */
+#define DOPPLER_C 299792.458
+
+/** A piecewise linear frequency offset over time, applied as a continuous phase chirp.
+
+    Within each segment the offset changes by a constant amount per sample,
+    so the phase step is itself rotated by a constant each sample: two
+    complex multiplies per sample, like a fixed offset oscillator.  The
+    phase is carried between blocks exactly, in double precision, and the
+    rotators are restarted from it at the start of every block and segment
+    so rounding cannot build up.  Before the first point and after the last
+    the end offsets are held.
+
+    Offsets are added to the transmitted frequency: they pre-compensate an
+    uplink, so that a moving receiver hears the signal on frequency.  A
+    receiver that sees f * (1 - range_rate / c) needs an offset of
+    +f * range_rate / c, which is negative while it approaches. */
+struct doppler
+{
+    double *times;
+    double *offsets;
+    int count;
+    long samp_rate;
+    long long sample;
+    double start;
+    double phase;
+};
+
+/** Load a profile of "seconds offset_hz" lines.  Returns 0 on success or -1 on error. */
+int doppler_load(struct doppler *doppler, const char *path, long samp_rate);
+
+/** Build the pre-compensation profile for a straight line pass of a receiver listening on tx_freq, closest at tca seconds from the start, min_range km away, moving at speed km/s.  Returns 0 on success or -1 on error. */
+int doppler_pass(struct doppler *doppler, double tca, double min_range, double speed, long tx_freq, long samp_rate);
+
+/** Build a profile that starts at offset Hz and moves by drift Hz per second.  Returns 0 on success or -1 on error. */
+int doppler_ramp(struct doppler *doppler, double offset, double drift, long samp_rate);
+
+/** Returns the offset in Hz at the given number of seconds from the start. */
+double doppler_offset_at(const struct doppler *doppler, double seconds);
+
+/** Shift the next len samples by the profile. */
+void doppler_apply(struct doppler *doppler, complex *iq, long len);
+
+/** Compare doppler_apply() with a direct per-sample cos()/sin() of the analytic phase over the given number of seconds, printing the error and speed of both. */
+void doppler_check(const struct doppler *doppler, double seconds, long block_len, FILE *out);
+
+/** Free a profile. */
+void doppler_free(struct doppler *doppler);
+
+#endif /* !FILE_DOPPLER_H_SEEN */
@@ -0,0 +1,131 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Writes tables.c, the lookup tables compiled into libbeacon, to STDOUT. */
+
+#include "tables.h"
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <math.h>
+
+/* International Morse code, with the punctuation that doubles as the
+   prosigns AR (+), AS (&), BT (=) and KN (() */
+static const struct
+{
+    char c;
+    const char *code;
+} morse[] = {
+    {'A', ".-"}, {'B', "-..."}, {'C', "-.-."}, {'D', "-.."}, {'E', "."}, {'F', "..-."},
+    {'G', "--."}, {'H', "...."}, {'I', ".."}, {'J', ".---"}, {'K', "-.-"}, {'L', ".-.."},
+    {'M', "--"}, {'N', "-."}, {'O', "---"}, {'P', ".--."}, {'Q', "--.-"}, {'R', ".-."},
+    {'S', "..."}, {'T', "-"}, {'U', "..-"}, {'V', "...-"}, {'W', ".--"}, {'X', "-..-"},
+    {'Y', "-.--"}, {'Z', "--.."},
+    {'1', ".----"}, {'2', "..---"}, {'3', "...--"}, {'4', "....-"}, {'5', "....."},
+    {'6', "-...."}, {'7', "--..."}, {'8', "---.."}, {'9', "----."}, {'0', "-----"},
+    {'.', ".-.-.-"}, {',', "--..--"}, {'?', "..--.."}, {'\'', ".----."}, {'!', "-.-.--"},
+    {'/', "-..-."}, {'(', "-.--."}, {')', "-.--.-"}, {'&', ".-..."}, {':', "---..."},
+    {';', "-.-.-."}, {'=', "-...-"}, {'+', ".-.-."}, {'-', "-....-"}, {'_', "..--.-"},
+    {'"', ".-..-."}, {'$', "...-..-"}, {'@', ".--.-."}};
+
+static unsigned int encode(const char *code)
+{
+    unsigned int len = strlen(code);
+    unsigned int packed = len;
+    for (unsigned int element = 0; element < len; element++)
+    {
+        if (code[element] == '-')
+        {
+            packed |= 1u << (4 + element);
+        }
+    }
+    return packed;
+}
+
+int main()
+{
+    printf("/* Generated by gentables, do not edit. */\n\n");
+    printf("#include \"tables.h\"\n\n");
+
+    printf("const double osc_sin_table[OSC_TABLE_LEN + 1] __attribute__((aligned(ARENA_ALIGN))) = {\n");
+    for (int index = 0; index <= OSC_TABLE_LEN; index++)
+    {
+        printf("    %.17g,\n", sin(2.0 * M_PI * (index % OSC_TABLE_LEN) / OSC_TABLE_LEN));
+    }
+    printf("};\n\n");
+
+    unsigned int table[256] = {0};
+    for (size_t entry = 0; entry < sizeof(morse) / sizeof(morse[0]); entry++)
+    {
+        unsigned char c = morse[entry].c;
+        table[c] = encode(morse[entry].code);
+        table[tolower(c)] = table[c];
+    }
+    table[' '] = MORSE_WORD_SPACE;
+
+    printf("const uint16_t morse_table[256] __attribute__((aligned(ARENA_ALIGN))) = {\n");
+    for (int c = 0; c < 256; c++)
+    {
+        printf("%s0x%04x,%s", c % 8 == 0 ? "    " : " ", table[c], c % 8 == 7 ? "\n" : "");
+    }
+    printf("};\n\n");
+
+    // Ziggurat layers for 32 bit draws, working down from the base
+    double k[ZIG_LAYERS], w[ZIG_LAYERS], f[ZIG_LAYERS];
+    double m1 = 2147483648.0, vn = 9.91256303526217e-3;
+    double dn = ZIG_R, tn = dn;
+    double q = vn / exp(-0.5 * dn * dn);
+    k[0] = (dn / q) * m1;
+    k[1] = 0;
+    w[0] = q / m1;
+    w[ZIG_LAYERS - 1] = dn / m1;
+    f[0] = 1.0;
+    f[ZIG_LAYERS - 1] = exp(-0.5 * dn * dn);
+    for (int layer = ZIG_LAYERS - 2; layer >= 1; layer--)
+    {
+        dn = sqrt(-2.0 * log(vn / dn + exp(-0.5 * dn * dn)));
+        k[layer + 1] = (dn / tn) * m1;
+        tn = dn;
+        f[layer] = exp(-0.5 * dn * dn);
+        w[layer] = dn / m1;
+    }
+
+    printf("const uint32_t zig_k[ZIG_LAYERS] __attribute__((aligned(ARENA_ALIGN))) = {\n");
+    for (int layer = 0; layer < ZIG_LAYERS; layer++)
+    {
+        printf("    %uu,\n", (unsigned int)k[layer]);
+    }
+    printf("};\n\n");
+    printf("const double zig_w[ZIG_LAYERS] __attribute__((aligned(ARENA_ALIGN))) = {\n");
+    for (int layer = 0; layer < ZIG_LAYERS; layer++)
+    {
+        printf("    %.17g,\n", w[layer]);
+    }
+    printf("};\n\n");
+    printf("const double zig_f[ZIG_LAYERS] __attribute__((aligned(ARENA_ALIGN))) = {\n");
+    for (int layer = 0; layer < ZIG_LAYERS; layer++)
+    {
+        printf("    %.17g,\n", f[layer]);
+    }
+    printf("};\n");
+    return 0;
+}
@@ -32,11 +32,5 @@ enum frequency
     FREQ_U = 432320000,
 };
 
-static bool stop;
-static void handle_sig(int sig)
-{
-    fprintf(stderr, " Waiting for process to finish...\n");
-    stop = true;
-}
-void shutdown(int code);
+void beacon_exit(int code);
 #endif /* !FILE_GLOBAL_H_SEEN */
@@ -0,0 +1,382 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "impair.h"
+#include "tables.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+int impair_parse(struct impair_params *params, const char *spec)
+{
+    memset(params, 0, sizeof(struct impair_params));
+    params->bandwidth = IMPAIR_DEFAULT_BANDWIDTH;
+    params->rician_k = 1;
+
+    char *copy = strdup(spec);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    int ret = 0;
+    char *save = NULL;
+    for (char *setting = strtok_r(copy, ",", &save); setting != NULL && ret == 0; setting = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(setting, '=');
+        if (value == NULL)
+        {
+            ret = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        if (strcmp(setting, "snr") == 0)
+        {
+            params->noise = true;
+            params->snr = atof(value);
+        }
+        else if (strcmp(setting, "bw") == 0)
+        {
+            params->bandwidth = atof(value);
+            ret = params->bandwidth > 0 ? 0 : -1;
+        }
+        else if (strcmp(setting, "offset") == 0)
+        {
+            params->offset = atof(value);
+        }
+        else if (strcmp(setting, "drift") == 0)
+        {
+            params->drift = atof(value);
+        }
+        else if (strcmp(setting, "fading") == 0)
+        {
+            if (strcmp(value, "rayleigh") == 0)
+            {
+                params->fading = FADING_RAYLEIGH;
+            }
+            else if (strcmp(value, "rician") == 0)
+            {
+                params->fading = FADING_RICIAN;
+            }
+            else
+            {
+                ret = -1;
+            }
+        }
+        else if (strcmp(setting, "k") == 0)
+        {
+            params->rician_k = atof(value);
+            ret = params->rician_k >= 0 ? 0 : -1;
+        }
+        else if (strcmp(setting, "fade-rate") == 0)
+        {
+            params->fade_rate = atof(value);
+        }
+        else if (strcmp(setting, "qsb") == 0)
+        {
+            ret = sscanf(value, "%lf:%lf", &params->qsb_depth, &params->qsb_rate) == 2 ? 0 : -1;
+        }
+        else if (strcmp(setting, "taps") == 0)
+        {
+            // delay_us:gain_db pairs separated by slashes
+            char *tap_save = NULL;
+            for (char *tap = strtok_r(value, "/", &tap_save); tap != NULL && ret == 0; tap = strtok_r(NULL, "/", &tap_save))
+            {
+                if (params->tap_count == IMPAIR_MAX_TAPS ||
+                    sscanf(tap, "%lf:%lf", &params->tap_delay[params->tap_count], &params->tap_gain[params->tap_count]) != 2)
+                {
+                    ret = -1;
+                }
+                params->tap_count++;
+            }
+        }
+        else if (strcmp(setting, "seed") == 0)
+        {
+            params->seed = strtoull(value, NULL, 0);
+        }
+        else
+        {
+            ret = -1;
+        }
+    }
+    free(copy);
+    if (params->fading != FADING_NONE && params->fade_rate <= 0)
+    {
+        // A slow ionospheric fade unless told otherwise
+        params->fade_rate = 0.5;
+    }
+    return ret;
+}
+
+/** Spread a seed over the generator state (splitmix64). */
+static uint64_t splitmix(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/** xorshift128+ */
+static inline uint64_t next_random(uint64_t *rng)
+{
+    uint64_t s1 = rng[0];
+    const uint64_t s0 = rng[1];
+    rng[0] = s0;
+    s1 ^= s1 << 23;
+    rng[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+    return rng[1] + s0;
+}
+
+/** Returns a uniform value in (0, 1). */
+static double uniform(uint64_t *rng)
+{
+    return ((next_random(rng) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/** The rare ziggurat cases: the wedges beside each layer and the tail past the base. */
+static double normal_slow(uint64_t *rng, int32_t draw, int layer)
+{
+    while (true)
+    {
+        double x = draw * zig_w[layer];
+        if (layer == 0)
+        {
+            double y;
+            do
+            {
+                x = -log(uniform(rng)) / ZIG_R;
+                y = -log(uniform(rng));
+            } while (y + y < x * x);
+            return draw > 0 ? ZIG_R + x : -ZIG_R - x;
+        }
+        if (zig_f[layer] + uniform(rng) * (zig_f[layer - 1] - zig_f[layer]) < exp(-0.5 * x * x))
+        {
+            return x;
+        }
+
+        uint64_t bits = next_random(rng);
+        layer = (bits >> 8) & (ZIG_LAYERS - 1);
+        draw = (int32_t)(bits >> 32);
+        if ((uint32_t)llabs(draw) < zig_k[layer])
+        {
+            return draw * zig_w[layer];
+        }
+    }
+}
+
+void impair_normals(struct impairments *impair, double *values, long len)
+{
+    // The layer and the draw come from separate bits of one random number,
+    // and nearly every draw falls inside its layer
+    for (long index = 0; index < len; index++)
+    {
+        uint64_t bits = next_random(impair->rng);
+        int layer = (bits >> 8) & (ZIG_LAYERS - 1);
+        int32_t draw = (int32_t)(bits >> 32);
+        if ((uint32_t)llabs(draw) < zig_k[layer])
+        {
+            values[index] = draw * zig_w[layer];
+        }
+        else
+        {
+            values[index] = normal_slow(impair->rng, draw, layer);
+        }
+    }
+}
+
+int impair_init(struct impairments *impair, const struct impair_params *params, long samp_rate, double signal_power)
+{
+    memset(impair, 0, sizeof(struct impairments));
+    impair->params = *params;
+    impair->samp_rate = samp_rate;
+
+    uint64_t seed = params->seed;
+    if (seed == 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        seed = now.tv_sec * 1000000000ULL + now.tv_nsec + getpid();
+    }
+    impair->rng[0] = splitmix(&seed);
+    impair->rng[1] = splitmix(&seed);
+
+    // Noise over the whole sampled band for the given SNR in bandwidth
+    double noise_power = signal_power / pow(10, params->snr / 10) * samp_rate / params->bandwidth;
+    impair->noise_sigma = sqrt(noise_power / 2);
+
+    for (int tap = 0; tap < params->tap_count; tap++)
+    {
+        impair->tap_samples[tap] = lround(params->tap_delay[tap] * samp_rate / 1e6);
+        impair->tap_scale[tap] = pow(10, params->tap_gain[tap] / 20);
+        if (impair->tap_samples[tap] < 1 || impair->tap_samples[tap] > IMPAIR_MAX_DELAY)
+        {
+            fprintf(stderr, "Error: Echo delays must be between 1 and %d samples\n", IMPAIR_MAX_DELAY);
+            return -1;
+        }
+        if (impair->tap_samples[tap] > impair->max_delay)
+        {
+            impair->max_delay = impair->tap_samples[tap];
+        }
+    }
+
+    // Sum of sinusoids fading (Zheng and Xiao), each path arriving from a
+    // random angle with random phases
+    double theta = 2 * M_PI * uniform(impair->rng) - M_PI;
+    for (int path = 0; path < IMPAIR_FADE_PATHS; path++)
+    {
+        double alpha = (2 * M_PI * (path + 1) - M_PI + theta) / (4 * IMPAIR_FADE_PATHS);
+        impair->path_freq_i[path] = params->fade_rate * cos(alpha);
+        impair->path_freq_q[path] = params->fade_rate * sin(alpha);
+        impair->path_phase_i[path] = 2 * M_PI * uniform(impair->rng) - M_PI;
+        impair->path_phase_q[path] = 2 * M_PI * uniform(impair->rng) - M_PI;
+    }
+
+    if (params->offset != 0 || params->drift != 0)
+    {
+        impair->shifting = true;
+        if (doppler_ramp(&impair->shift, params->offset, params->drift, samp_rate) < 0)
+        {
+            return -1;
+        }
+    }
+
+    impair->history = calloc(impair->max_delay + IMPAIR_CHUNK_LEN, sizeof(complex));
+    impair->normals = malloc(sizeof(double) * 2 * IMPAIR_CHUNK_LEN);
+    if (impair->history == NULL || impair->normals == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate the channel simulator\n");
+        impair_free(impair);
+        return -1;
+    }
+    return 0;
+}
+
+/** Returns the fading and QSB gain at the given sample. */
+static complex fade_gain(const struct impairments *impair, long long sample)
+{
+    const struct impair_params *params = &impair->params;
+    double seconds = (double)sample / impair->samp_rate;
+    complex gain = 1;
+
+    if (params->fading != FADING_NONE)
+    {
+        double re = 0, im = 0;
+        for (int path = 0; path < IMPAIR_FADE_PATHS; path++)
+        {
+            re += cos(2 * M_PI * impair->path_freq_i[path] * seconds + impair->path_phase_i[path]);
+            im += cos(2 * M_PI * impair->path_freq_q[path] * seconds + impair->path_phase_q[path]);
+        }
+        complex scatter = (re + im * I) / sqrt(IMPAIR_FADE_PATHS);
+        if (params->fading == FADING_RICIAN)
+        {
+            // A steady direct path carrying k times the scattered power
+            gain = sqrt(params->rician_k / (params->rician_k + 1)) + sqrt(1 / (params->rician_k + 1)) * scatter;
+        }
+        else
+        {
+            gain = scatter;
+        }
+    }
+    if (params->qsb_depth > 0)
+    {
+        // Dips by the depth in dB once per period
+        gain *= pow(10, -params->qsb_depth / 20 * (0.5 - 0.5 * cos(2 * M_PI * params->qsb_rate * seconds)));
+    }
+    return gain;
+}
+
+void impair_apply(struct impairments *impair, complex *iq, long len)
+{
+    const struct impair_params *params = &impair->params;
+    for (long done = 0; done < len; done += IMPAIR_CHUNK_LEN)
+    {
+        long chunk = len - done < IMPAIR_CHUNK_LEN ? len - done : IMPAIR_CHUNK_LEN;
+        complex *x = iq + done;
+
+        if (params->tap_count > 0)
+        {
+            // The history holds the last max_delay inputs before this chunk
+            complex *input = impair->history + impair->max_delay;
+            memcpy(input, x, sizeof(complex) * chunk);
+            for (int tap = 0; tap < params->tap_count; tap++)
+            {
+                complex *echo = input - impair->tap_samples[tap];
+                double scale = impair->tap_scale[tap];
+                for (long index = 0; index < chunk; index++)
+                {
+                    x[index] += scale * echo[index];
+                }
+            }
+            memmove(impair->history, impair->history + chunk, sizeof(complex) * impair->max_delay);
+        }
+
+        if (params->fading != FADING_NONE || params->qsb_depth > 0)
+        {
+            // Fading is slow, so the gain is interpolated between steps
+            complex next = fade_gain(impair, impair->sample);
+            for (long step = 0; step < chunk; step += IMPAIR_FADE_STEP)
+            {
+                complex gain = next;
+                next = fade_gain(impair, impair->sample + step + IMPAIR_FADE_STEP);
+                complex slope = (next - gain) / IMPAIR_FADE_STEP;
+                long end = step + IMPAIR_FADE_STEP < chunk ? step + IMPAIR_FADE_STEP : chunk;
+                for (long index = step; index < end; index++)
+                {
+                    x[index] *= gain + slope * (index - step);
+                }
+            }
+        }
+
+        if (impair->shifting)
+        {
+            doppler_apply(&impair->shift, x, chunk);
+        }
+
+        if (params->noise)
+        {
+            double sigma = impair->noise_sigma;
+            double *normals = impair->normals;
+            impair_normals(impair, normals, 2 * chunk);
+            for (long index = 0; index < chunk; index++)
+            {
+                x[index] += sigma * normals[2 * index] + sigma * normals[2 * index + 1] * I;
+            }
+        }
+        impair->sample += chunk;
+    }
+}
+
+void impair_free(struct impairments *impair)
+{
+    if (impair->shifting)
+    {
+        doppler_free(&impair->shift);
+    }
+    free(impair->history);
+    free(impair->normals);
+    impair->history = NULL;
+    impair->normals = NULL;
+}
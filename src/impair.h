@@ -0,0 +1,112 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File impair.h */
+#ifndef FILE_IMPAIR_H_SEEN
+#define FILE_IMPAIR_H_SEEN
+
+#include "../config.h"
+#include "doppler.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <complex.h>
+
+/* Most multipath echoes, and the longest echo delay in samples */
+#define IMPAIR_MAX_TAPS 4
+#define IMPAIR_MAX_DELAY 65536
+
+/* Samples processed at a time, and between fading gain updates */
+#define IMPAIR_CHUNK_LEN 4096
+#define IMPAIR_FADE_STEP 64
+
+/* Sinusoids summed for Rayleigh fading */
+#define IMPAIR_FADE_PATHS 8
+
+/* Bandwidth in Hz the SNR is given in unless set */
+#define IMPAIR_DEFAULT_BANDWIDTH 2500
+
+enum fading
+{
+    FADING_NONE,
+    FADING_RAYLEIGH,
+    FADING_RICIAN
+};
+
+/** What a simulated channel does to the signal.  Parsed from a comma separated list of key=value settings. */
+struct impair_params
+{
+    bool noise;
+    double snr;
+    double bandwidth;
+    double offset;
+    double drift;
+    enum fading fading;
+    double rician_k;
+    double fade_rate;
+    double qsb_depth;
+    double qsb_rate;
+    int tap_count;
+    double tap_delay[IMPAIR_MAX_TAPS];
+    double tap_gain[IMPAIR_MAX_TAPS];
+    uint64_t seed;
+};
+
+/** A simulated channel: multipath echoes, then fading and QSB, then a frequency offset and drift, then white Gaussian noise. */
+struct impairments
+{
+    struct impair_params params;
+    long samp_rate;
+    long long sample;
+    double noise_sigma;
+    uint64_t rng[2];
+
+    long tap_samples[IMPAIR_MAX_TAPS];
+    double tap_scale[IMPAIR_MAX_TAPS];
+    long max_delay;
+    complex *history;
+
+    double path_freq_i[IMPAIR_FADE_PATHS];
+    double path_freq_q[IMPAIR_FADE_PATHS];
+    double path_phase_i[IMPAIR_FADE_PATHS];
+    double path_phase_q[IMPAIR_FADE_PATHS];
+
+    bool shifting;
+    struct doppler shift;
+    double *normals;
+};
+
+/** Parse settings such as "snr=10,offset=20,drift=0.5,fading=rician,k=4,fade-rate=0.3,qsb=10:0.1,taps=500:-6/1200:-12,seed=7".  Returns 0 on success or -1 on error. */
+int impair_parse(struct impair_params *params, const char *spec);
+
+/** Set up a channel for a signal whose key down power is signal_power.  Returns 0 on success or -1 on error. */
+int impair_init(struct impairments *impair, const struct impair_params *params, long samp_rate, double signal_power);
+
+/** Pass the next len samples through the channel. */
+void impair_apply(struct impairments *impair, complex *iq, long len);
+
+/** Fill the array with standard normal values. */
+void impair_normals(struct impairments *impair, double *values, long len);
+
+/** Free a channel. */
+void impair_free(struct impairments *impair);
+
+#endif /* !FILE_IMPAIR_H_SEEN */
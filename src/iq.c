@@ -20,14 +20,129 @@
 
 #include "iq.h"
 
-struct sample_table generate_sample_table(long freq, long samp_rate)
+/** Allocate memory for a state, from its arena if it has one. */
+static void *state_alloc(struct iq_state *state, size_t size)
+{
+    if (state->arena != NULL)
+    {
+        return arena_alloc(state->arena, size);
+    }
+    return malloc(size);
+}
+
+/** Look up sin(theta) in the compiled-in table, interpolating between entries. */
+static double table_sin(double theta)
+{
+    double pos = theta * (OSC_TABLE_LEN / (2.0 * PI));
+    double whole = floor(pos);
+    long index = (long)whole & (OSC_TABLE_LEN - 1);
+    return osc_sin_table[index] + (pos - whole) * (osc_sin_table[index + 1] - osc_sin_table[index]);
+}
+
+static double table_cos(double theta)
+{
+    return table_sin(theta + PI / 2);
+}
+
+/** Returns the number of samples in one period of the given frequency. */
+static long period_len(long freq, long samp_rate)
+{
+    return (long)((double)samp_rate / (double)freq);
+}
+
+/** Returns the greatest common divisor of a and b. */
+static size_t gcd(size_t a, size_t b)
+{
+    while (b != 0)
+    {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/** Allocate a ring for a period of len values of value_size bytes, setting the number of values to fill in and how many can be read in one piece from any index below len.  As many whole periods as fill whole pages go in a mirrored ring, unless that is larger than IQ_RING_MAX_SIZE, in which case the period is followed by IQ_RING_OVERLAP more values in the state's own memory. */
+static void *alloc_ring(struct iq_state *state, size_t value_size, long len, struct mirror *mirror, long *stored, long *span)
+{
+    size_t period_size = value_size * len;
+    size_t page = mirror_granularity();
+    size_t periods = page / gcd(period_size, page);
+    if (periods * period_size <= IQ_RING_MAX_SIZE && mirror_create(mirror, periods * period_size) == 0)
+    {
+        *stored = *span = periods * len;
+        return mirror->base;
+    }
+    *stored = len + IQ_RING_OVERLAP;
+    *span = IQ_RING_OVERLAP;
+    return state_alloc(state, value_size * *stored);
+}
+
+/** Fill the tone ring the first time it is needed. */
+static void build_tone(struct iq_state *state)
+{
+    if (state->samples.samples != NULL)
+    {
+        return;
+    }
+    long len = state->table.len;
+    state->samples.len = len;
+    state->samples.samples = alloc_ring(state, sizeof(double), len, &state->samples.mirror, &state->samples.stored, &state->samples.span);
+    for (long index = 0; index < state->samples.stored; index++)
+    {
+        state->samples.samples[index] = table_cos(state->table.samples[index % len]);
+    }
+}
+
+/** Fill the carrier ring the first time it is needed. */
+static void build_carrier(struct iq_state *state)
+{
+    if (state->iq.values != NULL)
+    {
+        return;
+    }
+    long len = state->table.len;
+    state->iq.len = len;
+    state->iq.values = alloc_ring(state, sizeof(complex), len, &state->iq.mirror, &state->iq.stored, &state->iq.span);
+    for (long index = 0; index < state->iq.stored; index++)
+    {
+        double theta = state->table.samples[index % len];
+        state->iq.values[index] = table_sin(theta) + table_cos(theta) * I;
+    }
+}
+
+/** Returns the table length holding a whole number of cycles, stored in cycles, that comes closest to the given frequency without going over IQ_EXACT_MAX_LEN. */
+static long exact_len(long freq, long samp_rate, long *cycles)
+{
+    long best_len = period_len(freq, samp_rate);
+    double best_error = fabs((double)samp_rate / best_len - freq);
+    *cycles = 1;
+    for (long count = 2; best_error > 0; count++)
+    {
+        long len = lround((double)samp_rate * count / freq);
+        if (len > IQ_EXACT_MAX_LEN)
+        {
+            break;
+        }
+        double error = fabs((double)samp_rate * count / len - freq);
+        if (error < best_error)
+        {
+            best_len = len;
+            best_error = error;
+            *cycles = count;
+        }
+    }
+    return best_len;
+}
+
+struct sample_table generate_sample_table(long freq, long samp_rate, struct iq_state *state)
 {
     assert(samp_rate >= 2 * freq);
     double two_pi = 2.0 * PI;
-    long rate = (long)((double)samp_rate / (double)freq);
+    long rate = period_len(freq, samp_rate);
     double step = two_pi / rate;
 
-    double *samples = malloc(rate * sizeof(double));
+    double *samples = state_alloc(state, rate * sizeof(double));
 
     double theta = 0;
     
@@ -38,6 +153,7 @@ struct sample_table generate_sample_table(long freq, long samp_rate)
     }
 
     struct sample_table table;
+    memset(&table, 0, sizeof(table));
     table.samples = samples;
     table.len = rate;
     
@@ -45,19 +161,98 @@ struct sample_table generate_sample_table(long freq, long samp_rate)
 }
 
 
-struct iq_state* init_state(long freq, long samp_rate)
+struct iq_state *create_iq_state(long freq, long samp_rate, struct arena *arena)
+{
+    struct iq_state *state = arena != NULL ? arena_alloc(arena, sizeof(struct iq_state)) : malloc(sizeof(struct iq_state));
+    memset(state, 0, sizeof(struct iq_state));
+    state->arena = arena;
+    state->table = generate_sample_table(freq, samp_rate, state);
+    state->cycles = 1;
+    return state;
+}
+
+struct iq_state *create_exact_iq_state(long freq, long samp_rate, struct arena *arena)
 {
-    struct iq_state *state = malloc(sizeof(struct iq_state));
-    state->start = 0;
-    state->table = generate_sample_table(freq, samp_rate);
-    state->iq.values = NULL;
-    state->samples.samples = NULL;
+    assert(samp_rate >= 2 * freq);
+    struct iq_state *state = arena != NULL ? arena_alloc(arena, sizeof(struct iq_state)) : malloc(sizeof(struct iq_state));
+    memset(state, 0, sizeof(struct iq_state));
+    state->arena = arena;
+
+    long len = exact_len(freq, samp_rate, &state->cycles);
+    state->table.samples = state_alloc(state, len * sizeof(double));
+    state->table.len = len;
+    for (long i = 0; i < len; i++)
+    {
+        // Phase from the sample index rather than accumulated, so the last
+        // sample of the table lands on a whole cycle
+        state->table.samples[i] = 2.0 * PI * (double)(((i + 1) * state->cycles) % len) / len;
+    }
     return state;
 }
 
+double iq_state_freq(const struct iq_state *state, long samp_rate)
+{
+    return (double)samp_rate * state->cycles / state->table.len;
+}
+
+/** Returns the arena space needed by a state with a table len samples long. */
+static size_t state_size(long len)
+{
+    // Room for the ring in case it can't be mirrored
+    return ARENA_ALIGNED(sizeof(struct iq_state)) + ARENA_ALIGNED(sizeof(double) * len) +
+           ARENA_ALIGNED(sizeof(complex) * (len + IQ_RING_OVERLAP));
+}
+
+size_t iq_state_size(long freq, long samp_rate)
+{
+    return state_size(period_len(freq, samp_rate));
+}
+
+size_t exact_iq_state_size(long freq, long samp_rate)
+{
+    long cycles;
+    return state_size(exact_len(freq, samp_rate, &cycles));
+}
+
+void seek_iq_state(struct iq_state *state, long long sample)
+{
+    // The signal repeats every table length, so the position within the
+    // table is all that's needed to continue from any sample.
+    state->start = sample % state->table.len;
+}
+
+void scale_iq_state(struct iq_state *state, double scale)
+{
+    build_carrier(state);
+    for (long index = 0; index < state->iq.stored; index++)
+    {
+        double i = cimag(state->iq.values[index]) * scale;
+        double q = creal(state->iq.values[index]) * scale;
+        state->iq.values[index] = q + i * I;
+    }
+}
+
 void destroy_iq_state(struct iq_state *state)
 {
-    if (state != NULL)
+    if (state == NULL)
+    {
+        return;
+    }
+    // Mirrored rings are mappings of their own, whether or not the state
+    // is in an arena
+    if (state->samples.mirror.base != NULL)
+    {
+        mirror_destroy(&state->samples.mirror);
+        state->samples.samples = NULL;
+    }
+    if (state->iq.mirror.base != NULL)
+    {
+        mirror_destroy(&state->iq.mirror);
+        state->iq.values = NULL;
+    }
+
+    // Memory from an arena is released with the arena
+    if (state->arena == NULL)
     {
         if (state->table.samples != NULL)
         {
@@ -75,146 +270,56 @@ void destroy_iq_state(struct iq_state *state)
     }
 }
 
-struct iq_state *generate_tone(long freq, long samp_rate, double *samples, int samples_len, struct iq_state *state)
+const double *tone_window(struct iq_state *state, long len)
 {
-    double theta = 0.0;
-    double value = 0.0;
-    int index = 0;
-
-    if (state == NULL)
-    {
-        state = init_state(freq, samp_rate);
-    }
-
-    if (state->samples.samples == NULL)
-    {
-        state->samples.len = state->table.len;
-        state->samples.samples = malloc(sizeof(double)*state->table.len);
-        for (index = 0; index < state->samples.len; index++)
-        {
-            theta = state->table.samples[index];
-            value = cos(theta);
-            state->samples.samples[index] = value;
-#ifdef DEBUG
-            fprintf(stderr, "freq: %ld, samp_rate: %ld, index: %d, len: %ld, theta: %0.3f, value: %0.3f\n", freq, samp_rate, index, state->samples.len, theta, i, q);
-#endif
-        }
-    }
-
-    long start = state->start;
-    double *current = samples;
-    long left = samples_len;
+    build_tone(state);
+    const double *window = state->samples.samples + state->start;
+    state->start = (state->start + len) % state->samples.len;
+    return window;
+}
 
-    double *precomputed = state->samples.samples;
-    long precomputed_len = state->samples.len;
+const complex *carrier_window(struct iq_state *state, long len)
+{
+    build_carrier(state);
+    const complex *window = state->iq.values + state->start;
+    state->start = (state->start + len) % state->iq.len;
+    return window;
+}
 
-    if (start > 0)
+struct iq_state *generate_tone(long freq, long samp_rate, double *samples, int samples_len, struct iq_state *state)
+{
+    if (state == NULL)
     {
-#ifdef DEBUG
-        fprintf(stderr, "Align Tone, start: %ld\n", start);
-#endif
-        // Align to the start of the pre-computed IQ
-        double *align = precomputed += start;
-        long align_len = precomputed_len-start;
-        memcpy(current, align, align_len);
-        current += align_len;
-        left -= align_len;
+        state = create_iq_state(freq, samp_rate, NULL);
     }
+    build_tone(state);
 
-    while (left >= precomputed_len)
+    // Every window up to the span is one piece of the ring, wherever it starts
+    for (long done = 0, len; done < samples_len; done += len)
     {
-#ifdef DEBUG
-        fprintf(stderr, "Copy Tone, left: %ld\n", left);
-#endif
-        memcpy(current, precomputed, precomputed_len);
-        current += precomputed_len;
-        left -= precomputed_len;
-    }
-
-    if (left > 0)
-    { 
-#ifdef DEBUG
-        fprintf(stderr, "Fill Remaining Tone, left: %ld\n", left);
-#endif
-        // Fill the remaining samples
-        memcpy(current, precomputed, left);
+        len = samples_len - done < state->samples.span ? samples_len - done : state->samples.span;
+        memcpy(samples + done, tone_window(state, len), sizeof(double) * len);
     }
-
-    state->start = left;
-
     return state;
 }
 
-struct iq_state* generate_carrier(long freq, long samp_rate, complex *iq, int iq_len, struct iq_state *state)
+struct iq_state *generate_carrier(long freq, long samp_rate, complex *iq, int iq_len, struct iq_state *state)
 {
-    double i = 0.0, q = 0.0, theta = 0.0;
-    int index = 0;
-
     if (state == NULL)
     {
-        state = init_state(freq, samp_rate);
-    }
-    if (state->iq.values == NULL)
-    {
-        state->iq.len = state->table.len;
-        state->iq.values = malloc(sizeof(complex)*state->iq.len);
-        for (index = 0; index < state->iq.len; index++)
-        {
-            theta = state->table.samples[index];
-            i = cos(theta);
-            q = sin(theta);
-#ifdef DEBUG
-            fprintf(stderr, "freq: %ld, samp_rate: %ld, index: %d, len: %ld, theta: %f, i: %f, q: %f\n", freq, samp_rate, index, state->iq.len, theta, i, q);
-#endif
-            state->iq.values[index] = q + i * I;
-        }
-    }
-
-    long start = state->start;
-    complex *current = iq;
-    long left = iq_len;
-
-    complex *precomputed = state->iq.values;
-    long precomputed_len = state->iq.len;
-
-    if (start > 0)
-    {
-#ifdef DEBUG
-        fprintf(stderr, "Align Carrier IQ, start: %ld\n", start);
-#endif
-        // Align to the start of the pre-computed IQ
-        complex *align = precomputed += start;
-        long align_len = precomputed_len-start;
-        memcpy(current, align, align_len);
-        current += align_len;
-        left -= align_len;
+        state = create_iq_state(freq, samp_rate, NULL);
     }
+    build_carrier(state);
 
-    while (left >= precomputed_len)
+    for (long done = 0, len; done < iq_len; done += len)
     {
-#ifdef DEBUG
-        fprintf(stderr, "Copy Carrier IQ, left: %ld\n", left);
-#endif
-        memcpy(current, precomputed, precomputed_len);
-        current += precomputed_len;
-        left -= precomputed_len;
+        len = iq_len - done < state->iq.span ? iq_len - done : state->iq.span;
+        memcpy(iq + done, carrier_window(state, len), sizeof(complex) * len);
     }
-
-    if (left > 0)
-    { 
-#ifdef DEBUG
-        fprintf(stderr, "Fill Remaining Carrier IQ, left: %ld\n", left);
-#endif
-        // Fill the remaining samples
-        memcpy(current, precomputed, left);
-    }
-
-    state->start = left;
-    
     return state;
 }
 
-void modulate_am(complex *carrier, double *baseband, int iq_len, double modulation_index)
+void modulate_am(complex *out, const complex *carrier, const double *baseband, int iq_len, double modulation_index)
 {
     for (int index = 0; index < iq_len; index++)
     {
@@ -231,12 +336,12 @@ void modulate_am(complex *carrier, double *baseband, int iq_len, double modulati
         carrier_i *= modulation_index / 10;
         carrier_q *= modulation_index / 10;
 
-        carrier[index] = (carrier_q + carrier_i * I) + (modulated_q + modulated_i * I);
+        out[index] = (carrier_q + carrier_i * I) + (modulated_q + modulated_i * I);
     }
 }
 
 /** TODO: This does not work yet. */
-void modulate_fm(complex *carrier, double *baseband, int iq_len, double modulation_index)
+void modulate_fm(complex *out, const complex *carrier, const double *baseband, int iq_len, double modulation_index)
 {
     for (int index = 0; index < iq_len; index++)
     {
@@ -249,21 +354,145 @@ void modulate_fm(complex *carrier, double *baseband, int iq_len, double modulati
         double modulated_i = sin(2*PI*((carrier_i + modulation_index) * baseband[index]));
         double modulated_q = cos(2*PI*((carrier_q + modulation_index) * baseband[index]));
 
-        carrier[index] = modulated_q + modulated_i * I;
+        out[index] = modulated_q + modulated_i * I;
+    }
+}
+
+int iq_format_from_name(const char *name)
+{
+    if (strcasecmp(name, "ci32") == 0)
+    {
+        return FORMAT_CI32;
+    }
+    else if (strcasecmp(name, "cs16") == 0)
+    {
+        return FORMAT_CS16;
+    }
+    else if (strcasecmp(name, "cf32") == 0)
+    {
+        return FORMAT_CF32;
+    }
+    return -1;
+}
+
+const char *iq_format_name(enum iq_format format)
+{
+    switch (format)
+    {
+    case FORMAT_CS16:
+        return "cs16";
+    case FORMAT_CF32:
+        return "cf32";
+    default:
+        return "ci32";
+    }
+}
+
+size_t iq_sample_size(enum iq_format format)
+{
+    switch (format)
+    {
+    case FORMAT_CS16:
+        return 2 * sizeof(int16_t);
+    case FORMAT_CF32:
+        return 2 * sizeof(float);
+    default:
+        return 2 * sizeof(uint32_t);
+    }
+}
+
+double iq_full_scale(enum iq_format format)
+{
+    switch (format)
+    {
+    case FORMAT_CS16:
+        return 32768;
+    case FORMAT_CF32:
+        return 1.0;
+    default:
+        return IQ_FULL_SCALE;
     }
 }
 
-void write_iq(FILE *out, complex *iq, int iq_len)
+/** Returns value clamped to a signed 16-bit sample. */
+static int16_t clamp16(double value)
 {
-    uint32_t buf[iq_len*2];
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+}
+
+void pack_iq(enum iq_format format, void *buf, complex *iq, int iq_len)
+{
+    uint32_t *buf32 = buf;
+    uint16_t *buf16 = buf;
+    union
+    {
+        float f;
+        uint32_t u;
+    } value;
+
     for (int index = 0; index < iq_len; index++)
     {
         double i = cimag(iq[index]);
         double q = creal(iq[index]);
-        buf[(index*2)] = htole32((uint32_t)i);
-        buf[(index*2)+1] = htole32((uint32_t)q);
-                    
+        switch (format)
+        {
+        case FORMAT_CS16:
+            buf16[(index*2)] = htole16((uint16_t)clamp16(i * (32768 / IQ_FULL_SCALE)));
+            buf16[(index*2)+1] = htole16((uint16_t)clamp16(q * (32768 / IQ_FULL_SCALE)));
+            break;
+        case FORMAT_CF32:
+            value.f = i / IQ_FULL_SCALE;
+            buf32[(index*2)] = htole32(value.u);
+            value.f = q / IQ_FULL_SCALE;
+            buf32[(index*2)+1] = htole32(value.u);
+            break;
+        default:
+            buf32[(index*2)] = htole32((uint32_t)i);
+            buf32[(index*2)+1] = htole32((uint32_t)q);
+            break;
+        }
+    }
+}
+
+void unpack_iq(enum iq_format format, const void *buf, complex *iq, int iq_len)
+{
+    const uint32_t *buf32 = buf;
+    const uint16_t *buf16 = buf;
+    union
+    {
+        float f;
+        uint32_t u;
+    } value;
+
+    for (int index = 0; index < iq_len; index++)
+    {
+        double i, q;
+        switch (format)
+        {
+        case FORMAT_CS16:
+            i = (int16_t)le16toh(buf16[(index*2)]) / (32768.0 / IQ_FULL_SCALE);
+            q = (int16_t)le16toh(buf16[(index*2)+1]) / (32768.0 / IQ_FULL_SCALE);
+            break;
+        case FORMAT_CF32:
+            value.u = le32toh(buf32[(index*2)]);
+            i = value.f * IQ_FULL_SCALE;
+            value.u = le32toh(buf32[(index*2)+1]);
+            q = value.f * IQ_FULL_SCALE;
+            break;
+        default:
+            i = (int32_t)le32toh(buf32[(index*2)]);
+            q = (int32_t)le32toh(buf32[(index*2)+1]);
+            break;
+        }
+        iq[index] = q + i * I;
     }
-    fwrite(buf, sizeof(uint32_t), iq_len*2, out);
+}
+
+void write_iq(FILE *out, enum iq_format format, complex *iq, int iq_len)
+{
+    size_t sample_size = iq_sample_size(format);
+    char buf[iq_len * sample_size];
+    pack_iq(format, buf, iq, iq_len);
+    fwrite(buf, sample_size, iq_len, out);
     fflush(out);
 }
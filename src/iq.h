@@ -23,9 +23,14 @@
 #define FILE_IQ_H_SEEN
 
 #include "../config.h"
+#include "beacon.h"
+#include "arena.h"
+#include "tables.h"
+#include "mirror.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
@@ -35,16 +40,39 @@
 
 #define PI 3.14159265
 
+/* Largest ring of whole periods that is mirrored */
+#define IQ_RING_MAX_SIZE (16 * 1024 * 1024)
+
+/* Values kept past the period by rings that can't be mirrored */
+#define IQ_RING_OVERLAP 4096
+
+/* Full scale of the samples the signal chain works in, that of the
+   AD9361's 12-bit DAC and ADC */
+#define IQ_FULL_SCALE 2048
+
+/* Longest table holding whole cycles of a frequency, see create_exact_iq_state() */
+#define IQ_EXACT_MAX_LEN 65536
+
+/** One period of values, len long.  Precomputed waveforms are kept as rings:
+    span values can be read in one piece from any index below len, either
+    because whole periods are mapped as a mirror or because the period is
+    followed by span more values.  stored is the number of values written. */
 struct sample_table
 {
     double *samples;
     long len;
+    long span;
+    long stored;
+    struct mirror mirror;
 };
 
 struct iq_table
 {
     complex *values;
     long len;
+    long span;
+    long stored;
+    struct mirror mirror;
 };
 
 struct iq_state
@@ -52,10 +80,33 @@ struct iq_state
     struct sample_table table;
     struct sample_table samples;
     struct iq_table iq;
+    long cycles;
     long start;
+    struct arena *arena;
 };
 
 
+/** Create a state for the given frequency, allocating it and its tables from the arena, or with malloc() if the arena is NULL. */
+struct iq_state *create_iq_state(long freq, long samp_rate, struct arena *arena);
+
+/** Returns the arena space needed by a state for the given frequency and its pre-computed values. */
+size_t iq_state_size(long freq, long samp_rate);
+
+/** Create a state whose table holds the number of whole cycles, up to IQ_EXACT_MAX_LEN samples long, that comes closest to the given frequency, rather than one period rounded down to whole samples. */
+struct iq_state *create_exact_iq_state(long freq, long samp_rate, struct arena *arena);
+
+/** Returns the arena space needed by create_exact_iq_state(). */
+size_t exact_iq_state_size(long freq, long samp_rate);
+
+/** Returns the frequency the state actually generates. */
+double iq_state_freq(const struct iq_state *state, long samp_rate);
+
+/** Move the state to the given absolute sample index. */
+void seek_iq_state(struct iq_state *state, long long sample);
+
+/** Multiply the pre-computed carrier IQ of the state by the given amount. */
+void scale_iq_state(struct iq_state *state, double scale);
+
 /** Free memory used by a iq_state struct. */
 void destroy_iq_state(struct iq_state *state);
     
@@ -65,13 +116,37 @@ struct iq_state* generate_tone(long freq, long samp_rate, double *samples, int s
 /** Generate a carrier signal at the given frequency */
 struct iq_state* generate_carrier(long freq, long samp_rate, complex *iq, int iq_len, struct iq_state *state);
 
-/** Module a baseband signal onto a carrier signal using amplitude modulation, overwriting the carrier IQ data. */
-void modulate_am(complex *carrier, double *baseband, int iq_len, double modulation_index);
+/** Returns the next len values of the tone where they sit in its ring, len being no more than the ring's span, and moves past them. */
+const double *tone_window(struct iq_state *state, long len);
+
+/** Returns the next len values of the carrier where they sit in its ring, len being no more than the ring's span, and moves past them. */
+const complex *carrier_window(struct iq_state *state, long len);
+
+/** Module a baseband signal onto a carrier signal using amplitude modulation, writing the result to out, which may be the carrier. */
+void modulate_am(complex *out, const complex *carrier, const double *baseband, int iq_len, double modulation_index);
+
+/** Module a baseband signal onto a carrier signal using frequency modulation, writing the result to out, which may be the carrier. */
+void modulate_fm(complex *out, const complex *carrier, const double *baseband, int iq_len, double modulation_index);
+
+/** Returns the format with the given name (ci32, cs16, or cf32), or -1 if there is none. */
+int iq_format_from_name(const char *name);
+
+/** Returns the name of the given format. */
+const char *iq_format_name(enum iq_format format);
+
+/** Returns the size in bytes of one IQ sample in the given format. */
+size_t iq_sample_size(enum iq_format format);
+
+/** Returns the full scale of the given format: IQ_FULL_SCALE for ci32, the whole 16 bits (MSB aligned, as the AD9361 takes them) for cs16, and 1.0 for cf32. */
+double iq_full_scale(enum iq_format format);
+
+/** Pack the given IQ data into interleaved little endian values of the given format, as written by write_iq(), scaled from IQ_FULL_SCALE to the format's full scale.  cs16 values are clamped to 16 bits. */
+void pack_iq(enum iq_format format, void *buf, complex *iq, int iq_len);
 
-/** Module a baseband signal onto a carrier signal using frequency modulation, overwriting the carrier IQ data. */
-void modulate_fm(complex *carrier, double *baseband, int iq_len, double modulation_index);
+/** Unpack IQ data packed by pack_iq(), scaling it back to IQ_FULL_SCALE. */
+void unpack_iq(enum iq_format format, const void *buf, complex *iq, int iq_len);
 
 /** Write the given IQ data to a file. */
-void write_iq(FILE *out, complex *iq, int iq_len);
+void write_iq(FILE *out, enum iq_format format, complex *iq, int iq_len);
 
 #endif /* !FILE_IQ_H_SEEN */
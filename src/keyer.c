@@ -0,0 +1,421 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "keyer.h"
+#include "cw.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/** Read a FIFO or terminal as bytes arrive, stamping each one for keyer_poll(). */
+static void *reader_thread(void *arg)
+{
+    struct keyer *keyer = arg;
+    struct pollfd fds[2] = {{.fd = keyer->fd, .events = POLLIN}, {.fd = keyer->wake_fd[0], .events = POLLIN}};
+
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+        if (fds[0].revents == 0)
+        {
+            continue;
+        }
+        char buf[64];
+        ssize_t len = read(keyer->fd, buf, sizeof(buf));
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (len < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            continue;
+        }
+        if (len <= 0)
+        {
+            // The input closed or failed, so nothing more will come
+            break;
+        }
+
+        pthread_mutex_lock(&keyer->lock);
+        for (ssize_t index = 0; index < len && keyer->input_count < KEYER_INPUT_LEN; index++)
+        {
+            struct key_input *input = &keyer->input[(keyer->input_head + keyer->input_count++) % KEYER_INPUT_LEN];
+            input->c = buf[index];
+            input->time = now;
+        }
+        pthread_mutex_unlock(&keyer->lock);
+    }
+    return NULL;
+}
+
+/** Start the thread that reads a FIFO or terminal.  Returns 0 on success or -1 on error. */
+static int start_reader(struct keyer *keyer, const char *path)
+{
+    // Holding the write end open keeps the FIFO from reading as closed between writers
+    if (keyer->source == KEY_FIFO && strcmp(path, "-") != 0)
+    {
+        keyer->hold_fd = open(path, O_WRONLY | O_NONBLOCK);
+    }
+    if (pipe(keyer->wake_fd) < 0)
+    {
+        perror("Error: Could not create the keyer wakeup pipe");
+        keyer->wake_fd[0] = keyer->wake_fd[1] = -1;
+        return -1;
+    }
+    pthread_mutex_init(&keyer->lock, NULL);
+    if (pthread_create(&keyer->thread, NULL, reader_thread, keyer) != 0)
+    {
+        fprintf(stderr, "Error: Could not start the keyer thread\n");
+        pthread_mutex_destroy(&keyer->lock);
+        return -1;
+    }
+    keyer->reading = true;
+    return 0;
+}
+
+int keyer_open(struct keyer *keyer, const char *path, long samp_rate, long dit_len)
+{
+    memset(keyer, 0, sizeof(struct keyer));
+    keyer->hold_fd = -1;
+    keyer->wake_fd[0] = keyer->wake_fd[1] = -1;
+    keyer->samp_rate = samp_rate;
+    keyer->dit_len = dit_len;
+    keyer->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_NONBLOCK);
+    if (keyer->fd < 0)
+    {
+        perror("Error: Could not open key input");
+        return -1;
+    }
+    fcntl(keyer->fd, F_SETFL, fcntl(keyer->fd, F_GETFL) | O_NONBLOCK);
+
+    struct stat st;
+    fstat(keyer->fd, &st);
+    if (strncmp(path, "/dev/input/", 11) == 0)
+    {
+        // Timestamps on the clock the rest of the program uses
+        int clock = CLOCK_MONOTONIC;
+        keyer->source = KEY_EVDEV;
+        keyer->timestamps = ioctl(keyer->fd, EVIOCSCLOCKID, &clock) == 0;
+    }
+    else if (S_ISFIFO(st.st_mode))
+    {
+        keyer->source = KEY_FIFO;
+    }
+    else if (isatty(keyer->fd))
+    {
+        // Take each character as it is typed, not a line at a time
+        struct termios raw;
+        tcgetattr(keyer->fd, &keyer->saved);
+        raw = keyer->saved;
+        raw.c_lflag &= ~ICANON;
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(keyer->fd, TCSANOW, &raw);
+        keyer->restore = true;
+        keyer->source = KEY_TYPED;
+    }
+    else
+    {
+        fprintf(stderr, "Error: %s is not a terminal, FIFO or input device\n", path);
+        keyer_close(keyer);
+        return -1;
+    }
+
+    keyer->latencies = malloc(sizeof(double) * KEYER_MAX_LATENCIES);
+    if (keyer->latencies == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate the latency buffer\n");
+        keyer_close(keyer);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &keyer->last_poll);
+    if (keyer->source != KEY_EVDEV && start_reader(keyer, path) < 0)
+    {
+        keyer_close(keyer);
+        return -1;
+    }
+    return 0;
+}
+
+const char *keyer_source_name(const struct keyer *keyer)
+{
+    switch (keyer->source)
+    {
+    case KEY_EVDEV:
+        return "Input Device";
+    case KEY_FIFO:
+        return "FIFO";
+    default:
+        return "Typed";
+    }
+}
+
+/** Queue a straight key change at the given offset, dropping it if it changes nothing. */
+static void add_event(struct keyer *keyer, long offset, bool down, const struct timespec *time)
+{
+    bool last = keyer->event_count > 0 ? keyer->events[keyer->event_count - 1].down : keyer->down;
+    if (down == last || keyer->event_count >= KEYER_MAX_EVENTS)
+    {
+        return;
+    }
+    struct key_event *event = &keyer->events[keyer->event_count++];
+    event->offset = offset;
+    event->down = down;
+    event->time = *time;
+}
+
+/** Queue the elements of one typed character. */
+static void add_character(struct keyer *keyer, char c, const struct timespec *time)
+{
+    bool pattern[CW_MAX_CHAR_LEN];
+    char text[2] = {c == '\n' || c == '\r' ? ' ' : c, '\0'};
+    int len = generate_cw_pattern(pattern, CW_MAX_CHAR_LEN, text, 0);
+    if (len == 0 || keyer->queued + len > KEYER_QUEUE_LEN)
+    {
+        return;
+    }
+    for (int index = 0; index < len; index++)
+    {
+        struct key_element *element = &keyer->queue[(keyer->head + keyer->queued++) % KEYER_QUEUE_LEN];
+        element->down = pattern[index];
+        element->first = index == 0;
+        element->time = *time;
+    }
+}
+
+/** Returns the offset in the next block of a key change that arrived at the given time since the last poll. */
+static long place_event(const struct keyer *keyer, const struct timespec *time, long block_len, long last_offset)
+{
+    long offset = elapsed(&keyer->last_poll, time) * keyer->samp_rate;
+    if (offset < last_offset)
+    {
+        offset = last_offset;
+    }
+    if (offset >= block_len)
+    {
+        offset = block_len - 1;
+    }
+    return offset;
+}
+
+void keyer_poll(struct keyer *keyer, long block_len)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    keyer->event_count = 0;
+    keyer->next_event = 0;
+    keyer->pos = 0;
+
+    if (keyer->source == KEY_EVDEV)
+    {
+        struct input_event ev;
+        long last_offset = 0;
+        while (read(keyer->fd, &ev, sizeof(ev)) == sizeof(ev))
+        {
+            // Key autorepeat (2) is not a change
+            if (ev.type != EV_KEY || ev.value > 1)
+            {
+                continue;
+            }
+            struct timespec time = now;
+            long offset = 0;
+            if (keyer->timestamps)
+            {
+                time.tv_sec = ev.time.tv_sec;
+                time.tv_nsec = ev.time.tv_usec * 1000;
+                offset = place_event(keyer, &time, block_len, last_offset);
+            }
+            add_event(keyer, offset, ev.value == 1, &time);
+            last_offset = offset;
+        }
+    }
+    else
+    {
+        struct key_input input[KEYER_INPUT_LEN];
+        pthread_mutex_lock(&keyer->lock);
+        int count = keyer->input_count;
+        for (int index = 0; index < count; index++)
+        {
+            input[index] = keyer->input[(keyer->input_head + index) % KEYER_INPUT_LEN];
+        }
+        keyer->input_head = (keyer->input_head + count) % KEYER_INPUT_LEN;
+        keyer->input_count = 0;
+        pthread_mutex_unlock(&keyer->lock);
+
+        long last_offset = 0;
+        for (int index = 0; index < count; index++)
+        {
+            if (keyer->source == KEY_TYPED)
+            {
+                add_character(keyer, input[index].c, &input[index].time);
+            }
+            else if (input[index].c == '1' || input[index].c == '0')
+            {
+                long offset = place_event(keyer, &input[index].time, block_len, last_offset);
+                add_event(keyer, offset, input[index].c == '1', &input[index].time);
+                last_offset = offset;
+            }
+        }
+    }
+    keyer->last_poll = now;
+}
+
+/** Note a key change being rendered, to time it once its block is pushed. */
+static void add_pending(struct keyer *keyer, const struct timespec *time)
+{
+    if (keyer->pending_count < KEYER_MAX_EVENTS)
+    {
+        keyer->pending[keyer->pending_count++] = *time;
+    }
+}
+
+long keyer_span(struct keyer *keyer, long max, bool *down)
+{
+    if (keyer->source == KEY_TYPED)
+    {
+        if (keyer->element_left == 0 && keyer->queued > 0)
+        {
+            struct key_element *element = &keyer->queue[keyer->head];
+            keyer->head = (keyer->head + 1) % KEYER_QUEUE_LEN;
+            keyer->queued--;
+            keyer->down = element->down;
+            keyer->element_left = keyer->dit_len;
+            if (element->first)
+            {
+                add_pending(keyer, &element->time);
+            }
+        }
+        *down = keyer->element_left > 0 && keyer->down;
+        if (keyer->element_left == 0)
+        {
+            return max;
+        }
+        long len = keyer->element_left < max ? keyer->element_left : max;
+        keyer->element_left -= len;
+        return len;
+    }
+
+    while (keyer->next_event < keyer->event_count && keyer->events[keyer->next_event].offset <= keyer->pos)
+    {
+        struct key_event *event = &keyer->events[keyer->next_event++];
+        keyer->down = event->down;
+        add_pending(keyer, &event->time);
+    }
+    long len = max;
+    if (keyer->next_event < keyer->event_count && keyer->events[keyer->next_event].offset - keyer->pos < len)
+    {
+        len = keyer->events[keyer->next_event].offset - keyer->pos;
+    }
+    keyer->pos += len;
+    *down = keyer->down;
+    return len;
+}
+
+void keyer_pushed(struct keyer *keyer, const struct timespec *pushed)
+{
+    for (int index = 0; index < keyer->pending_count; index++)
+    {
+        keyer->latencies[keyer->latency_count % KEYER_MAX_LATENCIES] = elapsed(&keyer->pending[index], pushed) * 1000;
+        keyer->latency_count++;
+    }
+    keyer->pending_count = 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void keyer_report(const struct keyer *keyer, FILE *out)
+{
+    long count = keyer->latency_count < KEYER_MAX_LATENCIES ? keyer->latency_count : KEYER_MAX_LATENCIES;
+    if (count == 0)
+    {
+        fprintf(out, "Key Latency: No key changes\n");
+        return;
+    }
+    double *sorted = malloc(sizeof(double) * count);
+    if (sorted == NULL)
+    {
+        return;
+    }
+    memcpy(sorted, keyer->latencies, sizeof(double) * count);
+    qsort(sorted, count, sizeof(double), compare_doubles);
+    fprintf(out, "Key Latency: Changes: %ld, p50: %0.2f ms, p90: %0.2f ms, p99: %0.2f ms, Max: %0.2f ms\n",
+            keyer->latency_count, sorted[(long)(0.5 * (count - 1))], sorted[(long)(0.9 * (count - 1))],
+            sorted[(long)(0.99 * (count - 1))], sorted[count - 1]);
+    free(sorted);
+}
+
+void keyer_close(struct keyer *keyer)
+{
+    if (keyer->reading)
+    {
+        char wake = 0;
+        if (write(keyer->wake_fd[1], &wake, 1) == 1)
+        {
+            pthread_join(keyer->thread, NULL);
+        }
+        pthread_mutex_destroy(&keyer->lock);
+        keyer->reading = false;
+    }
+    for (int index = 0; index < 2; index++)
+    {
+        if (keyer->wake_fd[index] >= 0)
+        {
+            close(keyer->wake_fd[index]);
+            keyer->wake_fd[index] = -1;
+        }
+    }
+    if (keyer->hold_fd >= 0)
+    {
+        close(keyer->hold_fd);
+        keyer->hold_fd = -1;
+    }
+    if (keyer->restore)
+    {
+        tcsetattr(keyer->fd, TCSANOW, &keyer->saved);
+    }
+    if (keyer->fd > STDIN_FILENO)
+    {
+        close(keyer->fd);
+    }
+    free(keyer->latencies);
+    keyer->latencies = NULL;
+}
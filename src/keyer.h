@@ -0,0 +1,153 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File keyer.h */
+#ifndef FILE_KEYER_H_SEEN
+#define FILE_KEYER_H_SEEN
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <termios.h>
+#include <pthread.h>
+
+/* Block length and kernel buffer count used for live keying unless set with -b and -k */
+#define KEYER_IQ_LEN 1024
+#define KEYER_KERNEL_BUFFERS 2
+
+/* Most straight key events taken in one block */
+#define KEYER_MAX_EVENTS 64
+
+/* Typed elements, one per dit, that can wait to be sent */
+#define KEYER_QUEUE_LEN 4096
+
+/* Latencies kept for the percentiles, the most recent ones */
+#define KEYER_MAX_LATENCIES 65536
+
+/* Bytes from a FIFO or terminal that can wait for the next block */
+#define KEYER_INPUT_LEN 256
+
+enum key_source
+{
+    KEY_TYPED,
+    KEY_EVDEV,
+    KEY_FIFO
+};
+
+/** A change of a straight key, placed at a sample offset in the block being rendered. */
+struct key_event
+{
+    long offset;
+    bool down;
+    struct timespec time;
+};
+
+/** A byte read from a FIFO or terminal and the time it was read. */
+struct key_input
+{
+    char c;
+    struct timespec time;
+};
+
+/** One dit length of typed text. */
+struct key_element
+{
+    bool down;
+    bool first;
+    struct timespec time;
+};
+
+/** Live key input and the key state it gives over the samples being rendered.
+
+    A straight key (an evdev input device, or a FIFO that is written 1 for key
+    down and 0 for key up, like a GPIO value file) is read once per block.
+    Events that carry a timestamp are placed in the next block at the same
+    offset they arrived at during the last one, so the operator's timing is
+    kept to the sample behind a fixed one block delay.  Text typed on a
+    terminal is sent as Morse at the configured speed.
+
+    Input devices timestamp their events in the kernel.  A FIFO or terminal
+    is read by its own thread instead, which stamps each byte as it arrives,
+    so its key changes are placed and timed the same way. */
+struct keyer
+{
+    enum key_source source;
+    int fd;
+    bool timestamps;
+    long samp_rate;
+    long dit_len;
+    bool down;
+    long pos;
+    struct timespec last_poll;
+
+    // Bytes from the reader thread, the oldest at input_head
+    struct key_input input[KEYER_INPUT_LEN];
+    int input_head;
+    int input_count;
+    int hold_fd;
+    int wake_fd[2];
+    pthread_mutex_t lock;
+    pthread_t thread;
+    bool reading;
+
+    struct key_event events[KEYER_MAX_EVENTS];
+    int event_count;
+    int next_event;
+
+    struct key_element queue[KEYER_QUEUE_LEN];
+    int head;
+    int queued;
+    long element_left;
+
+    struct termios saved;
+    bool restore;
+
+    // Key changes in the block being rendered, waiting for it to be pushed
+    struct timespec pending[KEYER_MAX_EVENTS];
+    int pending_count;
+    double *latencies;
+    long latency_count;
+};
+
+/** Open a key source: an evdev device under /dev/input, a FIFO, or a terminal ("-" for STDIN).  Returns 0 on success or -1 on error. */
+int keyer_open(struct keyer *keyer, const char *path, long samp_rate, long dit_len);
+
+/** Returns the name of the keyer's input type. */
+const char *keyer_source_name(const struct keyer *keyer);
+
+/** Read the key events that arrived since the last call, before rendering a block of block_len samples. */
+void keyer_poll(struct keyer *keyer, long block_len);
+
+/** Returns how many of the next samples, up to max, the key stays in the state stored in down. */
+long keyer_span(struct keyer *keyer, long max, bool *down);
+
+/** Record that the block rendered since the last poll was accepted by the device at the given time. */
+void keyer_pushed(struct keyer *keyer, const struct timespec *pushed);
+
+/** Print the key to push latency percentiles. */
+void keyer_report(const struct keyer *keyer, FILE *out);
+
+/** Close the key source and restore the terminal. */
+void keyer_close(struct keyer *keyer);
+
+#endif /* !FILE_KEYER_H_SEEN */
@@ -0,0 +1,259 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "loop.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+/** Watch fd for the given epoll events.  Returns 0 on success or -1 on error. */
+static int watch(struct event_loop *loop, int fd, uint32_t events)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/** Remove a socket at path, leaving anything else alone.  Returns 0 if nothing is there any more, or -1 if something other than a socket is. */
+static int remove_socket(const char *path)
+{
+    struct stat info;
+    if (lstat(path, &info) < 0)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (!S_ISSOCK(info.st_mode))
+    {
+        return -1;
+    }
+    return unlink(path) < 0 && errno != ENOENT ? -1 : 0;
+}
+
+/** Open the control socket.  Returns 0 on success or -1 on error. */
+static int open_control(struct event_loop *loop, const char *path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Error: Control socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    loop->control_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (loop->control_fd < 0)
+    {
+        perror("Error: Could not create control socket");
+        return -1;
+    }
+    // A socket left behind by an earlier run would make bind() fail, but
+    // the path may name some other file that is not ours to delete
+    if (remove_socket(path) < 0)
+    {
+        fprintf(stderr, "Error: %s exists and is not a socket, not replacing it\n", path);
+        return -1;
+    }
+    if (bind(loop->control_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("Error: Could not bind control socket");
+        return -1;
+    }
+    loop->control_path = path;
+    return watch(loop, loop->control_fd, EPOLLIN);
+}
+
+int loop_init(struct event_loop *loop, const char *control_path)
+{
+    memset(loop, 0, sizeof(struct event_loop));
+    loop->signal_fd = loop->timer_fd = loop->device_fd = loop->control_fd = -1;
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+    {
+        perror("Error: Could not block signals");
+        return -1;
+    }
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->epoll_fd < 0 || loop->signal_fd < 0 || loop->timer_fd < 0 ||
+        watch(loop, loop->signal_fd, EPOLLIN) < 0 || watch(loop, loop->timer_fd, EPOLLIN) < 0)
+    {
+        perror("Error: Could not set up the event loop");
+        loop_close(loop);
+        return -1;
+    }
+    if (control_path != NULL && open_control(loop, control_path) < 0)
+    {
+        loop_close(loop);
+        return -1;
+    }
+    return 0;
+}
+
+int loop_set_device(struct event_loop *loop, int fd)
+{
+    if (loop->device_fd >= 0)
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->device_fd, NULL);
+    }
+    loop->device_fd = fd;
+    if (fd >= 0 && watch(loop, fd, EPOLLOUT) < 0)
+    {
+        perror("Error: Could not watch the device");
+        loop->device_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void loop_set_timer(struct event_loop *loop, double seconds)
+{
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = (time_t)seconds;
+    timer.it_value.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+    if (seconds > 0 && timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0)
+    {
+        // A zero value would disarm it
+        timer.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(loop->timer_fd, 0, &timer, NULL);
+}
+
+/** Parse a command from the control socket. */
+static enum control_command read_command(struct event_loop *loop)
+{
+    char text[LOOP_CONTROL_LEN + 1];
+    loop->sender_len = sizeof(loop->sender);
+    ssize_t len = recvfrom(loop->control_fd, text, LOOP_CONTROL_LEN, 0, (struct sockaddr *)&loop->sender, &loop->sender_len);
+    if (len < 0)
+    {
+        loop->sender_len = 0;
+        return CONTROL_NONE;
+    }
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r' || text[len - 1] == ' '))
+    {
+        len--;
+    }
+    text[len] = '\0';
+
+    if (strcmp(text, "stop") == 0)
+    {
+        return CONTROL_STOP;
+    }
+    if (strcmp(text, "status") == 0)
+    {
+        return CONTROL_STATUS;
+    }
+    loop_reply(loop, "Unknown command (stop, status)\n");
+    return CONTROL_NONE;
+}
+
+int loop_wait(struct event_loop *loop, int timeout_ms)
+{
+    struct epoll_event ready[LOOP_MAX_EVENTS];
+    int count = epoll_wait(loop->epoll_fd, ready, LOOP_MAX_EVENTS, timeout_ms);
+    if (count < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    int events = 0;
+    for (int index = 0; index < count; index++)
+    {
+        int fd = ready[index].data.fd;
+        if (fd == loop->device_fd)
+        {
+            events |= LOOP_DEVICE;
+        }
+        else if (fd == loop->signal_fd)
+        {
+            struct signalfd_siginfo info;
+            while (read(loop->signal_fd, &info, sizeof(info)) == sizeof(info))
+            {
+                events |= LOOP_SIGNAL;
+            }
+        }
+        else if (fd == loop->timer_fd)
+        {
+            uint64_t expirations;
+            if (read(loop->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            {
+                events |= LOOP_TIMER;
+            }
+        }
+        else if (fd == loop->control_fd)
+        {
+            loop->command = read_command(loop);
+            if (loop->command != CONTROL_NONE)
+            {
+                events |= LOOP_CONTROL;
+            }
+        }
+    }
+    return events;
+}
+
+void loop_reply(struct event_loop *loop, const char *text)
+{
+    // Unbound senders have no address to reply to
+    if (loop->sender_len > sizeof(sa_family_t))
+    {
+        sendto(loop->control_fd, text, strlen(text), MSG_DONTWAIT, (struct sockaddr *)&loop->sender, loop->sender_len);
+    }
+}
+
+void loop_close(struct event_loop *loop)
+{
+    int *fds[] = {&loop->epoll_fd, &loop->signal_fd, &loop->timer_fd, &loop->control_fd};
+    for (size_t index = 0; index < sizeof(fds) / sizeof(fds[0]); index++)
+    {
+        if (*fds[index] >= 0)
+        {
+            close(*fds[index]);
+            *fds[index] = -1;
+        }
+    }
+    if (loop->control_path != NULL)
+    {
+        remove_socket(loop->control_path);
+        loop->control_path = NULL;
+    }
+    loop->device_fd = -1;
+}
@@ -0,0 +1,95 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/* File loop.h */
+#ifndef FILE_LOOP_H_SEEN
+#define FILE_LOOP_H_SEEN
+
+#include "../config.h"
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Longest control command, in bytes */
+#define LOOP_CONTROL_LEN 64
+
+/* Most events taken from one wait */
+#define LOOP_MAX_EVENTS 8
+
+/** What woke a wait, as bits. */
+enum loop_event
+{
+    LOOP_DEVICE = 1,
+    LOOP_TIMER = 2,
+    LOOP_SIGNAL = 4,
+    LOOP_CONTROL = 8
+};
+
+/** A command received on the control socket. */
+enum control_command
+{
+    CONTROL_NONE,
+    CONTROL_STOP,
+    CONTROL_STATUS
+};
+
+/** Waits on everything the streaming loops react to at once: the device
+    having room for a block, a timer, SIGINT and SIGTERM, and commands on a
+    control socket.
+
+    The signals are blocked in the thread that sets up the loop and in every
+    thread it starts afterwards, and read from a signalfd instead, so a
+    signal wakes the wait directly rather than interrupting whatever call is
+    in progress. */
+struct event_loop
+{
+    int epoll_fd;
+    int signal_fd;
+    int timer_fd;
+    int device_fd;
+    int control_fd;
+    const char *control_path;
+
+    // The last command and who sent it
+    enum control_command command;
+    struct sockaddr_un sender;
+    socklen_t sender_len;
+};
+
+/** Block SIGINT and SIGTERM and start watching for them, and for commands on a Unix datagram socket at control_path if it is not NULL.  Returns 0 on success or -1 on error. */
+int loop_init(struct event_loop *loop, const char *control_path);
+
+/** Watch fd for room to write, replacing any device watched before.  -1 stops watching.  Returns 0 on success or -1 on error. */
+int loop_set_device(struct event_loop *loop, int fd);
+
+/** Fire LOOP_TIMER once after the given number of seconds, or never if 0. */
+void loop_set_timer(struct event_loop *loop, double seconds);
+
+/** Wait up to timeout_ms milliseconds (-1 for no limit) for events.  Returns the events that fired, 0 on timeout, or -1 on error. */
+int loop_wait(struct event_loop *loop, int timeout_ms);
+
+/** Send a line back to whoever sent the last command, if they can be replied to. */
+void loop_reply(struct event_loop *loop, const char *text);
+
+/** Close the descriptors and remove the control socket. */
+void loop_close(struct event_loop *loop);
+
+#endif /* !FILE_LOOP_H_SEEN */
@@ -23,6 +23,450 @@
 const double M = 1000000;
 const double K = 1000;
 
+/* Seconds the last block waited for the device to accept it */
+static double device_wait;
+
+/* Device setup runs on its own thread while the first block renders */
+static pthread_t init_thread;
+static bool init_running;
+static bool init_failed;
+static struct beacon_config init_config;
+static struct timespec program_start, init_done;
+
+/* Streaming waits for the device, timers, signals and control commands here */
+static struct event_loop events;
+static bool looping;
+static long long samples_sent;
+
+static bool stop;
+static void handle_sig(int sig)
+{
+    (void)sig;
+    fprintf(stderr, " Waiting for process to finish...\n");
+    stop = true;
+}
+
+static double ms_since_start(struct timespec *when)
+{
+    return (when->tv_sec - program_start.tv_sec) * 1000.0 + (when->tv_nsec - program_start.tv_nsec) / 1e6;
+}
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/** Wait up to timeout_ms milliseconds (-1 for no limit) for events and act on signals and control commands.  Returns the events that fired. */
+static int handle_events(int timeout_ms)
+{
+    int fired = looping ? loop_wait(&events, timeout_ms) : 0;
+    if (fired < 0)
+    {
+        perror("Error: Event loop failed");
+        beacon_exit(1);
+    }
+    if (fired & LOOP_SIGNAL)
+    {
+        handle_sig(SIGINT);
+    }
+    if ((fired & LOOP_CONTROL) && events.command == CONTROL_STOP)
+    {
+        loop_reply(&events, "Stopping\n");
+        handle_sig(SIGTERM);
+    }
+    else if ((fired & LOOP_CONTROL) && events.command == CONTROL_STATUS)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        char status[128];
+        snprintf(status, sizeof(status), "Uptime: %0.1f s, Samples Sent: %lld\n", ms_since_start(&now) / 1000, samples_sent);
+        loop_reply(&events, status);
+    }
+    return fired;
+}
+
+/** Sleep until the device has room for the next block or the run is stopped.  Devices that can't be polled are written to straight away.  Returns the number of seconds waited. */
+static double wait_for_device()
+{
+    if (events.device_fd < 0)
+    {
+        // Still pick up signals and commands between blocks
+        handle_events(0);
+        return 0;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!stop && !(handle_events(-1) & LOOP_DEVICE))
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_seconds(&start, &end);
+}
+
+/** Sleep for the given number of seconds, waking early if the run is stopped. */
+static void sleep_events(double seconds)
+{
+    loop_set_timer(&events, seconds);
+    while (!stop && !(handle_events(-1) & LOOP_TIMER))
+        ;
+    loop_set_timer(&events, 0);
+}
+
+#ifdef ADALM_SUPPORT
+/** Watch the TX buffer for room, or fall back to blocking pushes if it can't be polled. */
+static void watch_device(bool report)
+{
+    int fd = adalm_tx_poll_fd();
+    if (loop_set_device(&events, fd) < 0)
+    {
+        beacon_exit(1);
+    }
+    if (report)
+    {
+        fprintf(stderr, "Event Loop: Device Polling: %s\n", fd >= 0 ? "Yes" : "No, Blocking Pushes");
+    }
+}
+#endif
+
+/** Parse a comma separated list of frequencies in MHz.  Returns the number parsed or -1 on error. */
+static int parse_hops(const char *list, long *freqs, int max)
+{
+    int count = 0;
+    const char *p = list;
+    while (*p != '\0')
+    {
+        char *end;
+        double freq = strtod(p, &end);
+        if (end == p || freq <= 0 || count == max || (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        freqs[count++] = (long)(freq * M);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+/** Load the configured Doppler profile.  Returns true if there is one. */
+static bool load_doppler(struct beacon_config config, struct doppler *doppler)
+{
+    int ret;
+    if (config.doppler_path != NULL)
+    {
+        ret = doppler_load(doppler, config.doppler_path, config.samp_rate);
+    }
+    else if (config.doppler_pass_set)
+    {
+        ret = doppler_pass(doppler, config.doppler_pass[0], config.doppler_pass[1], config.doppler_pass[2],
+                           config.tx_freq, config.samp_rate);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Error: Invalid pass\n");
+        }
+    }
+    else
+    {
+        return false;
+    }
+    if (ret < 0)
+    {
+        wait_init();
+        beacon_exit(1);
+    }
+
+    double low = doppler->offsets[0], high = low;
+    for (int index = 1; index < doppler->count; index++)
+    {
+        low = doppler->offsets[index] < low ? doppler->offsets[index] : low;
+        high = doppler->offsets[index] > high ? doppler->offsets[index] : high;
+    }
+    fprintf(stderr, "Doppler: %d Points over %0.1f s, Offset: %0.1f Hz to %0.1f Hz\n", doppler->count,
+            doppler->times[doppler->count - 1] - doppler->times[0], low, high);
+    return true;
+}
+
+/** Set up the configured channel impairments.  Returns true if there are any. */
+static bool load_impairments(struct beacon_config config, struct impairments *impair)
+{
+    if (config.impair_spec == NULL)
+    {
+        return false;
+    }
+
+    // The SNR is relative to the key down power of the modulated signal
+    struct beacon_params params = beacon_params(config);
+    struct beacon *probe = beacon_create(&params);
+    long probe_len = config.samp_rate / 10;
+    complex *probe_iq = malloc(sizeof(complex) * probe_len);
+    if (probe == NULL || probe_iq == NULL)
+    {
+        fprintf(stderr, "Error: Could not measure the signal power\n");
+        wait_init();
+        beacon_exit(1);
+    }
+    // The second block is past the rise of the key
+    beacon_render_keyed(probe, probe_iq, probe_len, 1);
+    beacon_render_keyed(probe, probe_iq, probe_len, 1);
+    double power = 0;
+    for (long index = 0; index < probe_len; index++)
+    {
+        power += creal(probe_iq[index]) * creal(probe_iq[index]) + cimag(probe_iq[index]) * cimag(probe_iq[index]);
+    }
+    power /= probe_len;
+    free(probe_iq);
+    beacon_destroy(probe);
+
+    if (impair_init(impair, &config.impair, config.samp_rate, power) < 0)
+    {
+        wait_init();
+        beacon_exit(1);
+    }
+    fprintf(stderr, "Channel: %s\n", config.impair_spec);
+    return true;
+}
+
+/** Returns the buffer to render the next block into: a free block from the tee if there is one, otherwise the output buffer. */
+static complex *next_block(struct tee *tee, complex *iq, long len)
+{
+    if (tee == NULL)
+    {
+        return iq;
+    }
+    complex *block = tee_acquire(tee, len);
+    if (block == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate a block for the sinks\n");
+        beacon_exit(1);
+    }
+    return block;
+}
+
+/** Check that the sinks don't clash with each other or with the device.  Returns true if they are usable. */
+static bool check_tee(struct beacon_config config)
+{
+    int kinds[TEE_SHM + 1] = {0};
+    for (int index = 0; index < config.tee_count; index++)
+    {
+        const struct tee_sink_params *sink = &config.tee[index];
+        kinds[sink->kind]++;
+        if (sink->kind == TEE_FILE && strcmp(sink->target, "-") == 0 &&
+            (config.device == DEVICE_FILE || config.device == DEVICE_URING))
+        {
+            fprintf(stderr, "Error: The device already writes to STDOUT\n");
+            return false;
+        }
+        // A ring's slots are sized once, the network sink grows with the blocks
+        if (sink->kind == TEE_SHM && config.autotune)
+        {
+            fprintf(stderr, "Error: --autotune can lengthen blocks past the slots of a shared memory ring\n");
+            return false;
+        }
+    }
+    // There is only one network sender and one shared memory ring
+    if (kinds[TEE_NET] > (config.device == DEVICE_NET ? 0 : 1) || kinds[TEE_SHM] > (config.device == DEVICE_SHM ? 0 : 1))
+    {
+        fprintf(stderr, "Error: Only one network and one shared memory output can be used at a time\n");
+        return false;
+    }
+    if (config.device == DEVICE_RENDER)
+    {
+        fprintf(stderr, "Error: --tee applies to the stream, not to --render\n");
+        return false;
+    }
+    return true;
+}
+
+/** Render the next len samples, on the pool's threads if there is one. */
+static void render_iq(struct beacon *ctx, struct render_pool *pool, complex *iq, long len)
+{
+    if (pool == NULL)
+    {
+        beacon_render_iq(ctx, iq, len);
+        return;
+    }
+    // ctx only keeps track of the position
+    long long start = beacon_tell(ctx);
+    render_pool_render(pool, start, iq, len);
+    beacon_seek(ctx, start + len);
+}
+
+/** Render the next block.  When gating, a block that reaches gate_before
+    samples ahead of the start of the next repetition is cut off there and the
+    rest filled with silence, so TX is off while the LO moves or the channel is
+    checked.  The number of silent samples is stored in gated, the start of the
+    next repetition in cycle, and true is returned. */
+static bool render_block(struct beacon *ctx, struct render_pool *pool, complex *iq, long iq_len, bool gating, long gate_before, long *gated, long long *cycle)
+{
+    *cycle = beacon_next_cycle(ctx);
+    long long until_gate = *cycle - gate_before - beacon_tell(ctx);
+    bool ends_cycle = gating && until_gate <= iq_len;
+    long len = iq_len;
+    if (ends_cycle)
+    {
+        len = until_gate > 0 ? until_gate : 0;
+    }
+    render_iq(ctx, pool, iq, len);
+    for (long index = len; index < iq_len; index++)
+    {
+        iq[index] = 0;
+    }
+    *gated = iq_len - len;
+    return ends_cycle;
+}
+
+/** Set up listening for the band around the carrier.  Returns the number of samples to listen for before each repetition. */
+static long init_listener(struct beacon_config config, struct listener *listener, long long cycle_len)
+{
+    // AM puts sidebands a tone away on both sides and CW a tone above
+    detector_init(&listener->detector, config.samp_rate,
+                  config.carrier_freq - config.tone_freq - LISTEN_MARGIN,
+                  config.carrier_freq + config.tone_freq + LISTEN_MARGIN);
+
+    // One block, but at least one detector segment and at most half a repetition
+    long len = config.iq_len > listener->detector.segment_len ? config.iq_len : listener->detector.segment_len;
+    if (len > cycle_len / 2)
+    {
+        len = cycle_len / 2;
+    }
+    listener->len = len;
+    listener->reported = false;
+    listener->rx = malloc(sizeof(complex) * len);
+    listener->raw = malloc(iq_sample_size(config.format) * len);
+    listener->file = NULL;
+    // unpack_iq() brings every recording format's full scale to IQ_FULL_SCALE
+    listener->full_scale = IQ_FULL_SCALE;
+#ifdef ADALM_SUPPORT
+    if (config.listen_file == NULL)
+    {
+        listener->full_scale = ADALM_RX_FULL_SCALE;
+    }
+#endif
+    if (listener->rx == NULL || listener->raw == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate the listen buffer\n");
+        beacon_exit(1);
+    }
+    if (config.listen_file != NULL)
+    {
+        listener->file = fopen(config.listen_file, "rb");
+        if (listener->file == NULL)
+        {
+            perror("Error: Could not open the recording to listen to");
+            beacon_exit(1);
+        }
+    }
+    return len;
+}
+
+static void free_listener(struct listener *listener)
+{
+    if (listener->file != NULL)
+    {
+        fclose(listener->file);
+    }
+    free(listener->rx);
+    free(listener->raw);
+}
+
+/** Receive one block from the device, or from the recording standing in for it. */
+static long receive(struct beacon_config config, struct listener *listener)
+{
+    if (listener->file != NULL)
+    {
+        size_t sample_size = iq_sample_size(config.format);
+        long got = fread(listener->raw, sample_size, listener->len, listener->file);
+        if (got < listener->len)
+        {
+            // Loop the recording
+            rewind(listener->file);
+            got += fread(listener->raw + got * sample_size, sample_size, listener->len - got, listener->file);
+        }
+        unpack_iq(config.format, listener->raw, listener->rx, got);
+
+        // Take as long as the radio would
+        sleep_events((double)got / config.samp_rate);
+        return got;
+    }
+#ifdef ADALM_SUPPORT
+    return adalm_receive(listener->rx, listener->len);
+#else
+    return -1;
+#endif
+}
+
+/** Wait until there is no signal in the band the beacon uses. */
+static void listen_before_transmit(struct beacon_config config, struct listener *listener, long freq)
+{
+#ifdef ADALM_SUPPORT
+    if (listener->file == NULL)
+    {
+        adalm_rx_tune(freq);
+        if (adalm_rx_start(listener->len) < 0)
+        {
+            return;
+        }
+    }
+#else
+    (void)freq;
+#endif
+    bool deferred = false;
+    while (!stop)
+    {
+        handle_events(0);
+        long got = receive(config, listener);
+        if (got <= 0)
+        {
+            fprintf(stderr, "Warning: Could not receive, transmitting without listening\n");
+            break;
+        }
+
+        struct timespec detect_start, detect_end;
+        clock_gettime(CLOCK_MONOTONIC, &detect_start);
+        double power = detector_power(&listener->detector, listener->rx, got, listener->full_scale);
+        clock_gettime(CLOCK_MONOTONIC, &detect_end);
+        if (!listener->reported)
+        {
+            double detect = elapsed_seconds(&detect_start, &detect_end);
+            double period = (double)got / config.samp_rate;
+            fprintf(stderr, "Listen: Detection: %0.3f ms per %0.3f ms block, %d frequencies\n",
+                    detect * 1000, period * 1000, listener->detector.bins);
+            if (detect > period)
+            {
+                fprintf(stderr, "Warning: Detection is slower than real time\n");
+            }
+            listener->reported = true;
+        }
+
+        if (power < config.listen_threshold)
+        {
+            if (deferred)
+            {
+                fprintf(stderr, "Channel clear (%0.1f dBFS), transmitting\n", power);
+            }
+            break;
+        }
+        if (!deferred)
+        {
+            fprintf(stderr, "Channel busy (%0.1f dBFS), deferring\n", power);
+            deferred = true;
+        }
+    }
+#ifdef ADALM_SUPPORT
+    if (listener->file == NULL)
+    {
+        adalm_rx_stop();
+    }
+#endif
+}
+
+static void *run_init(void *arg)
+{
+    (void)arg;
+    // Exiting is left to the main thread, which may be using the device state
+    init_failed = init(init_config) < 0;
+    clock_gettime(CLOCK_MONOTONIC, &init_done);
+    return NULL;
+}
+
 void print_version(FILE *out)
 {
     fprintf(out, "%s\n", PACKAGE_STRING);
@@ -45,7 +489,7 @@ void print_help(FILE *out, const char *executable_name)
     fprintf(out, "Common Options:\n");
     fprintf(out, "-U, --uhf\t\ttransmit using default UHF frequency of %0.3f MHz\n", FREQ_U / M);
     fprintf(out, "-S, --sband\t\ttransmit using default S-Band frequency %0.3f MHz\n", FREQ_S / M);
-    fprintf(out, "-m, --modulation\tsets the modulation (options: AM,FM default: AM)\n");
+    fprintf(out, "-m, --modulation\tsets the modulation (options: AM,FM,CW default: AM)\n");
     fprintf(out, "-A, --am\t\tsets the modulation to AM\n");
     fprintf(out, "-F, --fm\t\tsets the modulation to FM\n");
     fprintf(out, "\n");
@@ -60,12 +504,43 @@ void print_help(FILE *out, const char *executable_name)
     fprintf(out, "-g, --gain\t\tsets the hardware gain (0 to 90, default: %0.3f)\n", DEFAULT_GAIN);
     fprintf(out, "-s, --sampling_rate\tsets the sampling rate of the device (default: %d)\n", DEFAULT_SAMP_RATE);
     fprintf(out, "-f, --frequency\t\tsets the transmission frequency in MHz (default: %0.3f MHz)\n", FREQ_S / M);
+    fprintf(out, "-H, --hop\t\trotates through a comma separated list of frequencies in MHz, one per repetition of the message\n");
+    fprintf(out, "-L, --listen\t\tholds off each repetition of the message until the channel is clear\n");
+    fprintf(out, "    --listen-threshold\tsets the power in dBFS above which the channel is busy (default: %0.1f)\n", DEFAULT_LISTEN_THRESHOLD);
+    fprintf(out, "    --listen-file\tlistens to a recording in the --format layout instead of the receiver\n");
+    fprintf(out, "-k, --kernel-buffers\tsets the number of kernel TX buffers (default: driver default)\n");
+    fprintf(out, "-T, --autotune\t\tadjusts the buffer length and kernel buffer count at runtime for the lowest latency without underruns\n");
+    fprintf(out, "    --max-underruns\tsets the underruns per minute allowed by --autotune (default: %0.3f)\n", DEFAULT_MAX_UNDERRUNS);
+    fprintf(out, "-P, --metrics-port\tserves OpenMetrics (Prometheus) statistics on http://127.0.0.1:<port>/metrics\n");
+    fprintf(out, "    --control\t\taccepts stop and status commands on a Unix datagram socket at the given path\n");
     fprintf(out, "-o, --stdout\t\twrite IQ data to STDOUT\n");
+    fprintf(out, "-r, --uring\t\twrite IQ data to STDOUT using io_uring\n");
+    fprintf(out, "-n, --net\t\tstream IQ data to a network address (udp:host:port or tcp:host:port)\n");
+    fprintf(out, "-M, --shm\t\tpublish IQ data to a shared memory ring with the given name (e.g. /beacon)\n");
+    fprintf(out, "-O, --render\t\trender IQ data to a file as fast as possible instead of streaming it\n");
+    fprintf(out, "-D, --decode\t\twrite the IQ data in a .bcn file to STDOUT and exit\n");
+    fprintf(out, "-B, --batch\t\trender every entry of a CSV manifest to its own file and exit\n");
+    fprintf(out, "    --play\t\tsends a recording in the --format layout instead of a message (full scale: ci32 +/-2048, cs16 +/-32768, cf32 +/-1.0)\n");
+    fprintf(out, "    --loop\t\trepeats the --play recording until interrupted\n");
+    fprintf(out, "    --doppler\t\tshifts the signal by a profile of \"seconds offset_hz\" lines, interpolated linearly\n");
+    fprintf(out, "    --doppler-pass\tpre-compensates the signal for a receiver on a straight line pass: seconds to closest approach,closest range in km,speed in km/s\n");
+    fprintf(out, "    --doppler-check\tcompares the Doppler shift with a reference over --duration seconds and exits\n");
+    fprintf(out, "    --tee\t\talso sends every block to a file (- for STDOUT), network or shared memory sink without holding up the device,\n"
+                 "\t\t\te.g. file:tx.cs16,queue=32,drop=newest|oldest, net:udp:host:port or shm:name (up to %d)\n", TEE_MAX_SINKS);
+    fprintf(out, "    --impair\t\tpasses the signal through a simulated channel, e.g. snr=10,bw=2500,offset=20,drift=0.5,\n"
+                 "\t\t\tfading=rayleigh|rician,k=4,fade-rate=0.3,qsb=10:0.1,taps=500:-6/1200:-12,seed=7\n");
+    fprintf(out, "-K, --key\t\tkeys live from an input device, a FIFO of 1s and 0s, or text typed on a terminal (- for STDIN)\n");
+    fprintf(out, "-d, --duration\t\tsets the number of seconds to render (default: %0.0f)\n", DEFAULT_DURATION);
+    fprintf(out, "-j, --threads\t\tsets the number of render threads (default: one per CPU for --render and --batch, one when streaming)\n");
+    fprintf(out, "    --format\t\tsets the IQ format for STDOUT, network, shared memory, and file output (options: ci32,cs16,cf32 default: ci32, full scale: ci32 +/-2048, cs16 +/-32768, cf32 +/-1.0)\n");
     fprintf(out, "\n");
     fprintf(out, "Advanced Options:\n");
     fprintf(out, "-c, --carrier-offset\tsets the carrier offset frequency in Hz (default: %ld Hz)\n", DEFAULT_CARRIER_FREQ);
     fprintf(out, "-m, --modulation-index\tsets the modulation index (default: %0.3f)\n", DEFAULT_MODULATION_INDEX);
     fprintf(out, "-b, --buffer-length\tsets the length of the internal IQ buffer (default: %ld)\n", DEFAULT_IQ_LEN);
+    fprintf(out, "    --shm-slots\t\tsets the number of blocks in the shared memory ring (default: %d)\n", DEFAULT_SHM_SLOTS);
+    fprintf(out, "    --hugepages\t\tbacks the signal tables and buffers with 2 MB huge pages where available\n");
+    fprintf(out, "    --uring-depth\tsets the number of io_uring writes in flight (default: %d)\n", DEFAULT_URING_DEPTH);
     fprintf(out, "\n");
     fprintf(out, "Misc Options:\n");
     fprintf(out, "-v, --version\t\tprints version, copyright, and contact information\n");
@@ -75,6 +550,21 @@ void print_help(FILE *out, const char *executable_name)
     fprintf(out, "Homepage: <%s>\n", PACKAGE_URL);
 }
 
+/** Returns true if any character of the message can be sent in Morse code. */
+static bool has_morse(const char *message)
+{
+    bool pattern[CW_MAX_CHAR_LEN];
+    for (const char *c = message; *c != '\0'; c++)
+    {
+        char text[2] = {*c, '\0'};
+        if (generate_cw_pattern(pattern, CW_MAX_CHAR_LEN, text, 0) > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 struct beacon_config parse_config(int argc, char **argv)
 {
     struct beacon_config config;
@@ -95,6 +585,34 @@ struct beacon_config parse_config(int argc, char **argv)
     config.gain = DEFAULT_GAIN;
     config.modulation = MOD_AM;
     config.modulation_index = DEFAULT_MODULATION_INDEX;
+    config.uring_depth = DEFAULT_URING_DEPTH;
+    config.net_address = NULL;
+    config.format = FORMAT_CI32;
+    config.shm_name = NULL;
+    config.shm_slots = DEFAULT_SHM_SLOTS;
+    config.render_path = NULL;
+    config.kernel_buffers = 0;
+    config.autotune = false;
+    config.max_underruns = DEFAULT_MAX_UNDERRUNS;
+    config.metrics_port = 0;
+    config.hop_count = 0;
+    config.hugepages = false;
+    config.decode_path = NULL;
+    config.batch_path = NULL;
+    config.listen = false;
+    config.listen_threshold = DEFAULT_LISTEN_THRESHOLD;
+    config.listen_file = NULL;
+    config.play_path = NULL;
+    config.loop = false;
+    config.key_path = NULL;
+    config.doppler_path = NULL;
+    config.doppler_pass_set = false;
+    config.doppler_check = false;
+    config.impair_spec = NULL;
+    config.tee_count = 0;
+    config.control_path = NULL;
+    config.duration = DEFAULT_DURATION;
+    config.threads = 0;
 
     bool help_flag = false;
 
@@ -118,6 +636,35 @@ struct beacon_config parse_config(int argc, char **argv)
                 {"am", no_argument, 0, 'A'},
                 {"fm", no_argument, 0, 'F'},
                 {"stdout", no_argument, 0, 'o'},
+                {"uring", no_argument, 0, 'r'},
+                {"uring-depth", required_argument, 0, OPT_URING_DEPTH},
+                {"net", required_argument, 0, 'n'},
+                {"format", required_argument, 0, OPT_FORMAT},
+                {"shm", required_argument, 0, 'M'},
+                {"shm-slots", required_argument, 0, OPT_SHM_SLOTS},
+                {"render", required_argument, 0, 'O'},
+                {"kernel-buffers", required_argument, 0, 'k'},
+                {"autotune", no_argument, 0, 'T'},
+                {"max-underruns", required_argument, 0, OPT_MAX_UNDERRUNS},
+                {"hugepages", no_argument, 0, OPT_HUGEPAGES},
+                {"decode", required_argument, 0, 'D'},
+                {"batch", required_argument, 0, 'B'},
+                {"metrics-port", required_argument, 0, 'P'},
+                {"hop", required_argument, 0, 'H'},
+                {"listen", no_argument, 0, 'L'},
+                {"listen-threshold", required_argument, 0, OPT_LISTEN_THRESHOLD},
+                {"listen-file", required_argument, 0, OPT_LISTEN_FILE},
+                {"play", required_argument, 0, OPT_PLAY},
+                {"loop", no_argument, 0, OPT_LOOP},
+                {"key", required_argument, 0, 'K'},
+                {"doppler", required_argument, 0, OPT_DOPPLER},
+                {"doppler-pass", required_argument, 0, OPT_DOPPLER_PASS},
+                {"doppler-check", no_argument, 0, OPT_DOPPLER_CHECK},
+                {"impair", required_argument, 0, OPT_IMPAIR},
+                {"tee", required_argument, 0, OPT_TEE},
+                {"control", required_argument, 0, OPT_CONTROL},
+                {"duration", required_argument, 0, 'd'},
+                {"threads", required_argument, 0, 'j'},
                 {"local", no_argument, 0, 'l'},
                 {"help", no_argument, 0, 'h'},
                 {"version", no_argument, 0, 'v'},
@@ -126,7 +673,7 @@ struct beacon_config parse_config(int argc, char **argv)
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        int c = getopt_long(argc, argv, "u:s:f:c:a:m:i:t:w:p:b:g:USolhv",
+        int c = getopt_long(argc, argv, "u:s:f:c:a:m:i:t:w:p:b:g:n:M:O:D:B:d:j:k:P:H:K:LUSTorlhv",
                             long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -174,6 +721,10 @@ struct beacon_config parse_config(int argc, char **argv)
 	    {
   	        config.modulation = MOD_AM;
 	    }
+	    else if (strcasecmp(optarg, "CW") == 0)
+	    {
+  	        config.modulation = MOD_CW;
+	    }
             break;
 
         case 't':
@@ -200,6 +751,151 @@ struct beacon_config parse_config(int argc, char **argv)
             config.device = DEVICE_FILE;
             break;
 
+        case 'r':
+            config.device = DEVICE_URING;
+            break;
+
+        case OPT_URING_DEPTH:
+            config.uring_depth = atoi(optarg);
+            break;
+
+        case 'n':
+            config.device = DEVICE_NET;
+            config.net_address = optarg;
+            break;
+
+        case 'M':
+            config.device = DEVICE_SHM;
+            config.shm_name = optarg;
+            break;
+
+        case OPT_SHM_SLOTS:
+            config.shm_slots = atoi(optarg);
+            break;
+
+        case 'O':
+            config.device = DEVICE_RENDER;
+            config.render_path = optarg;
+            break;
+
+        case 'D':
+            config.decode_path = optarg;
+            break;
+
+        case 'B':
+            config.batch_path = optarg;
+            break;
+
+        case 'd':
+            config.duration = atof(optarg);
+            break;
+
+        case 'j':
+            config.threads = atoi(optarg);
+            break;
+
+        case 'k':
+            config.kernel_buffers = atoi(optarg);
+            break;
+
+        case 'T':
+            config.autotune = true;
+            break;
+
+        case 'P':
+            config.metrics_port = atoi(optarg);
+            break;
+
+        case 'H':
+            config.hop_count = parse_hops(optarg, config.hop_freqs, MAX_HOPS);
+            if (config.hop_count < 0)
+            {
+                fprintf(stderr, "Invalid hop frequencies (up to %d, in MHz): %s\n", MAX_HOPS, optarg);
+                exit(1);
+            }
+            break;
+
+        case OPT_HUGEPAGES:
+            config.hugepages = true;
+            break;
+
+        case 'L':
+            config.listen = true;
+            break;
+
+        case OPT_LISTEN_THRESHOLD:
+            config.listen_threshold = atof(optarg);
+            break;
+
+        case OPT_LISTEN_FILE:
+            config.listen = true;
+            config.listen_file = optarg;
+            break;
+
+        case OPT_PLAY:
+            config.play_path = optarg;
+            break;
+
+        case OPT_LOOP:
+            config.loop = true;
+            break;
+
+        case 'K':
+            config.key_path = optarg;
+            break;
+
+        case OPT_DOPPLER:
+            config.doppler_path = optarg;
+            break;
+
+        case OPT_DOPPLER_PASS:
+            if (sscanf(optarg, "%lf,%lf,%lf", &config.doppler_pass[0], &config.doppler_pass[1], &config.doppler_pass[2]) != 3)
+            {
+                fprintf(stderr, "Invalid pass (seconds to closest approach,closest range in km,speed in km/s): %s\n", optarg);
+                exit(1);
+            }
+            config.doppler_pass_set = true;
+            break;
+
+        case OPT_DOPPLER_CHECK:
+            config.doppler_check = true;
+            break;
+
+        case OPT_IMPAIR:
+            if (impair_parse(&config.impair, optarg) < 0)
+            {
+                fprintf(stderr, "Invalid channel impairments: %s\n", optarg);
+                exit(1);
+            }
+            config.impair_spec = optarg;
+            break;
+
+        case OPT_TEE:
+            if (config.tee_count == TEE_MAX_SINKS || tee_parse(&config.tee[config.tee_count], optarg) < 0)
+            {
+                fprintf(stderr, "Invalid sink (at most %d of kind:target[,queue=N][,drop=newest|oldest]): %s\n", TEE_MAX_SINKS, optarg);
+                exit(1);
+            }
+            config.tee_count++;
+            break;
+
+        case OPT_CONTROL:
+            config.control_path = optarg;
+            break;
+
+        case OPT_MAX_UNDERRUNS:
+            config.max_underruns = atof(optarg);
+            break;
+
+        case OPT_FORMAT:
+            if (iq_format_from_name(optarg) < 0)
+            {
+                fprintf(stderr, "Unknown IQ format: %s\n", optarg);
+                exit(1);
+            }
+            config.format = iq_format_from_name(optarg);
+            break;
+
         case 'l':
             config.uri = LOCAL_URI;
             break;
@@ -238,63 +934,272 @@ struct beacon_config parse_config(int argc, char **argv)
         }
     }
 
-    if (help_flag || optind >= argc)
+    // The Doppler check needs no message
+    if (!help_flag && optind >= argc && config.doppler_check)
     {
-        print_help(stderr, basename(argv[0]));
-        exit(1);
+        return config;
     }
 
-    /* Print any remaining command line arguments (not options). */
-    if (optind < argc)
+    // Live keying needs short blocks and a short queue to keep latency down
+    if (config.key_path != NULL)
     {
-        config.message = argv[optind++];
-    }
-
-    if (config.message == "")
+        if (config.iq_len == DEFAULT_IQ_LEN)
+        {
+            config.iq_len = KEYER_IQ_LEN;
+        }
+        if (config.kernel_buffers <= 0)
+        {
+            config.kernel_buffers = KEYER_KERNEL_BUFFERS;
+        }
+    }
+
+    // Decoding a file, rendering a manifest, playing a recording or keying
+    // live needs no message
+    if (!help_flag && optind >= argc &&
+        (config.decode_path != NULL || config.batch_path != NULL || config.play_path != NULL || config.key_path != NULL))
+    {
+        return config;
+    }
+
+    if (help_flag || optind >= argc)
+    {
+        print_help(stderr, basename(argv[0]));
+        exit(1);
+    }
+
+    /* Print any remaining command line arguments (not options). */
+    if (optind < argc)
+    {
+        config.message = argv[optind++];
+    }
+
+    if (config.message == "")
     {
         fprintf(stderr, "Usage: beacon <MESSAGE>\n");
         exit(1);
     }
+
+    if (config.padding == 0 && !has_morse(config.message))
+    {
+        fprintf(stderr, "Error: The message has nothing to send in Morse code and there is no padding\n");
+        exit(1);
+    }
+
+    if (config.autotune)
+    {
+        if (config.device != DEVICE_ADALM)
+        {
+            fprintf(stderr, "Warning: --autotune only applies to the Adalm-Pluto\n");
+            config.autotune = false;
+        }
+        else if (config.kernel_buffers <= 0)
+        {
+            // Start from the libiio default
+            config.kernel_buffers = DEFAULT_KERNEL_BUFFERS;
+        }
+    }
+
+    if (config.hop_count > 0)
+    {
+        if (config.device != DEVICE_ADALM)
+        {
+            fprintf(stderr, "Warning: --hop only applies to the Adalm-Pluto\n");
+            config.hop_count = 0;
+        }
+        else
+        {
+            config.tx_freq = config.hop_freqs[0];
+        }
+    }
+
+    if (config.listen && config.device != DEVICE_ADALM && config.listen_file == NULL)
+    {
+        fprintf(stderr, "Warning: --listen needs the Adalm-Pluto receiver or --listen-file\n");
+        config.listen = false;
+    }
     return config;
 }
 
+struct beacon_params beacon_params(struct beacon_config config)
+{
+    struct beacon_params params;
+    params.samp_rate = config.samp_rate;
+    params.carrier_freq = config.carrier_freq;
+    params.tone_freq = config.tone_freq;
+    params.wpm = config.wpm;
+    params.message = config.message;
+    params.padding = config.padding;
+    params.modulation = config.modulation;
+    params.modulation_index = config.modulation_index;
+    params.hugepages = config.hugepages;
+    return params;
+}
+
+/** Print the keying, and in CW mode the frequency the keyed tone is rendered at. */
+static void print_keying(struct beacon_config config, struct beacon *ctx)
+{
+    if (config.message[0] != '\0')
+    {
+        fprintf(stderr, "WPM: %d, Samples Per Dit: %ld, Padding: %d, Message: %s\n", config.wpm, beacon_dit_len(ctx), config.padding, config.message);
+    }
+    if (config.modulation == MOD_CW)
+    {
+        fprintf(stderr, "CW: Keyed Tone: %0.3f Hz, Key Edges: %0.1f ms\n", beacon_keyed_freq(ctx), BEACON_CW_EDGE_MS);
+    }
+}
+
 void transmit(struct beacon_config config)
 {
-    long dit_len = calc_dit_len(config.samp_rate, config.wpm);
-    fprintf(stderr, "WPM: %d, Samples Per Dit: %ld, Padding: %d, Message: %s\n", config.wpm, dit_len, config.padding, config.message);
+    struct beacon_params params = beacon_params(config);
+    struct beacon *ctx = beacon_create(&params);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "Error: Invalid signal parameters\n");
+        wait_init();
+        beacon_exit(1);
+    }
+    print_keying(config, ctx);
 
     long samples = 0;
+    struct timespec first_render, first_sent;
+    bool first = true;
     
-    complex *carrier = malloc(sizeof(complex)*config.iq_len);
-    double *tone = malloc(sizeof(double)*config.iq_len);
-    struct iq_state *carrier_state = NULL, *tone_state = NULL;
+    struct arena *output = arena_create(sizeof(complex)*config.iq_len, config.hugepages);
+    if (output == NULL)
+    {
+        perror("Error: Could not allocate the output buffer");
+        wait_init();
+        beacon_exit(1);
+    }
+    complex *iq = arena_alloc(output, sizeof(complex)*config.iq_len);
+    fprintf(stderr, "Memory: Signal: %0.1f KB, Output: %0.1f KB, Huge Pages: %s\n",
+            beacon_footprint(ctx) / K, output->size / K, beacon_hugepages(ctx) && output->hugepages ? "Yes" : "No");
+
+    // Large blocks at high sample rates are split across several threads
+    struct render_pool *pool = NULL;
+    if (config.threads > 1)
+    {
+        pool = render_pool_create(&params, config.threads);
+        if (pool == NULL)
+        {
+            fprintf(stderr, "Error: Could not start the render threads\n");
+            wait_init();
+            beacon_exit(1);
+        }
+        fprintf(stderr, "Render Threads: %d, Pinned: %d\n", render_pool_threads(pool), render_pool_pinned(pool));
+    }
+
+    struct doppler doppler;
+    bool shifting = load_doppler(config, &doppler);
+    struct impairments impair;
+    bool impaired = load_impairments(config, &impair);
 
-    struct cw_state state;
-    state.element = 0;
-    state.samples_left = 0;
-    state.value = false;
+    // Sinks fed alongside the device share the rendered blocks
+    struct tee *tee = NULL;
+    if (config.tee_count > 0)
+    {
+        tee = tee_create(config.tee, config.tee_count, config.format, config.samp_rate, config.iq_len, config.shm_slots,
+                         config.hugepages);
+        if (tee == NULL)
+        {
+            fprintf(stderr, "Error: Could not start the sinks\n");
+            tee_free_params(config.tee, config.tee_count);
+            wait_init();
+            beacon_exit(1);
+        }
+        for (int index = 0; index < config.tee_count; index++)
+        {
+            fprintf(stderr, "Tee: %s %s, Queue: %d Blocks, Drop: %s\n", tee_kind_name(config.tee[index].kind),
+                    config.tee[index].target, config.tee[index].queue,
+                    config.tee[index].drop == TEE_DROP_OLDEST ? "Oldest" : "Newest");
+        }
+    }
 
-    int cw_len = (strlen(config.message) + config.padding + 1) * 10;
+    // Listening takes the last block of the padding before each repetition
+    struct listener listener;
+    long listen_len = 0;
+    if (config.listen)
+    {
+        listen_len = init_listener(config, &listener, beacon_next_cycle(ctx));
+    }
 
-    bool cw_pattern[cw_len];
-    int cw_pattern_length = generate_cw_pattern(cw_pattern, cw_len, config.message, config.padding);
+    // Gating state: the block just rendered ends a repetition, the block
+    // about to be sent is the first after a hop, and how long the hop took
+    bool hopping = config.hop_count > 1;
+    bool gating = hopping || config.listen;
+    bool cycle_pending, hopped = false;
+    long long cycle_at;
+    int hop = 0;
+    long gated = 0, hop_gated = 0;
+    double retune = 0;
+    struct timespec drained;
+
+    // Render the first block while the device is still being set up
+    struct timespec render_start, render_end;
+    clock_gettime(CLOCK_MONOTONIC, &render_start);
+    iq = next_block(tee, iq, config.iq_len);
+    cycle_pending = render_block(ctx, pool, iq, config.iq_len, gating, listen_len, &gated, &cycle_at);
+    if (shifting)
+    {
+        doppler_apply(&doppler, iq, config.iq_len);
+    }
+    if (impaired)
+    {
+        impair_apply(&impair, iq, config.iq_len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &first_render);
+    render_end = first_render;
+    wait_init();
+#ifdef ADALM_SUPPORT
+    if (config.device == DEVICE_ADALM)
+    {
+        watch_device(true);
+    }
+#endif
+    if (config.listen)
+    {
+        listen_before_transmit(config, &listener, config.tx_freq);
+    }
+
+    struct tune_state tune;
+    struct timespec block_start, block_end;
+    if (config.autotune)
+    {
+        tune_init(&tune, config.samp_rate, config.iq_len, config.kernel_buffers, config.max_underruns / 60.0);
+    }
+
+    // Tracks the kernel queue so underruns can be reported to metrics
+    struct queue_model queue;
+    int kernel_buffers = config.kernel_buffers > 0 ? config.kernel_buffers : DEFAULT_KERNEL_BUFFERS;
+    queue_model_init(&queue, kernel_buffers);
 
     while (!stop)
     {
-        carrier_state = generate_carrier(config.carrier_freq, config.samp_rate, carrier, config.iq_len, carrier_state);
-        tone_state = generate_tone(config.tone_freq, config.samp_rate, tone, config.iq_len, tone_state);
-        /*
-        state = modulate_cw(tone, config.iq_len, dit_len, cw_pattern, cw_pattern_length, state);
-        switch(config.modulation)
+        double render_time = elapsed_seconds(&render_start, &render_end);
+        clock_gettime(CLOCK_MONOTONIC, &block_start);
+        double room_wait = wait_for_device();
+        if (stop)
         {
-        case MOD_FM:
-            modulate_fm(carrier, tone, config.iq_len, config.modulation_index);
-            break;
-        default:
-            modulate_am(carrier, tone, config.iq_len, config.modulation_index);
             break;
         }
-        samples = write_iq_to_device(config.device, carrier, config.iq_len);
+        samples = write_iq_to_device(config, iq, config.iq_len);
+        clock_gettime(CLOCK_MONOTONIC, &block_end);
+        samples_sent += samples;
+        if (device_wait >= 0)
+        {
+            device_wait += room_wait;
+        }
+        if (tee != NULL)
+        {
+            tee_publish(tee, config.iq_len);
+        }
+        if (first)
+        {
+            first_sent = block_end;
+            fprintf(stderr, "Startup: First Block Rendered: %0.1f ms, Device Ready: %0.1f ms, First Block Sent: %0.1f ms\n",
+                    ms_since_start(&first_render), ms_since_start(&init_done), ms_since_start(&first_sent));
+            first = false;
+        }
         if (samples == 0)
         {
             fprintf(stderr, "Couldn't Write Samples.\n");
@@ -305,42 +1210,524 @@ void transmit(struct beacon_config config)
             fprintf(stderr, "Wrote %ld Samples.\n", samples);
         }
 #endif
-        */
+        if (device_wait < 0)
+        {
+            metrics_push_error();
+        }
+        else
+        {
+            metrics_block(samples, render_time);
+        }
+        if (hopped && device_wait >= 0)
+        {
+            // Dead air runs from the gated tail through draining, retuning and
+            // rendering until this block went into the empty queue
+            double dead_air = (double)hop_gated / config.samp_rate + elapsed_seconds(&drained, &block_end);
+            fprintf(stderr, "Hop: %0.3f MHz, Retune: %0.3f ms, Dead Air: %0.3f ms\n",
+                    config.hop_freqs[hop] / M, retune * 1000, dead_air * 1000);
+            // The queue was drained on purpose, so restart the model from this block
+            queue.level = 1;
+        }
+        else if (config.device == DEVICE_ADALM && device_wait >= 0)
+        {
+            // The previous render counts towards the time between pushes
+            double cycle = elapsed_seconds(&block_start, &block_end) + render_time;
+            double period = (double)config.iq_len / config.samp_rate;
+            if (queue_model_update(&queue, kernel_buffers, period, cycle - device_wait, device_wait))
+            {
+                metrics_underrun();
+            }
+            if (config.autotune && tune_update(&tune, cycle - device_wait, device_wait))
+            {
+#ifdef ADALM_SUPPORT
+                adalm_resize(tune.iq_len, tune.kernel_buffers);
+                watch_device(false);
+#endif
+                config.iq_len = tune.iq_len;
+                kernel_buffers = tune.kernel_buffers;
+                queue_model_init(&queue, kernel_buffers);
+                arena_destroy(output);
+                output = arena_create(sizeof(complex)*config.iq_len, config.hugepages);
+                if (output == NULL)
+                {
+                    perror("Error: Could not allocate the output buffer");
+                    beacon_exit(1);
+                }
+                iq = arena_alloc(output, sizeof(complex)*config.iq_len);
+            }
+        }
+        hopped = false;
+        if (cycle_pending)
+        {
+            // Let the queued blocks play out so TX is silent
+            if (config.device == DEVICE_ADALM)
+            {
+                sleep_events((double)kernel_buffers * config.iq_len / config.samp_rate);
+            }
+            // A stop during the drain shouldn't retune, listen or send more
+            if (stop)
+            {
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &drained);
+#ifdef ADALM_SUPPORT
+            if (hopping)
+            {
+                int next = (hop + 1) % config.hop_count;
+                retune = adalm_recall_profile(next);
+                if (retune >= 0)
+                {
+                    hop = next;
+                    hopped = true;
+                    hop_gated = gated;
+                }
+            }
+#endif
+            if (config.listen)
+            {
+                listen_before_transmit(config, &listener, hopping ? config.hop_freqs[hop] : config.tx_freq);
+            }
+            beacon_seek(ctx, cycle_at);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &render_start);
+        iq = next_block(tee, iq, config.iq_len);
+        cycle_pending = render_block(ctx, pool, iq, config.iq_len, gating, listen_len, &gated, &cycle_at);
+        if (shifting)
+        {
+            doppler_apply(&doppler, iq, config.iq_len);
+        }
+        if (impaired)
+        {
+            impair_apply(&impair, iq, config.iq_len);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &render_end);
+    }
+    if (config.listen)
+    {
+        free_listener(&listener);
+    }
+    if (pool != NULL)
+    {
+        render_pool_destroy(pool);
+    }
+    if (shifting)
+    {
+        doppler_free(&doppler);
+    }
+    if (impaired)
+    {
+        impair_free(&impair);
+    }
+    if (tee != NULL)
+    {
+        tee_destroy(tee);
+        tee_free_params(config.tee, config.tee_count);
+    }
+    beacon_destroy(ctx);
+    arena_destroy(output);
+}
+
+/** Returns the number of threads to render files with. */
+static int file_threads(struct beacon_config config)
+{
+    return config.threads > 0 ? config.threads : sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+void render(struct beacon_config config)
+{
+    struct beacon_params params = beacon_params(config);
+    struct beacon *ctx = beacon_create(&params);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "Error: Invalid signal parameters\n");
+        beacon_exit(1);
+    }
+    print_keying(config, ctx);
+    beacon_destroy(ctx);
+
+    if (render_file(config.render_path, &params, config.format, config.duration, config.iq_len, file_threads(config)) < 0)
+    {
+        beacon_exit(1);
+    }
+}
+
+void decode(struct beacon_config config)
+{
+    struct timespec started, finished;
+
+    FILE *in = fopen(config.decode_path, "rb");
+    if (in == NULL)
+    {
+        perror("Error: Could not open input file");
+        exit(1);
+    }
+    struct bcn_reader *reader = bcn_open(in);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "Error: %s is not a .bcn file\n", config.decode_path);
+        fclose(in);
+        exit(1);
+    }
+    struct bcn_info info = bcn_reader_info(reader);
+    size_t sample_size = iq_sample_size(info.format);
+    fprintf(stderr, "Decoding %s, Format: %s, Sampling Rate: %0.3f Ms/s\n", config.decode_path, iq_format_name(info.format), info.samp_rate / M);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    char *buf = malloc(config.iq_len * sample_size);
+    if (buf == NULL)
+    {
+        perror("Error: Could not allocate the decode buffer");
+        bcn_free(reader);
+        fclose(in);
+        exit(1);
+    }
+    long long samples = 0;
+    long len = 0;
+    while (!stop && (len = bcn_read(reader, buf, config.iq_len)) > 0)
+    {
+        if (fwrite(buf, sample_size, len, stdout) != (size_t)len)
+        {
+            perror("Error: Could not write IQ data");
+            exit(1);
+        }
+        samples += len;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    if (len < 0)
+    {
+        fprintf(stderr, "Error: %s is damaged\n", config.decode_path);
+        exit(1);
+    }
+
+    double elapsed = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    fprintf(stderr, "Decoded %0.3f s of signal in %0.3f s (%0.3f Ms/s)\n",
+            (double)samples / info.samp_rate, elapsed, samples / elapsed / 1e6);
+    free(buf);
+    bcn_free(reader);
+    fclose(in);
+}
+
+void batch(struct beacon_config config)
+{
+    struct beacon_params params = beacon_params(config);
+    if (render_batch(config.batch_path, &params, config.format, config.duration, config.iq_len, file_threads(config)) < 0)
+    {
+        exit(1);
+    }
+}
+
+void play(struct beacon_config config)
+{
+    struct playback playback;
+    if (play_open(&playback, config.play_path, config.format) < 0)
+    {
+        wait_init();
+        beacon_exit(1);
+    }
+    fprintf(stderr, "Playing %s, Format: %s, Length: %0.3f s%s\n", config.play_path, iq_format_name(config.format),
+            (double)playback.samples / config.samp_rate, config.loop ? ", Looping" : "");
+
+    complex *iq = malloc(sizeof(complex) * config.iq_len);
+    if (iq == NULL)
+    {
+        perror("Error: Could not allocate the output buffer");
+        wait_init();
+        beacon_exit(1);
+    }
+    wait_init();
+
+#ifdef ADALM_SUPPORT
+    if (config.device == DEVICE_ADALM && config.loop && playback.samples <= ADALM_MAX_CYCLIC_SAMPLES)
+    {
+        // The whole recording fits in one buffer that the device repeats by itself
+        if (adalm_transmit_cyclic(config.format, playback.data, playback.samples) < 0)
+        {
+            beacon_exit(1);
+        }
+        fprintf(stderr, "Cyclic Buffer: %ld Samples\n", playback.samples);
+        while (!stop)
+        {
+            handle_events(-1);
+        }
+        free(iq);
+        play_close(&playback);
+        return;
+    }
+    if (config.device == DEVICE_ADALM)
+    {
+        watch_device(true);
+    }
+#endif
+
+    // Tracks the kernel queue so underruns can be reported
+    struct queue_model queue;
+    int kernel_buffers = config.kernel_buffers > 0 ? config.kernel_buffers : DEFAULT_KERNEL_BUFFERS;
+    queue_model_init(&queue, kernel_buffers);
+    double period = (double)config.iq_len / config.samp_rate;
+
+    struct timespec started, block_start, block_end, last_end;
+    long long sent = 0;
+    long offset = 0, underruns = 0;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    last_end = started;
+    while (!stop)
+    {
+        long len = playback.samples - offset;
+        if (len > config.iq_len)
+        {
+            len = config.iq_len;
+        }
+        const void *buf = play_block(&playback, offset);
+
+        clock_gettime(CLOCK_MONOTONIC, &block_start);
+        double room_wait = wait_for_device();
+        if (stop)
+        {
+            break;
+        }
+        device_wait = 0;
+        if (config.device == DEVICE_ADALM)
+        {
+#ifdef ADALM_SUPPORT
+            // Straight from the mapping into the TX buffer
+            device_wait = adalm_transmit_packed(config.format, buf, len);
+#endif
+        }
+        else
+        {
+            unpack_iq(config.format, buf, iq, len);
+            write_iq_to_device(config, iq, len);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &block_end);
+        samples_sent += len;
+        if (device_wait >= 0)
+        {
+            device_wait += room_wait;
+        }
+
+        if (device_wait < 0)
+        {
+            metrics_push_error();
+        }
+        else
+        {
+            // Reading the mapping, and any page faults, count as rendering
+            double cycle = elapsed_seconds(&last_end, &block_end);
+            metrics_block(len, cycle - device_wait);
+            if (config.device == DEVICE_ADALM && queue_model_update(&queue, kernel_buffers, period, cycle - device_wait, device_wait))
+            {
+                metrics_underrun();
+                underruns++;
+            }
+        }
+        last_end = block_end;
+
+        sent += len;
+        offset += len;
+        if (offset >= playback.samples)
+        {
+            if (!config.loop)
+            {
+                break;
+            }
+            offset = 0;
+        }
+    }
+
+    double elapsed = elapsed_seconds(&started, &block_end);
+    fprintf(stderr, "Played %0.3f s of signal in %0.3f s (%0.3f Ms/s, %0.1f MB/s), Underruns: %ld\n",
+            (double)sent / config.samp_rate, elapsed, sent / elapsed / M,
+            sent * playback.sample_size / elapsed / M, underruns);
+    free(iq);
+    play_close(&playback);
+}
+
+void live(struct beacon_config config)
+{
+    struct beacon_params params = beacon_params(config);
+
+    // Only the keyed tone is used, but a context needs a cycle to be valid
+    params.message = "";
+    params.padding = 1;
+    struct beacon *ctx = beacon_create(&params);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "Error: Invalid signal parameters\n");
+        wait_init();
+        beacon_exit(1);
+    }
+    static struct keyer keyer;
+    if (keyer_open(&keyer, config.key_path, config.samp_rate, beacon_dit_len(ctx)) < 0)
+    {
+        wait_init();
+        beacon_exit(1);
+    }
+    double period = (double)config.iq_len / config.samp_rate;
+    fprintf(stderr, "Keyer: %s (%s), WPM: %d, Block: %ld Samples (%0.2f ms), Kernel Buffers: %d\n",
+            config.key_path, keyer_source_name(&keyer), config.wpm, config.iq_len, period * 1000, config.kernel_buffers);
+    print_keying(config, ctx);
+
+    complex *iq = malloc(sizeof(complex) * config.iq_len);
+    if (iq == NULL)
+    {
+        perror("Error: Could not allocate the output buffer");
+        wait_init();
+        beacon_exit(1);
+    }
+    wait_init();
+
+    // Only the Adalm-Pluto paces the loop by itself
+    struct timespec next, pushed;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stop)
+    {
+        keyer_poll(&keyer, config.iq_len);
+        for (long done = 0; done < config.iq_len;)
+        {
+            bool down;
+            long len = keyer_span(&keyer, config.iq_len - done, &down);
+            beacon_render_keyed(ctx, iq + done, len, down);
+            done += len;
+        }
+
+        if (config.device != DEVICE_ADALM)
+        {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            next.tv_nsec += (long)(period * 1e9);
+            next.tv_sec += next.tv_nsec / 1000000000;
+            next.tv_nsec %= 1000000000;
+        }
+        write_iq_to_device(config, iq, config.iq_len);
+        clock_gettime(CLOCK_MONOTONIC, &pushed);
+        if (device_wait < 0)
+        {
+            metrics_push_error();
+        }
+        keyer_pushed(&keyer, &pushed);
+    }
+
+    keyer_report(&keyer, stderr);
+    keyer_close(&keyer);
+    free(iq);
+    beacon_destroy(ctx);
+}
+
+void start_init(struct beacon_config config)
+{
+    init_config = config;
+    if (pthread_create(&init_thread, NULL, run_init, NULL) == 0)
+    {
+        init_running = true;
+    }
+    else
+    {
+        run_init(NULL);
     }
-    destroy_iq_state(carrier_state);
-    destroy_iq_state(tone_state);
-    free(carrier);
-    free(tone);
 }
 
-void init(struct beacon_config config)
+void wait_init()
 {
+    if (init_running)
+    {
+        pthread_join(init_thread, NULL);
+        init_running = false;
+    }
+    if (init_failed)
+    {
+        beacon_exit(1);
+    }
+}
+
+int init(struct beacon_config config)
+{
+    switch (config.device)
+    {
+    case DEVICE_ADALM:
 #ifdef ADALM_SUPPORT
-    adalm_init(config.uri, config.samp_rate, config.gain, config.tx_freq, config.iq_len);
+        if (adalm_init(config.uri, config.samp_rate, config.gain, config.tx_freq, config.iq_len, config.kernel_buffers) < 0)
+        {
+            return -1;
+        }
+        if (config.hop_count > 1)
+        {
+            double store = adalm_store_profiles(config.hop_freqs, config.hop_count);
+            if (store < 0)
+            {
+                return -1;
+            }
+            fprintf(stderr, "Fastlock: Stored %d Profiles in %0.1f ms\n", config.hop_count, store * 1000);
+        }
+#endif
+        break;
+    case DEVICE_URING:
+#ifdef URING_SUPPORT
+        return uring_init(fileno(stdout), config.iq_len * iq_sample_size(config.format), config.uring_depth);
+#else
+        fprintf(stderr, "Error: io_uring support was not enabled at build time\n");
+        return -1;
 #endif
+    case DEVICE_NET:
+        return net_init(config.net_address, config.format, config.samp_rate, config.iq_len);
+    case DEVICE_SHM:
+        return shm_init(config.shm_name, config.format, config.samp_rate, config.iq_len, config.shm_slots);
+    default:
+        break;
+    }
+    return 0;
 }
 
-void shutdown(int code)
+void beacon_exit(int code)
 {
 #ifdef ADALM_SUPPORT
     adalm_shutdown();
 #endif
+#ifdef URING_SUPPORT
+    uring_shutdown();
+#endif
+    net_shutdown();
+    shm_shutdown();
+    metrics_shutdown();
+    if (looping)
+    {
+        loop_close(&events);
+    }
     exit(code);
 }
 
-int write_iq_to_device(enum device device, complex *iq, long iq_len)
+int write_iq_to_device(struct beacon_config config, complex *iq, long iq_len)
 {
-    switch (device)
+#ifdef URING_SUPPORT
+    void *buf;
+#endif
+    switch (config.device)
     {
     case DEVICE_ADALM:
 #ifdef ADALM_SUPPORT
-        adalm_transmit(iq, iq_len);
+        device_wait = adalm_transmit(iq, iq_len);
         break;
 #else
         return 0;
 #endif
+    case DEVICE_URING:
+#ifdef URING_SUPPORT
+        buf = uring_get_buffer();
+        pack_iq(config.format, buf, iq, iq_len);
+        uring_submit(buf, iq_len * iq_sample_size(config.format));
+        break;
+#else
+        return 0;
+#endif
+    case DEVICE_NET:
+        if (net_send(iq, iq_len) < 0)
+        {
+            beacon_exit(1);
+        }
+        break;
+    case DEVICE_SHM:
+        shm_publish(iq, iq_len);
+        break;
     default:
-        write_iq(stdout, iq, iq_len);
+        write_iq(stdout, config.format, iq, iq_len);
         break;
     }
     return iq_len;
@@ -352,6 +1739,14 @@ const char *device_name(struct beacon_config config)
     {
     case DEVICE_ADALM:
         return "Adalm-Pluto";
+    case DEVICE_URING:
+        return "STDOUT (io_uring)";
+    case DEVICE_NET:
+        return config.net_address;
+    case DEVICE_SHM:
+        return config.shm_name;
+    case DEVICE_RENDER:
+        return config.render_path;
     default:
         return "STDOUT";
     }
@@ -364,6 +1759,8 @@ const char *modulation_name(struct beacon_config config)
     {
     case MOD_FM:
         return "FM";
+    case MOD_CW:
+        return "CW";
     default:
         return "AM";
     }
@@ -372,15 +1769,117 @@ const char *modulation_name(struct beacon_config config)
 
 void main(int argc, char **argv)
 {
+    clock_gettime(CLOCK_MONOTONIC, &program_start);
     signal(SIGINT, handle_sig);
     struct beacon_config config = parse_config(argc, argv);
+    if ((config.doppler_path != NULL || config.doppler_pass_set) && !config.doppler_check &&
+        (config.device == DEVICE_RENDER || config.decode_path != NULL || config.batch_path != NULL ||
+         config.play_path != NULL || config.key_path != NULL))
+    {
+        fprintf(stderr, "Error: --doppler and --doppler-pass apply to the streamed message only, use -o to capture it\n");
+        exit(1);
+    }
+    if (config.decode_path != NULL)
+    {
+        decode(config);
+        exit(0);
+    }
+    if (config.batch_path != NULL)
+    {
+        batch(config);
+        exit(0);
+    }
+    if (config.doppler_check)
+    {
+        struct doppler doppler;
+        if (!load_doppler(config, &doppler))
+        {
+            fprintf(stderr, "Error: --doppler-check needs --doppler or --doppler-pass\n");
+            exit(1);
+        }
+        doppler_check(&doppler, config.duration, config.iq_len, stderr);
+        doppler_free(&doppler);
+        exit(0);
+    }
+    if ((config.play_path != NULL || config.key_path != NULL) && config.device == DEVICE_RENDER)
+    {
+        fprintf(stderr, "Error: --play and --key cannot be combined with --render\n");
+        exit(1);
+    }
+    if (config.tee_count > 0 && (config.play_path != NULL || config.key_path != NULL))
+    {
+        fprintf(stderr, "Error: --tee cannot be combined with --play or --key\n");
+        exit(1);
+    }
+    if (config.tee_count > 0 && !check_tee(config))
+    {
+        exit(1);
+    }
+    if (config.impair_spec != NULL && config.device == DEVICE_RENDER)
+    {
+        fprintf(stderr, "Error: --impair applies to the stream, use -o to capture it\n");
+        exit(1);
+    }
+    if (config.impair_spec != NULL && config.device == DEVICE_ADALM)
+    {
+        fprintf(stderr, "Error: --impair is for testing receivers off the air, use -o, -r, -n or -M\n");
+        exit(1);
+    }
     fprintf(stderr,
             "Device: %s, URI: %s, Sampling Rate: %0.3f Ms/s, Gain: %0.3f, Transmission Frequency: %0.3f MHz\n",
             device_name(config), config.uri, config.samp_rate / M, config.gain, config.tx_freq / M);
-    fprintf(stderr,
-            "Carrier Offset: %0.3f KHz, Tone Frequency: %ld Hz, Modulation: %s, Modulation Index: %.3f\n",
-            config.carrier_freq / K, config.tone_freq, modulation_name(config), config.modulation_index);
-    init(config);
-    transmit(config);
-    shutdown(0);
+    if (config.play_path == NULL && config.key_path == NULL)
+    {
+        fprintf(stderr,
+                "Carrier Offset: %0.3f KHz, Tone Frequency: %ld Hz, Modulation: %s, Modulation Index: %.3f\n",
+                config.carrier_freq / K, config.tone_freq, modulation_name(config), config.modulation_index);
+    }
+    if (config.device == DEVICE_RENDER)
+    {
+        render(config);
+        beacon_exit(0);
+    }
+    if (config.key_path != NULL && config.control_path != NULL)
+    {
+        fprintf(stderr, "Error: --control cannot be combined with --key\n");
+        exit(1);
+    }
+    if (config.key_path == NULL)
+    {
+        // Before any thread starts, so that every thread leaves the signals
+        // to the event loop
+        if (loop_init(&events, config.control_path) < 0)
+        {
+            exit(1);
+        }
+        looping = true;
+    }
+    if (config.metrics_port > 0)
+    {
+        struct metrics_info info;
+        info.device = device_name(config);
+        info.message = config.play_path != NULL ? config.play_path : config.message;
+        info.wpm = config.wpm;
+        info.tx_freq = config.tx_freq;
+        info.gain = config.gain;
+        info.samp_rate = config.samp_rate;
+        if (metrics_start(config.metrics_port, info) < 0)
+        {
+            exit(1);
+        }
+    }
+    start_init(config);
+    if (config.play_path != NULL)
+    {
+        play(config);
+    }
+    else if (config.key_path != NULL)
+    {
+        live(config);
+    }
+    else
+    {
+        transmit(config);
+    }
+    beacon_exit(0);
 }
@@ -24,30 +24,74 @@
 
 #include "global.h"
 
+#include "beacon.h"
 #include "iq.h"
-#include "cw.h"
 
 #ifdef ADALM_SUPPORT
 #include "adalm.h"
 #endif
 
+#ifdef URING_SUPPORT
+#include "uring.h"
+#endif
+
+#include "net.h"
+#include "shm.h"
+#include "render.h"
+#include "batch.h"
+#include "tune.h"
+#include "metrics.h"
+#include "detect.h"
+#include "play.h"
+#include "pool.h"
+#include "keyer.h"
+#include "doppler.h"
+#include "impair.h"
+#include "tee.h"
+#include "loop.h"
+#include "cw.h"
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <getopt.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <libgen.h>
+#include <time.h>
+#include <pthread.h>
 
 enum device
 {
     DEVICE_FILE,
-    DEVICE_ADALM
+    DEVICE_ADALM,
+    DEVICE_URING,
+    DEVICE_NET,
+    DEVICE_SHM,
+    DEVICE_RENDER
 };
 
-enum modulation
+/* Most frequencies --hop can rotate through, one per AD9361 fastlock profile */
+#define MAX_HOPS 8
+
+/** Options that only have a long form. */
+enum long_option
 {
-    MOD_AM,
-    MOD_FM
+    OPT_URING_DEPTH = 256,
+    OPT_FORMAT,
+    OPT_SHM_SLOTS,
+    OPT_MAX_UNDERRUNS,
+    OPT_HUGEPAGES,
+    OPT_LISTEN_THRESHOLD,
+    OPT_LISTEN_FILE,
+    OPT_PLAY,
+    OPT_LOOP,
+    OPT_DOPPLER,
+    OPT_DOPPLER_PASS,
+    OPT_DOPPLER_CHECK,
+    OPT_IMPAIR,
+    OPT_TEE,
+    OPT_CONTROL
 };
 
 struct beacon_config
@@ -65,6 +109,50 @@ struct beacon_config
     double gain;
     enum modulation modulation;
     double modulation_index;
+    int uring_depth;
+    const char *net_address;
+    enum iq_format format;
+    const char *shm_name;
+    int shm_slots;
+    const char *render_path;
+    double duration;
+    int threads;
+    int kernel_buffers;
+    bool autotune;
+    double max_underruns;
+    int metrics_port;
+    long hop_freqs[MAX_HOPS];
+    int hop_count;
+    bool hugepages;
+    const char *decode_path;
+    const char *batch_path;
+    bool listen;
+    double listen_threshold;
+    const char *listen_file;
+    const char *play_path;
+    bool loop;
+    const char *key_path;
+    const char *doppler_path;
+    double doppler_pass[3];
+    bool doppler_pass_set;
+    bool doppler_check;
+    const char *impair_spec;
+    struct impair_params impair;
+    struct tee_sink_params tee[TEE_MAX_SINKS];
+    int tee_count;
+    const char *control_path;
+};
+
+/** What listening before transmitting needs between repetitions. */
+struct listener
+{
+    struct detector detector;
+    FILE *file;
+    complex *rx;
+    char *raw;
+    long len;
+    double full_scale;
+    bool reported;
 };
 
 const char *DEFAULT_URI = "ip:192.168.2.1";
@@ -77,14 +165,30 @@ const int DEFAULT_PADDING = 10;
 const double DEFAULT_GAIN = 100;
 const double DEFAULT_SAMP_RATE = 1000000;
 const double DEFAULT_MODULATION_INDEX = 500;
+const int DEFAULT_URING_DEPTH = 8;
+const int DEFAULT_SHM_SLOTS = 16;
+const double DEFAULT_DURATION = 60;
+const int DEFAULT_KERNEL_BUFFERS = 4;
+const double DEFAULT_MAX_UNDERRUNS = 1;
+const double DEFAULT_LISTEN_THRESHOLD = -50;
+const long LISTEN_MARGIN = 200;
 
 void print_version(FILE *out);
 void print_help(FILE *out, const char *executable_name);
 struct beacon_config parse_config(int argc, char **argv);
-void init(struct beacon_config config);
+/** Set up the output device.  Returns 0 on success or -1 on error, leaving the exit to the caller. */
+int init(struct beacon_config config);
+void start_init(struct beacon_config config);
+void wait_init();
 void main(int argc, char **argv);
+struct beacon_params beacon_params(struct beacon_config config);
 void transmit(struct beacon_config config);
-int write_iq_to_device(enum device device, complex *iq, long iq_len);
+void render(struct beacon_config config);
+void decode(struct beacon_config config);
+void batch(struct beacon_config config);
+void play(struct beacon_config config);
+void live(struct beacon_config config);
+int write_iq_to_device(struct beacon_config config, complex *iq, long iq_len);
 const char *device_name(struct beacon_config config);
 
 #endif /* !FILE_MAIN_H_SEEN */
@@ -0,0 +1,303 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Seconds a scraper gets to send its request before it is dropped */
+#define METRICS_TIMEOUT 2
+
+/* The TX path only ever does relaxed atomic updates here, so a slow
+   scrape can never hold it up. */
+static atomic_ullong samples_pushed;
+static atomic_ullong blocks_pushed;
+static atomic_ullong push_errors;
+static atomic_ullong underruns;
+static _Atomic double render_seconds_total;
+static _Atomic double render_seconds_last;
+
+static struct metrics_info metrics_info;
+static struct timespec started;
+static int listen_fd = -1;
+static pthread_t server_thread;
+static bool server_running;
+
+void metrics_block(long samples, double render_seconds)
+{
+    atomic_fetch_add_explicit(&samples_pushed, samples, memory_order_relaxed);
+    atomic_fetch_add_explicit(&blocks_pushed, 1, memory_order_relaxed);
+    atomic_store_explicit(&render_seconds_last, render_seconds, memory_order_relaxed);
+    // Only this thread writes the total, so a load and store is enough
+    double total = atomic_load_explicit(&render_seconds_total, memory_order_relaxed);
+    atomic_store_explicit(&render_seconds_total, total + render_seconds, memory_order_relaxed);
+}
+
+void metrics_push_error()
+{
+    atomic_fetch_add_explicit(&push_errors, 1, memory_order_relaxed);
+}
+
+void metrics_underrun()
+{
+    atomic_fetch_add_explicit(&underruns, 1, memory_order_relaxed);
+}
+
+/** Write a label value with the escaping OpenMetrics requires. */
+static void write_label(FILE *out, const char *value)
+{
+    for (; *value; value++)
+    {
+        switch (*value)
+        {
+        case '\\':
+            fputs("\\\\", out);
+            break;
+        case '"':
+            fputs("\\\"", out);
+            break;
+        case '\n':
+            fputs("\\n", out);
+            break;
+        default:
+            fputc(*value, out);
+            break;
+        }
+    }
+}
+
+static void write_metrics(FILE *out)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double uptime = (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+
+    // An info family's one sample is named <family>_info
+    fprintf(out, "# TYPE beacon info\n");
+    fprintf(out, "# HELP beacon Beacon configuration.\n");
+    fprintf(out, "beacon_info{version=\"%s\",device=\"", PACKAGE_VERSION);
+    write_label(out, metrics_info.device);
+    fprintf(out, "\",message=\"");
+    write_label(out, metrics_info.message);
+    fprintf(out, "\"} 1\n");
+
+    fprintf(out, "# TYPE beacon_wpm gauge\n");
+    fprintf(out, "# HELP beacon_wpm CW speed in words per minute.\n");
+    fprintf(out, "beacon_wpm %d\n", metrics_info.wpm);
+    fprintf(out, "# TYPE beacon_tx_frequency_hertz gauge\n");
+    fprintf(out, "# UNIT beacon_tx_frequency_hertz hertz\n");
+    fprintf(out, "# HELP beacon_tx_frequency_hertz Transmission frequency.\n");
+    fprintf(out, "beacon_tx_frequency_hertz %ld\n", metrics_info.tx_freq);
+    fprintf(out, "# TYPE beacon_gain gauge\n");
+    fprintf(out, "# HELP beacon_gain Hardware gain setting.\n");
+    fprintf(out, "beacon_gain %0.3f\n", metrics_info.gain);
+    fprintf(out, "# TYPE beacon_sample_rate_hertz gauge\n");
+    fprintf(out, "# UNIT beacon_sample_rate_hertz hertz\n");
+    fprintf(out, "# HELP beacon_sample_rate_hertz Sampling rate; compare with the rate of beacon_samples_pushed to see whether the beacon keeps up.\n");
+    fprintf(out, "beacon_sample_rate_hertz %ld\n", metrics_info.samp_rate);
+    fprintf(out, "# TYPE beacon_uptime_seconds gauge\n");
+    fprintf(out, "# UNIT beacon_uptime_seconds seconds\n");
+    fprintf(out, "# HELP beacon_uptime_seconds Time since the beacon started.\n");
+    fprintf(out, "beacon_uptime_seconds %0.3f\n", uptime);
+
+    fprintf(out, "# TYPE beacon_samples_pushed counter\n");
+    fprintf(out, "# HELP beacon_samples_pushed Samples sent to the device.\n");
+    fprintf(out, "beacon_samples_pushed_total %llu\n", atomic_load_explicit(&samples_pushed, memory_order_relaxed));
+    fprintf(out, "# TYPE beacon_blocks_pushed counter\n");
+    fprintf(out, "# HELP beacon_blocks_pushed Blocks sent to the device.\n");
+    fprintf(out, "beacon_blocks_pushed_total %llu\n", atomic_load_explicit(&blocks_pushed, memory_order_relaxed));
+    fprintf(out, "# TYPE beacon_push_errors counter\n");
+    fprintf(out, "# HELP beacon_push_errors Blocks the device failed to accept.\n");
+    fprintf(out, "beacon_push_errors_total %llu\n", atomic_load_explicit(&push_errors, memory_order_relaxed));
+    fprintf(out, "# TYPE beacon_underruns counter\n");
+    fprintf(out, "# HELP beacon_underruns Estimated times the device ran out of samples.\n");
+    fprintf(out, "beacon_underruns_total %llu\n", atomic_load_explicit(&underruns, memory_order_relaxed));
+    fprintf(out, "# TYPE beacon_render_seconds counter\n");
+    fprintf(out, "# UNIT beacon_render_seconds seconds\n");
+    fprintf(out, "# HELP beacon_render_seconds Time spent rendering blocks; divide by beacon_blocks_pushed for the time per block.\n");
+    fprintf(out, "beacon_render_seconds_total %0.6f\n", atomic_load_explicit(&render_seconds_total, memory_order_relaxed));
+    fprintf(out, "# TYPE beacon_last_render_seconds gauge\n");
+    fprintf(out, "# UNIT beacon_last_render_seconds seconds\n");
+    fprintf(out, "# HELP beacon_last_render_seconds Time spent rendering the most recent block.\n");
+    fprintf(out, "beacon_last_render_seconds %0.6f\n", atomic_load_explicit(&render_seconds_last, memory_order_relaxed));
+    fprintf(out, "# EOF\n");
+}
+
+static void send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        data += sent;
+        len -= sent;
+    }
+}
+
+static void serve_client(int fd)
+{
+    char request[1024];
+    size_t len = 0;
+
+    // Read until the end of the request headers; the body is never needed
+    while (len < sizeof(request) - 1)
+    {
+        ssize_t got = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (got <= 0)
+        {
+            return;
+        }
+        len += got;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+        {
+            break;
+        }
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    const char *status = "200 OK";
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL)
+    {
+        return;
+    }
+
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0)
+    {
+        write_metrics(out);
+    }
+    else
+    {
+        status = "404 Not Found";
+        fprintf(out, "Not Found\n");
+    }
+    fclose(out);
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 %s\r\n"
+                              "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n",
+                              status, body_len);
+    send_all(fd, header, header_len);
+    send_all(fd, body, body_len);
+    free(body);
+}
+
+static void *serve(void *arg)
+{
+    (void)arg;
+    while (true)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+        struct timeval timeout = {METRICS_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(int port, struct metrics_info info)
+{
+    metrics_info = info;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        perror("Error: Could not create metrics socket");
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0)
+    {
+        perror("Error: Could not listen for metrics");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    if (pthread_create(&server_thread, NULL, serve, NULL) != 0)
+    {
+        fprintf(stderr, "Error: Could not start metrics thread\n");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    server_running = true;
+
+    fprintf(stderr, "Metrics: http://127.0.0.1:%d/metrics\n", port);
+    return 0;
+}
+
+void metrics_shutdown()
+{
+    if (!server_running)
+    {
+        return;
+    }
+    // Wakes the server thread out of accept()
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(server_thread, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+    server_running = false;
+}
@@ -0,0 +1,56 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File metrics.h */
+#ifndef FILE_METRICS_H_SEEN
+#define FILE_METRICS_H_SEEN
+
+#include "../config.h"
+
+#include <stdbool.h>
+
+/** Fixed facts about the running beacon, reported alongside the counters. */
+struct metrics_info
+{
+    const char *device;
+    const char *message;
+    int wpm;
+    long tx_freq;
+    double gain;
+    long samp_rate;
+};
+
+/** Serve OpenMetrics text on http://127.0.0.1:port/metrics from a background thread.  Returns 0 on success or -1 on error. */
+int metrics_start(int port, struct metrics_info info);
+
+/** Record a block that was sent, with the time it took to render. */
+void metrics_block(long samples, double render_seconds);
+
+/** Record a failed push to the device. */
+void metrics_push_error();
+
+/** Record an estimated underrun. */
+void metrics_underrun();
+
+/** Stop serving. */
+void metrics_shutdown();
+
+#endif /* !FILE_METRICS_H_SEEN */
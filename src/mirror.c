@@ -0,0 +1,85 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#define _GNU_SOURCE
+#include "mirror.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+size_t mirror_granularity()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t)page : 4096;
+}
+
+int mirror_create(struct mirror *mirror, size_t size)
+{
+    mirror->base = NULL;
+    mirror->size = 0;
+    if (size == 0 || size % mirror_granularity() != 0)
+    {
+        return -1;
+    }
+
+    // Both halves map the same memory, so the pages only exist once
+    int fd = memfd_create("beacon-mirror", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Reserve both halves together so nothing else can land between them
+    char *base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, 2 * size);
+        close(fd);
+        return -1;
+    }
+    // The mappings keep the memory alive
+    close(fd);
+
+    mirror->base = base;
+    mirror->size = size;
+    return 0;
+}
+
+void mirror_destroy(struct mirror *mirror)
+{
+    if (mirror->base != NULL)
+    {
+        munmap(mirror->base, 2 * mirror->size);
+        mirror->base = NULL;
+        mirror->size = 0;
+    }
+}
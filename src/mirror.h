@@ -0,0 +1,47 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/* File mirror.h */
+#ifndef FILE_MIRROR_H_SEEN
+#define FILE_MIRROR_H_SEEN
+
+#include "../config.h"
+
+#include <stddef.h>
+
+/** A buffer mapped twice at consecutive addresses, so that whatever is read
+    or written past its end lands at its start.  A window of up to size bytes
+    starting anywhere in the first mapping is one contiguous range. */
+struct mirror
+{
+    char *base;
+    size_t size;
+};
+
+/** Returns the unit that mirror sizes must be a multiple of: the page size. */
+size_t mirror_granularity();
+
+/** Map a mirrored buffer of size bytes, a multiple of mirror_granularity().  Returns 0 on success or -1 on error. */
+int mirror_create(struct mirror *mirror, size_t size);
+
+/** Unmap a mirrored buffer.  Does nothing if it was never mapped. */
+void mirror_destroy(struct mirror *mirror);
+
+#endif /* !FILE_MIRROR_H_SEEN */
@@ -0,0 +1,462 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#define _GNU_SOURCE
+#include "net.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+/* Seconds between periodic statistics reports */
+#define NET_STATS_INTERVAL 10
+/* Most segments the kernel will accept in one UDP GSO send */
+#define NET_GSO_MAX_SEGMENTS 64
+#define NET_GSO_MAX_BYTES 65000
+
+static int sock = -1;
+static enum net_protocol protocol;
+static enum iq_format net_format;
+static long net_samp_rate;
+static size_t sample_size;
+
+static char *frames;
+static long samples_per_frame;
+static size_t frame_size;
+static long frame_capacity;
+static int frames_per_message;
+
+static struct mmsghdr *messages;
+static struct iovec *iovecs;
+static int message_count;
+
+static uint64_t sequence;
+static uint64_t sample;
+
+static unsigned long long frames_sent;
+static unsigned long long frames_dropped;
+static unsigned long long bytes_sent;
+static unsigned long long send_calls;
+static struct timespec started;
+static struct timespec last_report;
+
+static double seconds_since(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static uint64_t timestamp_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int connect_to(const char *address)
+{
+    char host[256];
+    const char *rest;
+    int socktype;
+
+    if (strncmp(address, "udp:", 4) == 0)
+    {
+        protocol = NET_UDP;
+        socktype = SOCK_DGRAM;
+    }
+    else if (strncmp(address, "tcp:", 4) == 0)
+    {
+        protocol = NET_TCP;
+        socktype = SOCK_STREAM;
+    }
+    else
+    {
+        fprintf(stderr, "Error: Network address must start with udp: or tcp:, got %s\n", address);
+        return -1;
+    }
+    rest = address + 4;
+
+    // The port follows the last colon so that bracketed IPv6 hosts work
+    const char *port = strrchr(rest, ':');
+    if (port == NULL || port == rest || port - rest >= (long)sizeof(host))
+    {
+        fprintf(stderr, "Error: Network address must be in the form %.4shost:port, got %s\n", address, address);
+        return -1;
+    }
+    memcpy(host, rest, port - rest);
+    host[port - rest] = '\0';
+    port++;
+    if (host[0] == '[' && host[strlen(host) - 1] == ']')
+    {
+        memmove(host, host + 1, strlen(host) - 2);
+        host[strlen(host) - 2] = '\0';
+    }
+
+    struct addrinfo hints, *result, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    int err = getaddrinfo(host, port, &hints, &result);
+    if (err != 0)
+    {
+        fprintf(stderr, "Error: Could not resolve %s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (ai = result; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0)
+    {
+        perror("Error: Could not connect");
+    }
+    return fd;
+}
+
+/** Make room for the frames of a block of iq_len samples.  Returns 0 on success or -1 if out of memory. */
+static int reserve_frames(long iq_len)
+{
+    if (protocol == NET_TCP && iq_len > samples_per_frame)
+    {
+        // A TCP frame carries a whole block, so it grows with the blocks
+        samples_per_frame = iq_len;
+        frame_size = sizeof(struct net_frame_header) + samples_per_frame * sample_size;
+        frame_capacity = 0;
+    }
+    long needed = (iq_len + samples_per_frame - 1) / samples_per_frame;
+    if (needed <= frame_capacity)
+    {
+        return 0;
+    }
+    char *grown = realloc(frames, needed * frame_size);
+    if (grown == NULL)
+    {
+        return -1;
+    }
+    frames = grown;
+    if (protocol == NET_UDP)
+    {
+        struct mmsghdr *grown_messages = realloc(messages, needed * sizeof(struct mmsghdr));
+        if (grown_messages == NULL)
+        {
+            return -1;
+        }
+        messages = grown_messages;
+        struct iovec *grown_iovecs = realloc(iovecs, needed * sizeof(struct iovec));
+        if (grown_iovecs == NULL)
+        {
+            return -1;
+        }
+        iovecs = grown_iovecs;
+    }
+    frame_capacity = needed;
+    return 0;
+}
+
+/** Lay the frames of one block out as sendmmsg messages, grouping frames into GSO sends when possible. */
+static void build_messages(long frame_count, size_t last_frame_size)
+{
+    message_count = 0;
+    for (long frame = 0; frame < frame_count; frame += frames_per_message)
+    {
+        long count = frame_count - frame;
+        if (count > frames_per_message)
+        {
+            count = frames_per_message;
+        }
+        size_t len = (count - 1) * frame_size;
+        len += (frame + count == frame_count) ? last_frame_size : frame_size;
+
+        iovecs[message_count].iov_base = frames + frame * frame_size;
+        iovecs[message_count].iov_len = len;
+        memset(&messages[message_count], 0, sizeof(struct mmsghdr));
+        messages[message_count].msg_hdr.msg_iov = &iovecs[message_count];
+        messages[message_count].msg_hdr.msg_iovlen = 1;
+        message_count++;
+    }
+}
+
+static int enable_gso()
+{
+#ifdef UDP_SEGMENT
+    int segment = frame_size;
+    if (setsockopt(sock, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0)
+    {
+        int count = NET_GSO_MAX_BYTES / frame_size;
+        return count > NET_GSO_MAX_SEGMENTS ? NET_GSO_MAX_SEGMENTS : count;
+    }
+#endif
+    return 1;
+}
+
+static void disable_gso()
+{
+#ifdef UDP_SEGMENT
+    int segment = 0;
+    setsockopt(sock, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment));
+#endif
+    frames_per_message = 1;
+}
+
+int net_init(const char *address, enum iq_format format, long samp_rate, long iq_len)
+{
+    sock = connect_to(address);
+    if (sock < 0)
+    {
+        return -1;
+    }
+
+    net_format = format;
+    net_samp_rate = samp_rate;
+    sample_size = iq_sample_size(format);
+
+    // Each connection is a new stream
+    sequence = 0;
+    sample = 0;
+    frames_sent = frames_dropped = bytes_sent = send_calls = 0;
+
+    if (protocol == NET_UDP)
+    {
+        samples_per_frame = (NET_UDP_PAYLOAD - sizeof(struct net_frame_header)) / sample_size;
+    }
+    else
+    {
+        samples_per_frame = iq_len;
+    }
+    frame_size = sizeof(struct net_frame_header) + samples_per_frame * sample_size;
+    frame_capacity = 0;
+    if (reserve_frames(iq_len) < 0)
+    {
+        fprintf(stderr, "Error: Could not allocate the network frames\n");
+        net_close();
+        return -1;
+    }
+
+    if (protocol == NET_UDP)
+    {
+        // A deeper send buffer absorbs a whole block without dropping
+        int sndbuf = frame_capacity * frame_size * 4;
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+        frames_per_message = enable_gso();
+    }
+
+    fprintf(stderr, "Network: %s, Format: %s, Samples Per Frame: %ld, Frames Per Send: %d\n",
+            protocol == NET_UDP ? "UDP" : "TCP", iq_format_name(format), samples_per_frame,
+            protocol == NET_UDP ? frames_per_message : 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    last_report = started;
+    return 0;
+}
+
+/** Fill in the headers and payloads of the frame_count frames that hold one block.  Returns the size of the last frame. */
+static size_t fill_frames(complex *iq, long iq_len, long frame_count)
+{
+    uint64_t now = timestamp_ns();
+    size_t last_frame_size = frame_size;
+
+    for (long frame = 0; frame < frame_count; frame++)
+    {
+        // Only the last frame is short, and never empty
+        long offset = frame * samples_per_frame;
+        long count = iq_len - offset;
+        if (count > samples_per_frame)
+        {
+            count = samples_per_frame;
+        }
+
+        struct net_frame_header *header = (struct net_frame_header *)(frames + frame * frame_size);
+        header->magic = htole32(NET_FRAME_MAGIC);
+        header->version = htole16(NET_FRAME_VERSION);
+        header->format = htole16(net_format);
+        header->sequence = htole64(sequence++);
+        header->timestamp = htole64(now);
+        header->sample = htole64(sample + offset);
+        header->samp_rate = htole32(net_samp_rate);
+        header->samples = htole32(count);
+        pack_iq(net_format, header + 1, iq + offset, count);
+
+        last_frame_size = sizeof(struct net_frame_header) + count * sample_size;
+    }
+    return last_frame_size;
+}
+
+static long frames_in_message(int message)
+{
+    return (iovecs[message].iov_len + frame_size - 1) / frame_size;
+}
+
+static int send_udp(long frame_count, size_t last_frame_size)
+{
+    build_messages(frame_count, last_frame_size);
+
+    int message = 0;
+    while (message < message_count)
+    {
+        int sent = sendmmsg(sock, messages + message, message_count - message, 0);
+        send_calls++;
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EIO && frames_per_message > 1)
+            {
+                // The route doesn't support segmentation offload
+                fprintf(stderr, "Network: UDP GSO unavailable, sending one frame per datagram\n");
+                disable_gso();
+                build_messages(frame_count, last_frame_size);
+                message = 0;
+                continue;
+            }
+            if (errno == EAGAIN || errno == ENOBUFS || errno == ECONNREFUSED || errno == EMSGSIZE)
+            {
+                // The receiver isn't keeping up or isn't listening; drop and keep going
+                frames_dropped += frames_in_message(message);
+                message++;
+                continue;
+            }
+            perror("Error: Could not send IQ data");
+            return -1;
+        }
+        for (int index = message; index < message + sent; index++)
+        {
+            frames_sent += frames_in_message(index);
+            bytes_sent += iovecs[index].iov_len;
+        }
+        message += sent;
+    }
+    return 0;
+}
+
+static int send_tcp(size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t sent = send(sock, frames + done, len - done, MSG_NOSIGNAL);
+        send_calls++;
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error: Could not send IQ data");
+            return -1;
+        }
+        done += sent;
+    }
+    frames_sent++;
+    bytes_sent += len;
+    return 0;
+}
+
+long net_send(complex *iq, long iq_len)
+{
+    if (iq_len <= 0)
+    {
+        return 0;
+    }
+    // Blocks can be shorter than at init (the end of a recording) or longer (after tuning)
+    if (reserve_frames(iq_len) < 0)
+    {
+        fprintf(stderr, "Error: Could not allocate the network frames\n");
+        return -1;
+    }
+    long frame_count = (iq_len + samples_per_frame - 1) / samples_per_frame;
+    size_t last_frame_size = fill_frames(iq, iq_len, frame_count);
+    int result = protocol == NET_UDP ? send_udp(frame_count, last_frame_size) : send_tcp(last_frame_size);
+    if (result < 0)
+    {
+        return -1;
+    }
+    sample += iq_len;
+
+    if (seconds_since(&last_report) >= NET_STATS_INTERVAL)
+    {
+        net_print_stats(stderr);
+        clock_gettime(CLOCK_MONOTONIC, &last_report);
+    }
+    return iq_len;
+}
+
+void net_print_stats(FILE *out)
+{
+    double elapsed = seconds_since(&started);
+    fprintf(out, "Network: Frames Sent: %llu, Frames Dropped: %llu, Sends: %llu, Sent: %0.3f MB, Throughput: %0.3f MB/s, %0.3f Ms/s\n",
+            frames_sent, frames_dropped, send_calls, bytes_sent / 1e6,
+            elapsed > 0 ? bytes_sent / elapsed / 1e6 : 0.0,
+            elapsed > 0 ? sample / elapsed / 1e6 : 0.0);
+}
+
+void net_shutdown()
+{
+    if (sock < 0)
+    {
+        return;
+    }
+    net_print_stats(stderr);
+    net_close();
+}
+
+void net_close()
+{
+    if (sock < 0)
+    {
+        return;
+    }
+    close(sock);
+    sock = -1;
+    free(frames);
+    free(messages);
+    free(iovecs);
+    frames = NULL;
+    messages = NULL;
+    iovecs = NULL;
+    frame_capacity = 0;
+}
@@ -0,0 +1,76 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File net.h */
+#ifndef FILE_NET_H_SEEN
+#define FILE_NET_H_SEEN
+
+#include "../config.h"
+#include "iq.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <complex.h>
+
+/* "BCN1" when read as a little endian value */
+#define NET_FRAME_MAGIC 0x314e4342
+#define NET_FRAME_VERSION 1
+
+/** Largest UDP payload that fits in a standard 1500 byte ethernet frame. */
+#define NET_UDP_PAYLOAD 1472
+
+enum net_protocol
+{
+    NET_UDP,
+    NET_TCP
+};
+
+/** Header sent in front of every frame of IQ data.  All fields are little endian.
+    UDP frames carry as many samples as fit in one datagram, TCP frames carry one whole block.
+    Receivers can find lost UDP frames from gaps in the sequence number. */
+struct net_frame_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t format;
+    uint64_t sequence;
+    uint64_t timestamp;
+    uint64_t sample;
+    uint32_t samp_rate;
+    uint32_t samples;
+};
+
+/** Connect to the given address (udp:host:port or tcp:host:port).  Returns 0 on success or -1 on error. */
+int net_init(const char *address, enum iq_format format, long samp_rate, long iq_len);
+
+/** Send the given IQ data.  Returns the number of samples sent or dropped, or -1 if the connection failed. */
+long net_send(complex *iq, long iq_len);
+
+/** Print the throughput and drop counters. */
+void net_print_stats(FILE *out);
+
+/** Print the final counters and close the connection. */
+void net_shutdown();
+
+/** Close the connection without printing the counters. */
+void net_close();
+
+#endif /* !FILE_NET_H_SEEN */
@@ -0,0 +1,100 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "play.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int play_open(struct playback *playback, const char *path, enum iq_format format)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error: Could not open recording");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("Error: Could not open recording");
+        close(fd);
+        return -1;
+    }
+
+    playback->format = format;
+    playback->sample_size = iq_sample_size(format);
+    playback->samples = st.st_size / playback->sample_size;
+    playback->size = st.st_size;
+    playback->advised = 0;
+    if (playback->samples == 0)
+    {
+        fprintf(stderr, "Error: %s holds no samples\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, playback->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("Error: Could not map recording");
+        return -1;
+    }
+    playback->data = data;
+
+    // Read ahead more aggressively and let pages go soon after they are used
+    madvise(data, playback->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+const void *play_block(struct playback *playback, long offset)
+{
+    size_t start = offset * playback->sample_size;
+
+    // Top up the read-ahead once the cursor is half way through it, and start
+    // again from the top when a loop comes back round
+    if (start + PLAY_READAHEAD < playback->advised || start > playback->advised)
+    {
+        playback->advised = start;
+    }
+    if (start + PLAY_READAHEAD / 2 >= playback->advised && playback->advised < playback->size)
+    {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t from = playback->advised / page * page;
+        size_t len = PLAY_READAHEAD;
+        if (from + len > playback->size)
+        {
+            len = playback->size - from;
+        }
+        madvise((char *)playback->data + from, len, MADV_WILLNEED);
+        playback->advised = from + len;
+    }
+    return playback->data + start;
+}
+
+void play_close(struct playback *playback)
+{
+    munmap((void *)playback->data, playback->size);
+}
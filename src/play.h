@@ -0,0 +1,54 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File play.h */
+#ifndef FILE_PLAY_H_SEEN
+#define FILE_PLAY_H_SEEN
+
+#include "../config.h"
+#include "iq.h"
+
+#include <stddef.h>
+
+/* How far ahead of the block being sent the kernel is asked to read */
+#define PLAY_READAHEAD (8 * 1024 * 1024)
+
+/** A recording mapped into memory and read in order, block by block. */
+struct playback
+{
+    const char *data;
+    size_t size;
+    long samples;
+    enum iq_format format;
+    size_t sample_size;
+    size_t advised;
+};
+
+/** Map a recording in the given format.  Returns 0 on success or -1 on error. */
+int play_open(struct playback *playback, const char *path, enum iq_format format);
+
+/** Returns the packed samples starting at the given sample, asking the kernel to read ahead of them. */
+const void *play_block(struct playback *playback, long offset);
+
+/** Unmap a recording. */
+void play_close(struct playback *playback);
+
+#endif /* !FILE_PLAY_H_SEEN */
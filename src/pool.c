@@ -0,0 +1,242 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#define _GNU_SOURCE
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct render_worker
+{
+    struct render_pool *pool;
+    struct beacon *ctx;
+    int index;
+    pthread_t thread;
+};
+
+struct render_pool
+{
+    int threads;
+    int pinned;
+    struct render_worker *workers;
+
+    // The current block, published by bumping generation
+    beacon_iq *iq;
+    long long start;
+    long len;
+    atomic_uint generation;
+    atomic_int done;
+    atomic_bool quit;
+
+    // Threads that run out of spins sleep here until the counters move
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+};
+
+/** Render this worker's share of the current block. */
+static void render_slice(struct render_worker *worker)
+{
+    struct render_pool *pool = worker->pool;
+    long slice = (pool->len + pool->threads - 1) / pool->threads;
+    slice = (slice + POOL_SLICE_ALIGN - 1) / POOL_SLICE_ALIGN * POOL_SLICE_ALIGN;
+    long from = slice * worker->index;
+    long to = from + slice < pool->len ? from + slice : pool->len;
+    if (from >= to)
+    {
+        return;
+    }
+    beacon_seek(worker->ctx, pool->start + from);
+    beacon_render_iq(worker->ctx, pool->iq + from, to - from);
+}
+
+static void *pool_worker(void *arg)
+{
+    struct render_worker *worker = arg;
+    struct render_pool *pool = worker->pool;
+    unsigned int seen = 0;
+
+    while (true)
+    {
+        unsigned int generation;
+        int spins = 0;
+        while ((generation = atomic_load_explicit(&pool->generation, memory_order_acquire)) == seen)
+        {
+            if (++spins > POOL_SPIN_LIMIT)
+            {
+                pthread_mutex_lock(&pool->lock);
+                while ((generation = atomic_load_explicit(&pool->generation, memory_order_acquire)) == seen)
+                {
+                    pthread_cond_wait(&pool->work, &pool->lock);
+                }
+                pthread_mutex_unlock(&pool->lock);
+                break;
+            }
+        }
+        seen = generation;
+        if (atomic_load_explicit(&pool->quit, memory_order_relaxed))
+        {
+            break;
+        }
+        render_slice(worker);
+        if (atomic_fetch_add_explicit(&pool->done, 1, memory_order_release) == pool->threads - 2)
+        {
+            // Last one in wakes the caller if it stopped spinning
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->finished);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    return NULL;
+}
+
+/** Publish a new block, or the quit flag, and wake any sleeping workers. */
+static void publish(struct render_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/** Pin a worker to its own CPU, leaving CPU 0 for the calling thread.  Returns true on success. */
+static bool pin_worker(struct render_worker *worker)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 1)
+    {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(1 + (worker->index - 1) % (cpus - 1), &set);
+    return pthread_setaffinity_np(worker->thread, sizeof(set), &set) == 0;
+}
+
+struct render_pool *render_pool_create(const struct beacon_params *params, int threads)
+{
+    struct render_pool *pool = calloc(1, sizeof(struct render_pool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->workers = calloc(threads, sizeof(struct render_worker));
+    if (pool->workers == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->done, 0);
+    atomic_init(&pool->quit, false);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+
+    for (int index = 0; index < threads; index++)
+    {
+        struct render_worker *worker = &pool->workers[index];
+        worker->pool = pool;
+        worker->index = index;
+        worker->ctx = beacon_create(params);
+        if (worker->ctx == NULL)
+        {
+            render_pool_destroy(pool);
+            return NULL;
+        }
+        // The caller renders slice 0 itself
+        if (index > 0)
+        {
+            if (pthread_create(&worker->thread, NULL, pool_worker, worker) != 0)
+            {
+                beacon_destroy(worker->ctx);
+                worker->ctx = NULL;
+                render_pool_destroy(pool);
+                return NULL;
+            }
+            if (pin_worker(worker))
+            {
+                pool->pinned++;
+            }
+        }
+        pool->threads = index + 1;
+    }
+    return pool;
+}
+
+void render_pool_render(struct render_pool *pool, long long start, beacon_iq *iq, long len)
+{
+    pool->iq = iq;
+    pool->start = start;
+    pool->len = len;
+    atomic_store_explicit(&pool->done, 0, memory_order_relaxed);
+    publish(pool);
+
+    render_slice(&pool->workers[0]);
+
+    int spins = 0;
+    while (atomic_load_explicit(&pool->done, memory_order_acquire) < pool->threads - 1)
+    {
+        if (++spins > POOL_SPIN_LIMIT)
+        {
+            pthread_mutex_lock(&pool->lock);
+            while (atomic_load_explicit(&pool->done, memory_order_acquire) < pool->threads - 1)
+            {
+                pthread_cond_wait(&pool->finished, &pool->lock);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+    }
+}
+
+int render_pool_threads(const struct render_pool *pool)
+{
+    return pool->threads;
+}
+
+int render_pool_pinned(const struct render_pool *pool)
+{
+    return pool->pinned;
+}
+
+void render_pool_destroy(struct render_pool *pool)
+{
+    atomic_store_explicit(&pool->quit, true, memory_order_relaxed);
+    publish(pool);
+    for (int index = 0; index < pool->threads; index++)
+    {
+        if (index > 0)
+        {
+            pthread_join(pool->workers[index].thread, NULL);
+        }
+        beacon_destroy(pool->workers[index].ctx);
+    }
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,62 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File pool.h */
+#ifndef FILE_POOL_H_SEEN
+#define FILE_POOL_H_SEEN
+
+#include "../config.h"
+#include "beacon.h"
+#include "arena.h"
+
+#include <stdbool.h>
+
+/* Slices start on a cache line so workers never write to the same one */
+#define POOL_SLICE_ALIGN (ARENA_ALIGN / sizeof(beacon_iq))
+
+/* Times a thread checks for work or completion before going to sleep */
+#define POOL_SPIN_LIMIT 4096
+
+/** A set of threads that render one block together, each into its own slice.
+
+    Every thread has its own rendering context and seeks it to the start of
+    its slice, so the block comes out the same as if one context rendered it.
+    The calling thread renders the first slice.  Blocks are handed out and
+    collected through two atomic counters that the threads spin on briefly
+    before sleeping on a condition variable, so an idle pool uses no CPU. */
+struct render_pool;
+
+/** Start threads - 1 worker threads, pinned to CPUs 1 and up.  Returns NULL on error. */
+struct render_pool *render_pool_create(const struct beacon_params *params, int threads);
+
+/** Render len samples starting at the given absolute sample, returning once every slice is done. */
+void render_pool_render(struct render_pool *pool, long long start, beacon_iq *iq, long len);
+
+/** Returns the number of threads, including the caller. */
+int render_pool_threads(const struct render_pool *pool);
+
+/** Returns the number of workers that could be pinned to a CPU. */
+int render_pool_pinned(const struct render_pool *pool);
+
+/** Stop the workers and free the pool. */
+void render_pool_destroy(struct render_pool *pool);
+
+#endif /* !FILE_POOL_H_SEEN */
@@ -0,0 +1,454 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#define _GNU_SOURCE
+#include "render.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+struct render_job
+{
+    const struct beacon_params *params;
+    enum iq_format format;
+    int fd;
+    long long total_samples;
+    long block_len;
+    long long block_count;
+    atomic_llong next_block;
+    atomic_bool failed;
+};
+
+/** How repeated parts of a file are filled in, fastest first. */
+enum repeat_method
+{
+    REPEAT_CLONE,
+    REPEAT_COPY_RANGE,
+    REPEAT_READ_WRITE
+};
+
+static const char *repeat_method_name(enum repeat_method method)
+{
+    switch (method)
+    {
+    case REPEAT_CLONE:
+        return "reflink";
+    case REPEAT_COPY_RANGE:
+        return "copy_file_range";
+    default:
+        return "read/write";
+    }
+}
+
+/** Returns true if the error means the file system can't do this kind of copy, as opposed to the copy failing. */
+static bool unsupported(int err)
+{
+    return err == EOPNOTSUPP || err == ENOTTY || err == ENOSYS || err == EXDEV || err == EINVAL;
+}
+
+/** Copy len bytes from src to dst within the file, by cloning the whole blocks if the file system shares extents, then copying in the kernel, then reading and writing.  The method drops to the next one once the file system turns it down.  Returns 0 on success or -1 on error. */
+static int copy_range(int fd, off_t src, off_t dst, off_t len, off_t block_size, enum repeat_method *method)
+{
+#ifdef FICLONERANGE
+    off_t aligned = len / block_size * block_size;
+    if (*method == REPEAT_CLONE && aligned > 0)
+    {
+        struct file_clone_range range = {fd, src, aligned, dst};
+        if (ioctl(fd, FICLONERANGE, &range) == 0)
+        {
+            src += aligned;
+            dst += aligned;
+            len -= aligned;
+        }
+        else if (unsupported(errno))
+        {
+            *method = REPEAT_COPY_RANGE;
+        }
+        else
+        {
+            perror("Error: Could not clone IQ data");
+            return -1;
+        }
+    }
+#else
+    *method = *method == REPEAT_CLONE ? REPEAT_COPY_RANGE : *method;
+#endif
+
+    // A tail shorter than a block is copied even where clones work
+    while (len > 0 && *method != REPEAT_READ_WRITE)
+    {
+        ssize_t copied = copy_file_range(fd, &src, fd, &dst, len, 0);
+        if (copied > 0)
+        {
+            len -= copied;
+        }
+        else if (copied < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (copied == 0 || unsupported(errno))
+        {
+            if (*method == REPEAT_COPY_RANGE)
+            {
+                *method = REPEAT_READ_WRITE;
+            }
+            break;
+        }
+        else
+        {
+            perror("Error: Could not copy IQ data");
+            return -1;
+        }
+    }
+
+    if (len == 0)
+    {
+        return 0;
+    }
+    char *buf = malloc(RENDER_COPY_LEN);
+    if (buf == NULL)
+    {
+        perror("Error: Could not copy IQ data");
+        return -1;
+    }
+    while (len > 0)
+    {
+        ssize_t got = pread(fd, buf, len < RENDER_COPY_LEN ? len : RENDER_COPY_LEN, src);
+        ssize_t put = got;
+        for (ssize_t done = 0; got > 0 && done < got; done += put)
+        {
+            put = pwrite(fd, buf + done, got - done, dst + done);
+            if (put < 0 && errno == EINTR)
+            {
+                put = 0;
+            }
+            else if (put < 0)
+            {
+                break;
+            }
+        }
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0 || put < 0)
+        {
+            perror("Error: Could not copy IQ data");
+            free(buf);
+            return -1;
+        }
+        src += got;
+        dst += got;
+        len -= got;
+    }
+    free(buf);
+    return 0;
+}
+
+/** Fill the file from done to size with the period bytes starting at start, which are already written.  Each pass copies everything from start onward, so the copies take a few dozen calls for any length.  Returns the method used at the end, or -1 on error. */
+static int repeat_period(int fd, off_t start, off_t done, off_t size, off_t block_size)
+{
+    enum repeat_method method = REPEAT_CLONE;
+    while (done < size)
+    {
+        off_t len = done - start < size - done ? done - start : size - done;
+        if (copy_range(fd, start, done, len, block_size, &method) < 0)
+        {
+            return -1;
+        }
+        done += len;
+    }
+    return method;
+}
+
+/** Worker thread.  Each worker has its own context and claims blocks in order until none are left. */
+static void *render_worker(void *arg)
+{
+    struct render_job *job = arg;
+    size_t sample_size = iq_sample_size(job->format);
+    char *buf = malloc(job->block_len * sample_size);
+    struct beacon *ctx = beacon_create(job->params);
+
+    if (buf == NULL || ctx == NULL)
+    {
+        fprintf(stderr, "Error: Could not create render context\n");
+        atomic_store(&job->failed, true);
+    }
+
+    while (!atomic_load(&job->failed))
+    {
+        long long block = atomic_fetch_add(&job->next_block, 1);
+        if (block >= job->block_count)
+        {
+            break;
+        }
+
+        long long start = block * job->block_len;
+        long len = job->block_len;
+        if (start + len > job->total_samples)
+        {
+            len = job->total_samples - start;
+        }
+
+        // Blocks are rendered independently, so seek unless this worker
+        // just rendered the block before this one.
+        if (beacon_tell(ctx) != start)
+        {
+            beacon_seek(ctx, start);
+        }
+        beacon_render(ctx, buf, len, job->format);
+
+        size_t size = len * sample_size;
+        off_t offset = start * sample_size;
+        size_t done = 0;
+        while (done < size)
+        {
+            ssize_t written = pwrite(job->fd, buf + done, size - done, offset + done);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("Error: Could not write IQ data");
+                atomic_store(&job->failed, true);
+                break;
+            }
+            done += written;
+        }
+    }
+
+    beacon_destroy(ctx);
+    free(buf);
+    return NULL;
+}
+
+int render_bcn(FILE *out, const struct beacon_params *params, enum iq_format format, long long total_samples, long block_len)
+{
+    char *buf = malloc(block_len * iq_sample_size(format));
+    struct beacon *ctx = beacon_create(params);
+    struct bcn_writer *writer = bcn_create(out, format, params->samp_rate);
+    int ret = 0;
+
+    if (buf == NULL || ctx == NULL || writer == NULL)
+    {
+        fprintf(stderr, "Error: Could not create render context\n");
+        ret = -1;
+    }
+    for (long long done = 0; done < total_samples && ret == 0; done += block_len)
+    {
+        long len = block_len;
+        if (done + len > total_samples)
+        {
+            len = total_samples - done;
+        }
+        beacon_render(ctx, buf, len, format);
+        ret = bcn_write(writer, buf, len);
+    }
+    if (writer != NULL && bcn_close(writer) < 0)
+    {
+        ret = -1;
+    }
+    beacon_destroy(ctx);
+    free(buf);
+    return ret;
+}
+
+/** Render into a .bcn file.  The encoder works through the signal in order, so this uses one thread. */
+static int render_bcn_file(const char *path, const struct beacon_params *params, enum iq_format format, double seconds, long block_len)
+{
+    struct timespec started, finished;
+    long long total_samples = (long long)(seconds * params->samp_rate);
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        perror("Error: Could not open output file");
+        return -1;
+    }
+
+    fprintf(stderr, "Rendering %lld samples to %s, Format: %s (bcn)\n", total_samples, path, iq_format_name(format));
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int ret = render_bcn(out, params, format, total_samples, block_len);
+    off_t size = ftello(out);
+    if (fclose(out) != 0 || ret < 0)
+    {
+        perror("Error: Could not write IQ data");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    double elapsed = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    double raw_size = (double)total_samples * iq_sample_size(format);
+    fprintf(stderr, "Rendered %0.3f s of signal in %0.3f s (%0.3f Ms/s), %0.1f KB (%0.3f%% of raw)\n",
+            seconds, elapsed, total_samples / elapsed / 1e6, size / 1e3, raw_size > 0 ? 100.0 * size / raw_size : 0.0);
+    return 0;
+}
+
+bool is_bcn_path(const char *path)
+{
+    size_t len = strlen(path);
+    return len >= 4 && strcasecmp(path + len - 4, ".bcn") == 0;
+}
+
+int render_file(const char *path, const struct beacon_params *params, enum iq_format format, double seconds, long block_len, int threads)
+{
+    if (is_bcn_path(path))
+    {
+        return render_bcn_file(path, params, format, seconds, block_len);
+    }
+
+    struct render_job job;
+    struct timespec started, finished;
+
+    long long total_samples = (long long)(seconds * params->samp_rate);
+    size_t sample_size = iq_sample_size(format);
+    off_t size = total_samples * sample_size;
+
+    job.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (job.fd < 0)
+    {
+        perror("Error: Could not open output file");
+        return -1;
+    }
+
+    // A signal that repeats within the file is rendered up to the end of its
+    // first whole period and the rest copied from that.  Copies start and
+    // repeat on file system blocks so they can share extents.
+    struct stat info;
+    off_t block_size = fstat(job.fd, &info) == 0 && info.st_blksize > 0 ? info.st_blksize : RENDER_COPY_LEN;
+    long long period_start = 0, period = 0;
+    struct beacon *probe = beacon_create(params);
+    if (probe != NULL)
+    {
+        period = beacon_period(probe, &period_start);
+        beacon_destroy(probe);
+    }
+    off_t repeat_start = (period_start * sample_size + block_size - 1) / block_size * block_size;
+    off_t period_size = 0;
+    if (period > 0 && period < total_samples && (block_size & (block_size - 1)) == 0 && block_size % sample_size == 0)
+    {
+        period_size = period * sample_size;
+        while (period_size % block_size != 0 && period_size <= size)
+        {
+            period_size *= 2;
+        }
+    }
+    if (period_size > 0 && repeat_start + 2 * period_size > size)
+    {
+        // Too long to line up with blocks here, so repeat it as it is
+        repeat_start = period_start * sample_size;
+        period_size = period * sample_size;
+    }
+    bool repeating = period_size > 0 && repeat_start + 2 * period_size <= size;
+
+    job.params = params;
+    job.format = format;
+    job.total_samples = repeating ? (repeat_start + period_size) / (off_t)sample_size : total_samples;
+    job.block_len = block_len;
+    job.block_count = (job.total_samples + block_len - 1) / block_len;
+    atomic_init(&job.next_block, 0);
+    atomic_init(&job.failed, false);
+
+    // Size the file up front so each block can be written in place.  Only
+    // the rendered part is allocated, so repeats can share its extents.
+    off_t allocate = job.total_samples * sample_size;
+    int err = posix_fallocate(job.fd, 0, allocate);
+    if ((err != 0 && ftruncate(job.fd, allocate) < 0) || ftruncate(job.fd, size) < 0)
+    {
+        perror("Error: Could not size output file");
+        close(job.fd);
+        return -1;
+    }
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > job.block_count)
+    {
+        threads = job.block_count > 0 ? job.block_count : 1;
+    }
+
+    fprintf(stderr, "Rendering %lld samples to %s, Format: %s, Threads: %d\n",
+            total_samples, path, iq_format_name(format), threads);
+    if (repeating)
+    {
+        fprintf(stderr, "Repeating: Period: %lld samples (%0.3f s), Rendering the first %lld samples\n",
+                period_size / (long long)sample_size, (double)period_size / sample_size / params->samp_rate, job.total_samples);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    pthread_t workers[threads];
+    int started_threads = 0;
+    for (; started_threads < threads; started_threads++)
+    {
+        if (pthread_create(&workers[started_threads], NULL, render_worker, &job) != 0)
+        {
+            fprintf(stderr, "Error: Could not start render thread\n");
+            atomic_store(&job.failed, true);
+            break;
+        }
+    }
+    for (int index = 0; index < started_threads; index++)
+    {
+        pthread_join(workers[index], NULL);
+    }
+
+
+    int method = -1;
+    if (repeating && !atomic_load(&job.failed))
+    {
+        method = repeat_period(job.fd, repeat_start, allocate, size, block_size);
+        if (method < 0)
+        {
+            atomic_store(&job.failed, true);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    close(job.fd);
+
+    if (atomic_load(&job.failed))
+    {
+        return -1;
+    }
+    if (repeating)
+    {
+        fprintf(stderr, "Repeated: %0.1f MB by %s\n", (size - allocate) / 1e6, repeat_method_name(method));
+    }
+
+    double elapsed = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    fprintf(stderr, "Rendered %0.3f s of signal in %0.3f s (%0.3f Ms/s, %0.3f MB/s)\n",
+            seconds, elapsed, total_samples / elapsed / 1e6, size / elapsed / 1e6);
+    return 0;
+}
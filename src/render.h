@@ -0,0 +1,46 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File render.h */
+#ifndef FILE_RENDER_H_SEEN
+#define FILE_RENDER_H_SEEN
+
+#include "../config.h"
+#include "beacon.h"
+#include "iq.h"
+#include "bcn.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Bytes copied at a time where the file system can't copy within a file itself */
+#define RENDER_COPY_LEN (8 * 1024 * 1024)
+
+/** Render the given number of seconds of the signal into a file, splitting the work into blocks of block_len samples across threads worker threads.  A path ending in .bcn is written as a compressed .bcn file on one thread.  Returns 0 on success or -1 on error. */
+int render_file(const char *path, const struct beacon_params *params, enum iq_format format, double seconds, long block_len, int threads);
+
+/** Render total_samples samples of the signal as a .bcn stream into out.  Returns 0 on success or -1 on error. */
+int render_bcn(FILE *out, const struct beacon_params *params, enum iq_format format, long long total_samples, long block_len);
+
+/** Returns true if the path names a .bcn file. */
+bool is_bcn_path(const char *path);
+
+#endif /* !FILE_RENDER_H_SEEN */
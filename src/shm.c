@@ -0,0 +1,154 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "shm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char *shm_name;
+static struct shm_ring_header *ring;
+static struct shm_slot_header *slots;
+static char *data;
+static size_t map_size;
+static enum iq_format shm_format;
+static long shm_samp_rate;
+static uint64_t sample;
+static struct timespec started;
+
+int shm_init(const char *name, enum iq_format format, long samp_rate, long iq_len, int slot_count)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t slot_size = iq_len * iq_sample_size(format);
+    size_t data_offset = sizeof(struct shm_ring_header) + slot_count * sizeof(struct shm_slot_header);
+
+    // Start the slots on a page boundary so readers can map or madvise them directly
+    data_offset = (data_offset + page_size - 1) / page_size * page_size;
+    map_size = data_offset + slot_count * slot_size;
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        perror("Error: Could not open shared memory");
+        return -1;
+    }
+    if (ftruncate(fd, map_size) < 0)
+    {
+        perror("Error: Could not size shared memory");
+        close(fd);
+        return -1;
+    }
+    ring = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+    {
+        ring = NULL;
+        perror("Error: Could not map shared memory");
+        return -1;
+    }
+    shm_name = name;
+    shm_format = format;
+    shm_samp_rate = samp_rate;
+
+    slots = (struct shm_slot_header *)(ring + 1);
+    data = (char *)ring + data_offset;
+
+    // Readers check the magic last, so publish it after everything else
+    ring->version = SHM_RING_VERSION;
+    ring->format = format;
+    ring->samp_rate = samp_rate;
+    ring->slot_count = slot_count;
+    ring->slot_samples = iq_len;
+    ring->slot_size = slot_size;
+    ring->data_offset = data_offset;
+    atomic_store_explicit(&ring->write_index, 0, memory_order_relaxed);
+    for (int index = 0; index < slot_count; index++)
+    {
+        atomic_store_explicit(&slots[index].sequence, 0, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+    ring->magic = SHM_RING_MAGIC;
+
+    fprintf(stderr, "Shared Memory: %s, Format: %s, Slots: %d, Size: %0.3f MB\n",
+            name, iq_format_name(format), slot_count, map_size / 1e6);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    return 0;
+}
+
+/** Sleep until the wall clock catches up with the samples published so far. */
+static void pace()
+{
+    struct timespec due = started;
+    long long ns = (long long)((double)sample / shm_samp_rate * 1e9);
+    due.tv_sec += ns / 1000000000LL;
+    due.tv_nsec += ns % 1000000000LL;
+    if (due.tv_nsec >= 1000000000L)
+    {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+        ;
+}
+
+void shm_publish(complex *iq, long iq_len)
+{
+    uint64_t block = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    uint64_t index = block % ring->slot_count;
+    struct shm_slot_header *slot = &slots[index];
+
+    if (iq_len > (long)ring->slot_samples)
+    {
+        iq_len = ring->slot_samples;
+    }
+
+    atomic_store_explicit(&slot->sequence, SHM_SLOT_WRITING, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->sample = sample;
+    slot->samples = iq_len;
+    pack_iq(shm_format, data + index * ring->slot_size, iq, iq_len);
+
+    atomic_store_explicit(&slot->sequence, block + 1, memory_order_release);
+    atomic_store_explicit(&ring->write_index, block + 1, memory_order_release);
+
+    sample += iq_len;
+    pace();
+}
+
+void shm_shutdown()
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    munmap(ring, map_size);
+    ring = NULL;
+    // Readers that already have the ring mapped keep it until they unmap
+    shm_unlink(shm_name);
+}
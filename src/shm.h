@@ -0,0 +1,82 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File shm.h */
+#ifndef FILE_SHM_H_SEEN
+#define FILE_SHM_H_SEEN
+
+#include "../config.h"
+#include "global.h"
+#include "iq.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <complex.h>
+
+/* "BCNR" when read as a little endian value */
+#define SHM_RING_MAGIC 0x524e4342
+#define SHM_RING_VERSION 1
+
+/** Marks a slot that the writer is currently filling. */
+#define SHM_SLOT_WRITING UINT64_MAX
+
+/** Header at the start of the shared memory object.
+
+    The header is followed by slot_count slot headers and then slot_count
+    slots of slot_size bytes each, starting at data_offset.  Block n is
+    stored in slot n % slot_count, and write_index is the number of blocks
+    published so far.
+
+    The writer never waits for readers.  To read block n in place, a reader
+    loads the slot's sequence, uses the data, then loads the sequence again.
+    The data is valid if both loads returned n + 1; any other value means the
+    writer lapped the reader while it was reading. */
+struct shm_ring_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t format;
+    uint32_t samp_rate;
+    uint32_t slot_count;
+    uint64_t slot_samples;
+    uint64_t slot_size;
+    uint64_t data_offset;
+    _Atomic uint64_t write_index;
+};
+
+struct shm_slot_header
+{
+    _Atomic uint64_t sequence;
+    uint64_t sample;
+    uint64_t samples;
+};
+
+/** Create a shared memory ring with the given name and slot_count slots of iq_len samples.  Returns 0 on success or -1 on error. */
+int shm_init(const char *name, enum iq_format format, long samp_rate, long iq_len, int slot_count);
+
+/** Publish a block into the next slot, pacing the writer to the sampling rate. */
+void shm_publish(complex *iq, long iq_len);
+
+/** Unmap and remove the shared memory ring. */
+void shm_shutdown();
+
+#endif /* !FILE_SHM_H_SEEN */
@@ -0,0 +1,57 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File tables.h */
+#ifndef FILE_TABLES_H_SEEN
+#define FILE_TABLES_H_SEEN
+
+#include "../config.h"
+#include "arena.h"
+
+#include <stdint.h>
+
+/* Entries in one period of the oscillator table, a power of two */
+#define OSC_TABLE_LEN 4096
+
+/* Morse codes are packed with the number of elements in the low 4 bits and
+   the elements above them, the first in bit 4, with a dah as a 1 */
+#define MORSE_LEN(code) ((code) & 0xF)
+#define MORSE_IS_DAH(code, element) (((code) >> (4 + (element))) & 1)
+
+/* The code for a space between words; 0 means the character has no code */
+#define MORSE_WORD_SPACE 0xF
+
+/* Layers of the ziggurat for normally distributed noise, and where its base starts */
+#define ZIG_LAYERS 128
+#define ZIG_R 3.442619855899
+
+/** sin() over one period, with the first entry repeated at the end so neighbours can be interpolated. */
+extern const double osc_sin_table[OSC_TABLE_LEN + 1];
+
+/** Morse code for every byte value, generated from the table in gentables.c. */
+extern const uint16_t morse_table[256];
+
+/** Ziggurat tables for a standard normal (Marsaglia and Tsang): the accept limits for a 32 bit signed draw, the layer widths, and the density at each layer. */
+extern const uint32_t zig_k[ZIG_LAYERS];
+extern const double zig_w[ZIG_LAYERS];
+extern const double zig_f[ZIG_LAYERS];
+
+#endif /* !FILE_TABLES_H_SEEN */
@@ -0,0 +1,495 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "tee.h"
+#include "arena.h"
+#include "net.h"
+#include "shm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/** A rendered block, shared by the sinks that still have it queued. */
+struct tee_block
+{
+    struct arena *arena;
+    complex *iq;
+    long capacity;
+    long len;
+    atomic_int refs;
+};
+
+struct tee_sink
+{
+    struct tee_sink_params params;
+    struct tee *tee;
+    FILE *file;
+    void *packed;
+    long packed_len;
+
+    // A ring of queued blocks, the oldest at head
+    struct tee_block **queue;
+    int head;
+    int count;
+    bool closing;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_t thread;
+    bool running;
+
+    unsigned long long written;
+    unsigned long long dropped;
+};
+
+struct tee
+{
+    struct tee_sink sinks[TEE_MAX_SINKS];
+    int sink_count;
+    enum iq_format format;
+    bool hugepages;
+
+    // Each sink holds at most its queue plus the block it is writing, so
+    // one more block than that is always free for the transmitter
+    struct tee_block *blocks;
+    int block_count;
+    int current;
+};
+
+/** Free the copied target of a sink that did not parse.  Returns -1. */
+static int parse_error(struct tee_sink_params *params)
+{
+    free(params->target);
+    params->target = NULL;
+    return -1;
+}
+
+int tee_parse(struct tee_sink_params *params, const char *spec)
+{
+    params->queue = TEE_DEFAULT_QUEUE;
+    params->drop = TEE_DROP_NEWEST;
+
+    const char *target = strchr(spec, ':');
+    if (target == NULL)
+    {
+        return -1;
+    }
+    if (strncmp(spec, "file", target - spec) == 0 && target - spec == 4)
+    {
+        params->kind = TEE_FILE;
+    }
+    else if (strncmp(spec, "net", target - spec) == 0 && target - spec == 3)
+    {
+        params->kind = TEE_NET;
+    }
+    else if (strncmp(spec, "shm", target - spec) == 0 && target - spec == 3)
+    {
+        params->kind = TEE_SHM;
+    }
+    else
+    {
+        return -1;
+    }
+
+    params->target = strdup(target + 1);
+    if (params->target == NULL)
+    {
+        return -1;
+    }
+    char *setting = strchr(params->target, ',');
+    if (setting != NULL)
+    {
+        *setting++ = '\0';
+    }
+    while (setting != NULL)
+    {
+        char *next = strchr(setting, ',');
+        if (next != NULL)
+        {
+            *next++ = '\0';
+        }
+        if (strncmp(setting, "queue=", 6) == 0)
+        {
+            params->queue = atoi(setting + 6);
+        }
+        else if (strcmp(setting, "drop=newest") == 0)
+        {
+            params->drop = TEE_DROP_NEWEST;
+        }
+        else if (strcmp(setting, "drop=oldest") == 0)
+        {
+            params->drop = TEE_DROP_OLDEST;
+        }
+        else
+        {
+            return parse_error(params);
+        }
+        setting = next;
+    }
+    return params->queue > 0 && params->target[0] != '\0' ? 0 : parse_error(params);
+}
+
+const char *tee_kind_name(enum tee_kind kind)
+{
+    switch (kind)
+    {
+    case TEE_NET:
+        return "Network";
+    case TEE_SHM:
+        return "Shared Memory";
+    default:
+        return "File";
+    }
+}
+
+/** Drop a reference to a block, freeing it for the transmitter once no sink has it. */
+static void release_block(struct tee_block *block)
+{
+    atomic_fetch_sub_explicit(&block->refs, 1, memory_order_release);
+}
+
+/** Write one block out to the sink.  Returns 0 on success or -1 on error. */
+static int write_block(struct tee_sink *sink, struct tee_block *block)
+{
+    switch (sink->params.kind)
+    {
+    case TEE_NET:
+        return net_send(block->iq, block->len) < 0 ? -1 : 0;
+    case TEE_SHM:
+        shm_publish(block->iq, block->len);
+        return 0;
+    default:
+        break;
+    }
+
+    // The packed copy lives in the sink so the block is only ever read
+    size_t sample_size = iq_sample_size(sink->tee->format);
+    if (block->len > sink->packed_len)
+    {
+        free(sink->packed);
+        sink->packed = malloc(sample_size * block->len);
+        sink->packed_len = sink->packed == NULL ? 0 : block->len;
+        if (sink->packed == NULL)
+        {
+            return -1;
+        }
+    }
+    pack_iq(sink->tee->format, sink->packed, block->iq, block->len);
+    return fwrite(sink->packed, sample_size, block->len, sink->file) == (size_t)block->len ? 0 : -1;
+}
+
+/** Open a file sink, failing rather than waiting if it is a FIFO with no reader.  Returns 0 on success or -1 on error. */
+static int open_file(struct tee_sink *sink)
+{
+    if (strcmp(sink->params.target, "-") == 0)
+    {
+        sink->file = stdout;
+        return 0;
+    }
+    int fd = open(sink->params.target, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0666);
+    if (fd < 0)
+    {
+        if (errno == ENXIO)
+        {
+            fprintf(stderr, "Error: %s is a FIFO with no reader, start the reader first\n", sink->params.target);
+        }
+        else
+        {
+            fprintf(stderr, "Error: Could not open %s: ", sink->params.target);
+            perror(NULL);
+        }
+        return -1;
+    }
+
+    // Only the open is non-blocking, the sink thread's writes wait as usual
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    sink->file = fdopen(fd, "wb");
+    if (sink->file == NULL)
+    {
+        perror("Error: Could not open the sink stream");
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void *sink_thread(void *arg)
+{
+    struct tee_sink *sink = arg;
+
+    pthread_mutex_lock(&sink->lock);
+    while (true)
+    {
+        while (sink->count == 0 && !sink->closing)
+        {
+            pthread_cond_wait(&sink->ready, &sink->lock);
+        }
+        if (sink->count == 0)
+        {
+            break;
+        }
+        struct tee_block *block = sink->queue[sink->head];
+        sink->head = (sink->head + 1) % sink->params.queue;
+        sink->count--;
+        bool failed = sink->failed;
+        pthread_mutex_unlock(&sink->lock);
+
+        if (!failed && write_block(sink, block) < 0)
+        {
+            fprintf(stderr, "Error: Could not write to %s, dropping its blocks\n", sink->params.target);
+            failed = true;
+        }
+        release_block(block);
+
+        pthread_mutex_lock(&sink->lock);
+        sink->failed = failed;
+        if (failed)
+        {
+            sink->dropped++;
+        }
+        else
+        {
+            sink->written++;
+        }
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+/** Stop the sink threads and free everything, reporting the sinks' counters if asked. */
+static void close_tee(struct tee *tee, bool report)
+{
+    for (int index = 0; index < tee->sink_count; index++)
+    {
+        struct tee_sink *sink = &tee->sinks[index];
+        if (sink->running)
+        {
+            pthread_mutex_lock(&sink->lock);
+            sink->closing = true;
+            pthread_cond_signal(&sink->ready);
+            pthread_mutex_unlock(&sink->lock);
+            pthread_join(sink->thread, NULL);
+        }
+    }
+    if (report)
+    {
+        tee_print_stats(tee, stderr);
+    }
+    for (int index = 0; index < tee->sink_count; index++)
+    {
+        struct tee_sink *sink = &tee->sinks[index];
+        // Sinks that never started have nothing to report at exit either
+        if (!report && sink->params.kind == TEE_NET)
+        {
+            net_close();
+        }
+        if (!report && sink->params.kind == TEE_SHM)
+        {
+            shm_shutdown();
+        }
+        if (sink->file != NULL)
+        {
+            fflush(sink->file);
+            if (sink->file != stdout)
+            {
+                fclose(sink->file);
+            }
+        }
+        pthread_mutex_destroy(&sink->lock);
+        pthread_cond_destroy(&sink->ready);
+        free(sink->queue);
+        free(sink->packed);
+    }
+    for (int index = 0; index < tee->block_count; index++)
+    {
+        if (tee->blocks[index].arena != NULL)
+        {
+            arena_destroy(tee->blocks[index].arena);
+        }
+    }
+    free(tee->blocks);
+    free(tee);
+}
+
+struct tee *tee_create(const struct tee_sink_params *sinks, int sink_count, enum iq_format format, long samp_rate,
+                       long iq_len, int shm_slots, bool hugepages)
+{
+    struct tee *tee = calloc(1, sizeof(struct tee));
+    if (tee == NULL)
+    {
+        return NULL;
+    }
+    tee->format = format;
+    tee->hugepages = hugepages;
+    tee->current = -1;
+
+    tee->block_count = 1;
+    for (int index = 0; index < sink_count; index++)
+    {
+        tee->block_count += sinks[index].queue + 1;
+    }
+    tee->blocks = calloc(tee->block_count, sizeof(struct tee_block));
+    if (tee->blocks == NULL)
+    {
+        free(tee);
+        return NULL;
+    }
+    for (int index = 0; index < tee->block_count; index++)
+    {
+        atomic_init(&tee->blocks[index].refs, 0);
+    }
+
+    for (int index = 0; index < sink_count; index++)
+    {
+        struct tee_sink *sink = &tee->sinks[index];
+        sink->params = sinks[index];
+        sink->tee = tee;
+        sink->queue = calloc(sink->params.queue, sizeof(struct tee_block *));
+        if (sink->queue == NULL)
+        {
+            close_tee(tee, false);
+            return NULL;
+        }
+        pthread_mutex_init(&sink->lock, NULL);
+        pthread_cond_init(&sink->ready, NULL);
+        tee->sink_count++;
+
+        if (sink->params.kind == TEE_NET && net_init(sink->params.target, format, samp_rate, iq_len) < 0)
+        {
+            close_tee(tee, false);
+            return NULL;
+        }
+        if (sink->params.kind == TEE_SHM && shm_init(sink->params.target, format, samp_rate, iq_len, shm_slots) < 0)
+        {
+            close_tee(tee, false);
+            return NULL;
+        }
+        if (sink->params.kind == TEE_FILE && open_file(sink) < 0)
+        {
+            close_tee(tee, false);
+            return NULL;
+        }
+        if (pthread_create(&sink->thread, NULL, sink_thread, sink) != 0)
+        {
+            close_tee(tee, false);
+            return NULL;
+        }
+        sink->running = true;
+    }
+    return tee;
+}
+
+complex *tee_acquire(struct tee *tee, long len)
+{
+    // Look for a block no sink holds, starting after the last one used
+    struct tee_block *block = NULL;
+    for (int offset = 1; offset <= tee->block_count; offset++)
+    {
+        int index = (tee->current + offset) % tee->block_count;
+        if (atomic_load_explicit(&tee->blocks[index].refs, memory_order_acquire) == 0)
+        {
+            tee->current = index;
+            block = &tee->blocks[index];
+            break;
+        }
+    }
+    if (block == NULL)
+    {
+        // Ruled out by the block count, but never write over a queued block
+        fprintf(stderr, "Error: No free block for the sinks\n");
+        return NULL;
+    }
+
+    if (block->capacity < len)
+    {
+        if (block->arena != NULL)
+        {
+            arena_destroy(block->arena);
+        }
+        block->arena = arena_create(sizeof(complex) * len, tee->hugepages);
+        block->iq = block->arena == NULL ? NULL : arena_alloc(block->arena, sizeof(complex) * len);
+        block->capacity = block->iq == NULL ? 0 : len;
+    }
+    return block->iq;
+}
+
+void tee_publish(struct tee *tee, long len)
+{
+    struct tee_block *block = &tee->blocks[tee->current];
+    block->len = len;
+
+    // The transmitter's own reference keeps the block until every sink has it
+    atomic_store_explicit(&block->refs, 1, memory_order_relaxed);
+    for (int index = 0; index < tee->sink_count; index++)
+    {
+        struct tee_sink *sink = &tee->sinks[index];
+        pthread_mutex_lock(&sink->lock);
+        if (sink->count == sink->params.queue)
+        {
+            sink->dropped++;
+            if (sink->params.drop == TEE_DROP_NEWEST)
+            {
+                pthread_mutex_unlock(&sink->lock);
+                continue;
+            }
+            release_block(sink->queue[sink->head]);
+            sink->head = (sink->head + 1) % sink->params.queue;
+            sink->count--;
+        }
+        atomic_fetch_add_explicit(&block->refs, 1, memory_order_relaxed);
+        sink->queue[(sink->head + sink->count) % sink->params.queue] = block;
+        sink->count++;
+        pthread_cond_signal(&sink->ready);
+        pthread_mutex_unlock(&sink->lock);
+    }
+    release_block(block);
+}
+
+void tee_print_stats(struct tee *tee, FILE *out)
+{
+    for (int index = 0; index < tee->sink_count; index++)
+    {
+        struct tee_sink *sink = &tee->sinks[index];
+        pthread_mutex_lock(&sink->lock);
+        fprintf(out, "Tee: %s %s, Blocks Written: %llu, Dropped: %llu\n", tee_kind_name(sink->params.kind),
+                sink->params.target, sink->written, sink->dropped);
+        pthread_mutex_unlock(&sink->lock);
+    }
+}
+
+void tee_destroy(struct tee *tee)
+{
+    close_tee(tee, true);
+}
+
+void tee_free_params(struct tee_sink_params *sinks, int sink_count)
+{
+    for (int index = 0; index < sink_count; index++)
+    {
+        free(sinks[index].target);
+        sinks[index].target = NULL;
+    }
+}
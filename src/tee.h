@@ -0,0 +1,96 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/* File tee.h */
+#ifndef FILE_TEE_H_SEEN
+#define FILE_TEE_H_SEEN
+
+#include "../config.h"
+#include "iq.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <complex.h>
+
+/* Most sinks fed alongside the device */
+#define TEE_MAX_SINKS 4
+
+/* Blocks a sink can fall behind by unless set */
+#define TEE_DEFAULT_QUEUE 32
+
+enum tee_kind
+{
+    TEE_FILE,
+    TEE_NET,
+    TEE_SHM
+};
+
+/** What a sink does with a new block when its queue is full. */
+enum tee_drop
+{
+    TEE_DROP_NEWEST,
+    TEE_DROP_OLDEST
+};
+
+/** A sink that gets a copy of every block sent to the device.  Parsed from "kind:target[,queue=N][,drop=newest|oldest]". */
+struct tee_sink_params
+{
+    enum tee_kind kind;
+    char *target;
+    int queue;
+    enum tee_drop drop;
+};
+
+/** Sends each rendered block to several sinks without copying it.
+
+    Blocks come from a shared set of reference counted buffers.  The
+    transmitter renders into a free buffer, sends it to the device and then
+    hands it to every sink's queue, each of which holds a reference until its
+    thread has written the block out.  A sink that falls behind drops blocks
+    from its own queue instead of holding up the transmitter, and there are
+    always enough buffers that one is free for the next render. */
+struct tee;
+
+/** Parse a sink.  Returns 0 on success or -1 on error. */
+int tee_parse(struct tee_sink_params *params, const char *spec);
+
+/** Returns the name of a kind of sink. */
+const char *tee_kind_name(enum tee_kind kind);
+
+/** Open the sinks and start their threads.  Returns NULL on error. */
+struct tee *tee_create(const struct tee_sink_params *sinks, int sink_count, enum iq_format format, long samp_rate,
+                       long iq_len, int shm_slots, bool hugepages);
+
+/** Returns a free buffer of at least len samples to render the next block into. */
+complex *tee_acquire(struct tee *tee, long len);
+
+/** Hand the block last returned by tee_acquire() to every sink. */
+void tee_publish(struct tee *tee, long len);
+
+/** Print how many blocks each sink wrote and dropped. */
+void tee_print_stats(struct tee *tee, FILE *out);
+
+/** Write out what the sinks have queued, stop their threads and free the buffers. */
+void tee_destroy(struct tee *tee);
+
+/** Free the targets copied by tee_parse(). */
+void tee_free_params(struct tee_sink_params *sinks, int sink_count);
+
+#endif /* !FILE_TEE_H_SEEN */
@@ -0,0 +1,257 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "tune.h"
+
+/* Shortest measurement window in seconds and in blocks */
+#define TUNE_WINDOW_SECONDS 2.0
+#define TUNE_WINDOW_BLOCKS 16
+
+/* A push that waits longer than this fraction of a block means the kernel queue was full */
+#define TUNE_FULL_WAIT 0.05
+
+void queue_model_init(struct queue_model *model, int kernel_buffers)
+{
+    model->level = kernel_buffers;
+}
+
+bool queue_model_update(struct queue_model *model, int kernel_buffers, double period, double busy_time, double push_time)
+{
+    bool underrun = false;
+
+    if (push_time > period * TUNE_FULL_WAIT)
+    {
+        // Waiting for room means the queue was full when this block went in
+        model->level = kernel_buffers;
+        return false;
+    }
+
+    model->level -= (busy_time + push_time) / period;
+    if (model->level < 0)
+    {
+        underrun = true;
+        model->level = 0;
+    }
+    model->level += 1;
+    if (model->level > kernel_buffers)
+    {
+        model->level = kernel_buffers;
+    }
+    return underrun;
+}
+
+static double block_duration(const struct tune_state *state)
+{
+    return (double)state->iq_len / state->samp_rate;
+}
+
+static void start_window(struct tune_state *state)
+{
+    double blocks_length = TUNE_WINDOW_BLOCKS * block_duration(state);
+    state->window_length = blocks_length > TUNE_WINDOW_SECONDS ? blocks_length : TUNE_WINDOW_SECONDS;
+    state->elapsed = 0;
+    state->busy = 0;
+    state->blocks = 0;
+    state->underruns = 0;
+    queue_model_init(&state->queue, state->kernel_buffers);
+}
+
+void tune_init(struct tune_state *state, long samp_rate, long iq_len, int kernel_buffers, double target_rate)
+{
+    state->phase = TUNE_GROW;
+    state->samp_rate = samp_rate;
+    state->iq_len = iq_len;
+    state->kernel_buffers = kernel_buffers;
+    state->good_iq_len = iq_len;
+    state->good_kernel_buffers = kernel_buffers;
+    state->have_good = false;
+    state->grown = false;
+    state->target_rate = target_rate;
+    start_window(state);
+}
+
+double tune_latency(const struct tune_state *state)
+{
+    return block_duration(state) * state->kernel_buffers;
+}
+
+static void settle(struct tune_state *state)
+{
+    if (state->have_good)
+    {
+        state->iq_len = state->good_iq_len;
+        state->kernel_buffers = state->good_kernel_buffers;
+    }
+    state->phase = TUNE_SETTLED;
+}
+
+/** Move to the next lower latency setting to try.  Returns false if there is none. */
+static bool shrink(struct tune_state *state)
+{
+    if (state->phase == TUNE_SHRINK_LEN)
+    {
+        if (state->iq_len / 2 >= TUNE_MIN_IQ_LEN)
+        {
+            state->iq_len /= 2;
+            return true;
+        }
+        state->phase = TUNE_SHRINK_BUFFERS;
+    }
+    if (state->kernel_buffers - 1 >= TUNE_MIN_KERNEL_BUFFERS)
+    {
+        state->kernel_buffers--;
+        return true;
+    }
+    return false;
+}
+
+/** Move to the next higher latency setting to try.  Returns false if there is none. */
+static bool grow(struct tune_state *state, double busy_fraction)
+{
+    bool longer = state->iq_len * 2 <= TUNE_MAX_IQ_LEN;
+    bool more = state->kernel_buffers + 1 <= TUNE_MAX_KERNEL_BUFFERS;
+
+    // Rendering that takes most of the block period needs longer blocks to
+    // amortize the per-push overhead; otherwise more buffers absorb jitter.
+    if (longer && (busy_fraction > TUNE_BUSY_LIMIT || !more))
+    {
+        state->iq_len *= 2;
+        return true;
+    }
+    if (more)
+    {
+        state->kernel_buffers++;
+        return true;
+    }
+    return false;
+}
+
+/** Decide on the next settings at the end of a measurement window.  Returns true if they changed. */
+static bool evaluate(struct tune_state *state)
+{
+    long iq_len = state->iq_len;
+    int kernel_buffers = state->kernel_buffers;
+    double rate = state->underruns / state->elapsed;
+    double busy_fraction = state->busy / state->elapsed;
+    bool ok = rate <= state->target_rate;
+
+#ifdef DEBUG
+    fprintf(stderr, "Tune: Buffer Length: %ld, Kernel Buffers: %d, Underruns: %ld, Busy: %0.1f%%\n",
+            iq_len, kernel_buffers, state->underruns, busy_fraction * 100);
+#endif
+
+    if (ok)
+    {
+        state->have_good = true;
+        state->good_iq_len = iq_len;
+        state->good_kernel_buffers = kernel_buffers;
+    }
+
+    switch (state->phase)
+    {
+    case TUNE_GROW:
+        if (!ok)
+        {
+            if (!grow(state, busy_fraction))
+            {
+                fprintf(stderr, "Auto-tune: Underruns persist at the largest settings\n");
+                state->phase = TUNE_SETTLED;
+            }
+            state->grown = true;
+        }
+        else if (state->grown)
+        {
+            // Anything smaller already underran
+            settle(state);
+        }
+        else
+        {
+            state->phase = TUNE_SHRINK_LEN;
+            if (!shrink(state))
+            {
+                settle(state);
+            }
+        }
+        break;
+    case TUNE_SHRINK_LEN:
+    case TUNE_SHRINK_BUFFERS:
+        if (!ok)
+        {
+            state->iq_len = state->good_iq_len;
+            state->kernel_buffers = state->good_kernel_buffers;
+            if (state->phase == TUNE_SHRINK_LEN)
+            {
+                state->phase = TUNE_SHRINK_BUFFERS;
+                if (!shrink(state))
+                {
+                    settle(state);
+                }
+            }
+            else
+            {
+                settle(state);
+            }
+        }
+        else if (!shrink(state))
+        {
+            settle(state);
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (state->phase == TUNE_SETTLED)
+    {
+        fprintf(stderr, "Auto-tune: Buffer Length: %ld, Kernel Buffers: %d, Latency: %0.3f ms\n",
+                state->iq_len, state->kernel_buffers, tune_latency(state) * 1000);
+    }
+
+    start_window(state);
+    return iq_len != state->iq_len || kernel_buffers != state->kernel_buffers;
+}
+
+bool tune_update(struct tune_state *state, double busy_time, double push_time)
+{
+    if (state->phase == TUNE_SETTLED)
+    {
+        return false;
+    }
+
+    double period = block_duration(state);
+    double cycle = busy_time + push_time;
+
+    state->blocks++;
+    state->elapsed += cycle;
+    state->busy += busy_time;
+
+    if (queue_model_update(&state->queue, state->kernel_buffers, period, busy_time, push_time))
+    {
+        state->underruns++;
+    }
+
+    // The first blocks only fill the queue, so don't judge a short window
+    if (state->elapsed < state->window_length || state->blocks <= state->kernel_buffers)
+    {
+        return false;
+    }
+    return evaluate(state);
+}
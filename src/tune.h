@@ -0,0 +1,104 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File tune.h */
+#ifndef FILE_TUNE_H_SEEN
+#define FILE_TUNE_H_SEEN
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Smallest and largest settings the tuner will try */
+#define TUNE_MIN_IQ_LEN 1024
+#define TUNE_MAX_IQ_LEN 1048576
+#define TUNE_MIN_KERNEL_BUFFERS 2
+#define TUNE_MAX_KERNEL_BUFFERS 16
+
+/* Fraction of each block period spent rendering above which larger blocks are tried before more buffers */
+#define TUNE_BUSY_LIMIT 0.8
+
+/** Estimates how full the kernel TX queue is from block timings.
+
+    A push that has to wait means the kernel queue was full.  Otherwise the
+    queue is assumed to drain by the time between pushes and fill by one
+    block per push.  An underrun is counted whenever it runs dry. */
+struct queue_model
+{
+    double level;
+};
+
+/** Start with a full queue. */
+void queue_model_init(struct queue_model *model, int kernel_buffers);
+
+/** Record one block of the given period.  Returns true if the queue is estimated to have underrun. */
+bool queue_model_update(struct queue_model *model, int kernel_buffers, double period, double busy_time, double push_time);
+
+enum tune_phase
+{
+    TUNE_GROW,
+    TUNE_SHRINK_LEN,
+    TUNE_SHRINK_BUFFERS,
+    TUNE_SETTLED
+};
+
+/** Searches for the smallest buffer length and kernel buffer count that hold a target underrun rate.
+
+    Each block is timed as the time spent rendering and filling it, plus the
+    time spent waiting for the device to accept it, and underruns are
+    estimated with a queue_model.
+
+    The tuner starts from the configured settings.  If they underrun, it grows
+    the block length (when rendering is the bottleneck) or the buffer count
+    (when timing jitter is).  Otherwise it halves the block length and then
+    drops buffers one at a time, keeping the last settings that held. */
+struct tune_state
+{
+    enum tune_phase phase;
+    long samp_rate;
+    long iq_len;
+    int kernel_buffers;
+    long good_iq_len;
+    int good_kernel_buffers;
+    bool have_good;
+    bool grown;
+    double target_rate;
+
+    // Current measurement window
+    double window_length;
+    double elapsed;
+    double busy;
+    struct queue_model queue;
+    long blocks;
+    long underruns;
+};
+
+/** Start tuning from the given settings, allowing target_rate underruns per second. */
+void tune_init(struct tune_state *state, long samp_rate, long iq_len, int kernel_buffers, double target_rate);
+
+/** Record one block.  Returns true if iq_len or kernel_buffers changed and the buffer needs to be recreated. */
+bool tune_update(struct tune_state *state, double busy_time, double push_time);
+
+/** Returns the output latency of the current settings in seconds. */
+double tune_latency(const struct tune_state *state);
+
+#endif /* !FILE_TUNE_H_SEEN */
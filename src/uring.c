@@ -0,0 +1,222 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "uring.h"
+
+struct uring_block
+{
+    void *data;
+    long len;
+    long done;
+    off_t offset;
+    bool busy;
+};
+
+static struct io_uring ring;
+static struct uring_block *blocks;
+static int depth;
+static int next_block;
+static int in_flight;
+static int out_fd = -1;
+static bool seekable;
+static bool failed;
+static off_t next_offset;
+
+/** Report an error, after which shutdown no longer waits for writes in flight. */
+static void report_failure(const char *message, int err)
+{
+    fprintf(stderr, "Error: %s: %s\n", message, strerror(err));
+    failed = true;
+}
+
+static void uring_fail(const char *message, int err)
+{
+    report_failure(message, err);
+    beacon_exit(1);
+}
+
+static void queue_write(int index)
+{
+    struct uring_block *block = &blocks[index];
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    if (!sqe)
+    {
+        uring_fail("Could not get io_uring submission entry", EBUSY);
+    }
+
+    // Pipes and sockets ignore the offset and have no ordering between
+    // concurrent writes, so each one waits for the previous to finish.
+    // Regular files are written at explicit offsets and can all be in flight.
+    __u64 offset = seekable ? (__u64)(block->offset + block->done) : (__u64)-1;
+    io_uring_prep_write_fixed(sqe, out_fd, (char *)block->data + block->done,
+                              block->len - block->done, offset, index);
+    io_uring_sqe_set_data(sqe, (void *)(intptr_t)index);
+    if (!seekable)
+    {
+        io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+    }
+
+    int ret = io_uring_submit(&ring);
+    if (ret < 0)
+    {
+        uring_fail("Could not submit io_uring write", -ret);
+    }
+}
+
+/** Wait for one completion and return its buffer to the free list. */
+static void reap_completion()
+{
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_wait_cqe(&ring, &cqe);
+    if (ret < 0)
+    {
+        uring_fail("Could not wait for io_uring completion", -ret);
+    }
+
+    int index = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+
+    struct uring_block *block = &blocks[index];
+    if (res < 0)
+    {
+        uring_fail("Could not write IQ data", -res);
+    }
+
+    block->done += res;
+    if (block->done < block->len)
+    {
+        if (!seekable || res == 0)
+        {
+            // A short write to a pipe can't be resumed without reordering
+            // the blocks queued behind it.
+            uring_fail("Short write of IQ data", EIO);
+        }
+#ifdef DEBUG
+        fprintf(stderr, "Resubmit short write, block: %d, done: %ld, len: %ld\n", index, block->done, block->len);
+#endif
+        queue_write(index);
+        return;
+    }
+
+    block->busy = false;
+    in_flight--;
+}
+
+int uring_init(int fd, long block_len, int queue_depth)
+{
+    struct stat st;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    out_fd = fd;
+    depth = queue_depth;
+    next_block = 0;
+    in_flight = 0;
+    seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    next_offset = seekable ? lseek(fd, 0, SEEK_CUR) : 0;
+    if (next_offset < 0)
+    {
+        next_offset = 0;
+    }
+
+    int ret = io_uring_queue_init(depth, &ring, 0);
+    if (ret < 0)
+    {
+        report_failure("Could not create io_uring", -ret);
+        return -1;
+    }
+
+    blocks = calloc(depth, sizeof(struct uring_block));
+    struct iovec *iovecs = calloc(depth, sizeof(struct iovec));
+    for (int index = 0; index < depth; index++)
+    {
+        if (posix_memalign(&blocks[index].data, page_size, block_len) != 0)
+        {
+            report_failure("Could not allocate io_uring buffer", ENOMEM);
+            free(iovecs);
+            return -1;
+        }
+        iovecs[index].iov_base = blocks[index].data;
+        iovecs[index].iov_len = block_len;
+    }
+
+    // Registering the buffers pins them once up front instead of on every write
+    ret = io_uring_register_buffers(&ring, iovecs, depth);
+    free(iovecs);
+    if (ret < 0)
+    {
+        report_failure("Could not register io_uring buffers", -ret);
+        return -1;
+    }
+    return 0;
+}
+
+void *uring_get_buffer()
+{
+    while (blocks[next_block].busy)
+    {
+        reap_completion();
+    }
+    return blocks[next_block].data;
+}
+
+void uring_submit(void *buf, long len)
+{
+    int index = next_block;
+    struct uring_block *block = &blocks[index];
+    assert(buf == block->data);
+
+    block->len = len;
+    block->done = 0;
+    block->offset = next_offset;
+    block->busy = true;
+    next_offset += len;
+    in_flight++;
+    next_block = (next_block + 1) % depth;
+
+    queue_write(index);
+}
+
+void uring_shutdown()
+{
+    if (blocks == NULL)
+    {
+        return;
+    }
+
+    if (!failed)
+    {
+        while (in_flight > 0)
+        {
+            reap_completion();
+        }
+    }
+
+    io_uring_unregister_buffers(&ring);
+    io_uring_queue_exit(&ring);
+
+    for (int index = 0; index < depth; index++)
+    {
+        free(blocks[index].data);
+    }
+    free(blocks);
+    blocks = NULL;
+}
@@ -0,0 +1,55 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* File uring.h */
+#ifndef FILE_URING_H_SEEN
+#define FILE_URING_H_SEEN
+
+#include "../config.h"
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <liburing.h>
+
+/** Set up an io_uring writer for the given file descriptor with queue_depth registered buffers of block_len bytes each.  Returns 0 on success or -1 on error. */
+int uring_init(int fd, long block_len, int queue_depth);
+
+/** Returns the next free registered buffer, waiting for an earlier write to complete if all buffers are in flight. */
+void *uring_get_buffer();
+
+/** Queue a write of len bytes from a buffer returned by uring_get_buffer(). */
+void uring_submit(void *buf, long len);
+
+/** Wait for all queued writes to complete and release the ring. */
+void uring_shutdown();
+
+#endif /* !FILE_URING_H_SEEN */
@@ -0,0 +1,428 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Runs the device setup and fastlock hopping against a stand-in for libiio and libad9361. */
+
+#include "adalm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define TEST_SAMP_RATE 2000000
+#define TEST_TX_FREQ 432320000
+#define TEST_GAIN 10
+/* What adalm_init() writes for TEST_GAIN */
+#define TEST_ATTENUATION -79
+#define TEST_BUF_LEN 4096
+#define TEST_KERNEL_BUFFERS 4
+#define TEST_HOPS 3
+
+static const long hop_freqs[TEST_HOPS] = {432320000, 435000000, 437500000};
+
+/** One channel attribute, with the writes made to it. */
+struct attr
+{
+    const char *name;
+    double value;
+    bool readable;
+    int writes;
+};
+
+#define MAX_ATTRS 4
+
+struct iio_channel
+{
+    const char *name;
+    bool output;
+    struct attr attrs[MAX_ATTRS];
+};
+
+struct iio_device
+{
+    const char *name;
+    struct iio_channel *channels;
+    int channel_count;
+    unsigned int kernel_buffers;
+};
+
+struct iio_context
+{
+    struct iio_device *devices;
+    int device_count;
+};
+
+struct iio_buffer
+{
+    int16_t *data;
+    size_t samples;
+};
+
+static struct iio_channel phy_channels[] = {
+    {"altvoltage0", true, {{"frequency", 0, true, 0}}},
+    {"altvoltage1", true, {{"frequency", 0, true, 0}, {"fastlock_store", 0, false, 0}, {"fastlock_recall", 0, false, 0}}},
+    {"voltage0", true, {{"hardwaregain", 0, true, 0}, {"sampling_frequency", 0, true, 0}}},
+};
+static struct iio_channel tx_channels[] = {{"voltage0", true, {{0}}}, {"voltage1", true, {{0}}}};
+static struct iio_channel rx_channels[] = {{"voltage0", false, {{0}}}, {"voltage1", false, {{0}}}};
+static struct iio_device devices[] = {
+    {"ad9361-phy", phy_channels, 3, 0},
+    {"cf-ad9361-dds-core-lpc", tx_channels, 2, 0},
+    {"cf-ad9361-lpc", rx_channels, 2, 0},
+};
+static struct iio_context context = {devices, 3};
+
+/* Calls to ad9361_set_bb_rate() and the size of the last TX buffer */
+static int rate_writes;
+static size_t buffer_samples;
+
+/* TX LO frequency held by each fastlock profile, 0 if none is stored */
+static double profiles[ADALM_MAX_PROFILES];
+static bool fail_store;
+
+static struct attr *find_attr(const struct iio_channel *chn, const char *name)
+{
+    for (int index = 0; index < MAX_ATTRS && chn->attrs[index].name != NULL; index++)
+    {
+        if (strcmp(chn->attrs[index].name, name) == 0)
+        {
+            return (struct attr *)&chn->attrs[index];
+        }
+    }
+    return NULL;
+}
+
+struct iio_context *iio_create_context_from_uri(const char *uri)
+{
+    if (strcmp(uri, "ip:missing") == 0)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+    return &context;
+}
+
+void iio_context_destroy(struct iio_context *ctx)
+{
+    (void)ctx;
+}
+
+struct iio_device *iio_context_find_device(const struct iio_context *ctx, const char *name)
+{
+    for (int index = 0; index < ctx->device_count; index++)
+    {
+        if (strcmp(ctx->devices[index].name, name) == 0)
+        {
+            return &ctx->devices[index];
+        }
+    }
+    return NULL;
+}
+
+struct iio_channel *iio_device_find_channel(const struct iio_device *dev, const char *name, bool output)
+{
+    for (int index = 0; index < dev->channel_count; index++)
+    {
+        if (strcmp(dev->channels[index].name, name) == 0 && dev->channels[index].output == output)
+        {
+            return &dev->channels[index];
+        }
+    }
+    return NULL;
+}
+
+int iio_channel_attr_read_longlong(const struct iio_channel *chn, const char *name, long long *val)
+{
+    struct attr *attr = find_attr(chn, name);
+    if (attr == NULL || !attr->readable)
+    {
+        return -ENOENT;
+    }
+    *val = (long long)attr->value;
+    return 0;
+}
+
+int iio_channel_attr_read_double(const struct iio_channel *chn, const char *name, double *val)
+{
+    struct attr *attr = find_attr(chn, name);
+    if (attr == NULL || !attr->readable)
+    {
+        return -ENOENT;
+    }
+    *val = attr->value;
+    return 0;
+}
+
+int iio_channel_attr_write_longlong(const struct iio_channel *chn, const char *name, long long val)
+{
+    struct attr *attr = find_attr(chn, name);
+    if (attr == NULL)
+    {
+        return -ENOENT;
+    }
+    // Fastlock profiles save and restore the TX LO without a calibration
+    struct attr *lo = find_attr(chn, "frequency");
+    bool store = strcmp(name, "fastlock_store") == 0;
+    if (store || strcmp(name, "fastlock_recall") == 0)
+    {
+        if (val < 0 || val >= ADALM_MAX_PROFILES || (store && fail_store) || (!store && profiles[val] == 0))
+        {
+            return -EINVAL;
+        }
+        if (store)
+        {
+            profiles[val] = lo->value;
+        }
+        else
+        {
+            lo->value = profiles[val];
+        }
+        attr->writes++;
+        return 0;
+    }
+    attr->value = val;
+    attr->readable = true;
+    attr->writes++;
+    return 0;
+}
+
+int ad9361_set_bb_rate(struct iio_device *dev, unsigned long rate)
+{
+    struct attr *attr = find_attr(iio_device_find_channel(dev, "voltage0", true), "sampling_frequency");
+    attr->value = rate;
+    attr->readable = true;
+    rate_writes++;
+    return 0;
+}
+
+void iio_channel_enable(struct iio_channel *chn)
+{
+    (void)chn;
+}
+
+void iio_channel_disable(struct iio_channel *chn)
+{
+    (void)chn;
+}
+
+int iio_device_set_kernel_buffers_count(const struct iio_device *dev, unsigned int nb_buffers)
+{
+    ((struct iio_device *)dev)->kernel_buffers = nb_buffers;
+    return 0;
+}
+
+struct iio_buffer *iio_device_create_buffer(const struct iio_device *dev, size_t samples_count, bool cyclic)
+{
+    (void)dev;
+    (void)cyclic;
+    struct iio_buffer *buf = malloc(sizeof(struct iio_buffer));
+    buf->data = calloc(samples_count * 2, sizeof(int16_t));
+    buf->samples = samples_count;
+    buffer_samples = samples_count;
+    return buf;
+}
+
+void iio_buffer_destroy(struct iio_buffer *buf)
+{
+    free(buf->data);
+    free(buf);
+}
+
+ssize_t iio_buffer_push(struct iio_buffer *buf)
+{
+    return buf->samples * 2 * sizeof(int16_t);
+}
+
+ssize_t iio_buffer_refill(struct iio_buffer *buf)
+{
+    return buf->samples * 2 * sizeof(int16_t);
+}
+
+void *iio_buffer_first(const struct iio_buffer *buf, const struct iio_channel *chn)
+{
+    (void)chn;
+    return buf->data;
+}
+
+ptrdiff_t iio_buffer_step(const struct iio_buffer *buf)
+{
+    (void)buf;
+    return 2 * sizeof(int16_t);
+}
+
+void *iio_buffer_end(const struct iio_buffer *buf)
+{
+    return buf->data + buf->samples * 2;
+}
+
+int iio_buffer_get_poll_fd(struct iio_buffer *buf)
+{
+    (void)buf;
+    return -1;
+}
+
+int iio_buffer_set_blocking_mode(struct iio_buffer *buf, bool blocking)
+{
+    (void)buf;
+    (void)blocking;
+    return 0;
+}
+
+void beacon_exit(int code)
+{
+    fprintf(stderr, "Error: beacon_exit(%d) was called\n", code);
+    exit(1);
+}
+
+/** Put the device in a known state and clear the write counts. */
+static void reset_device(double freq, double attenuation, double rate, bool readable)
+{
+    double values[] = {0, freq, attenuation, rate};
+    struct attr *attrs[] = {&phy_channels[0].attrs[0], &phy_channels[1].attrs[0], &phy_channels[2].attrs[0], &phy_channels[2].attrs[1]};
+    for (int index = 0; index < 4; index++)
+    {
+        attrs[index]->value = values[index];
+        attrs[index]->readable = readable;
+        attrs[index]->writes = 0;
+    }
+    rate_writes = 0;
+    buffer_samples = 0;
+    devices[1].kernel_buffers = 0;
+}
+
+/** Set the device up and check which settings were written and what they hold.  Returns the number of failures. */
+static int check_init(const char *name, int wanted_writes)
+{
+    int failures = 0;
+    if (adalm_init("ip:test", TEST_SAMP_RATE, TEST_GAIN, TEST_TX_FREQ, TEST_BUF_LEN, TEST_KERNEL_BUFFERS) < 0)
+    {
+        fprintf(stderr, "%s: Setup failed\n", name);
+        return 1;
+    }
+    struct attr *freq = &phy_channels[1].attrs[0];
+    struct attr *gain = &phy_channels[2].attrs[0];
+    struct attr *rate = &phy_channels[2].attrs[1];
+    if (freq->writes != wanted_writes || gain->writes != wanted_writes || rate_writes != wanted_writes)
+    {
+        fprintf(stderr, "%s: Wrote the frequency %d, gain %d and sampling rate %d times, expected %d\n",
+                name, freq->writes, gain->writes, rate_writes, wanted_writes);
+        failures++;
+    }
+    if (freq->value != TEST_TX_FREQ || gain->value != TEST_ATTENUATION || rate->value != TEST_SAMP_RATE)
+    {
+        fprintf(stderr, "%s: Left %0.0f Hz, %0.2f dB, %0.0f samples/s\n", name, freq->value, gain->value, rate->value);
+        failures++;
+    }
+    if (buffer_samples != TEST_BUF_LEN || devices[1].kernel_buffers != TEST_KERNEL_BUFFERS)
+    {
+        fprintf(stderr, "%s: TX buffer of %zu samples in %u kernel buffers\n", name, buffer_samples, devices[1].kernel_buffers);
+        failures++;
+    }
+    adalm_shutdown();
+    printf("%s: %s\n", name, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/** A context that can't be created is reported to the caller instead of exiting. */
+static int check_no_context(void)
+{
+    int failures = adalm_init("ip:missing", TEST_SAMP_RATE, TEST_GAIN, TEST_TX_FREQ, TEST_BUF_LEN, 0) == -1 ? 0 : 1;
+    printf("No context: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/** Store a profile per hop, then hop through them as the streaming loop does.  Returns the number of failures. */
+static int check_fastlock(void)
+{
+    int failures = 0;
+    reset_device(TEST_TX_FREQ, TEST_ATTENUATION, TEST_SAMP_RATE, true);
+    memset(profiles, 0, sizeof(profiles));
+    if (adalm_init("ip:test", TEST_SAMP_RATE, TEST_GAIN, TEST_TX_FREQ, TEST_BUF_LEN, 0) < 0 ||
+        adalm_store_profiles(hop_freqs, TEST_HOPS) < 0)
+    {
+        fprintf(stderr, "Fastlock: Storing the profiles failed\n");
+        return 1;
+    }
+    struct attr *freq = &phy_channels[1].attrs[0];
+    for (int profile = 0; profile < TEST_HOPS; profile++)
+    {
+        if (profiles[profile] != hop_freqs[profile])
+        {
+            fprintf(stderr, "Fastlock: Profile %d holds %0.0f Hz, expected %ld\n", profile, profiles[profile], hop_freqs[profile]);
+            failures++;
+        }
+    }
+    if (freq->value != hop_freqs[0])
+    {
+        fprintf(stderr, "Fastlock: Started at %0.0f Hz, expected the first hop\n", freq->value);
+        failures++;
+    }
+
+    // Hops recall the stored calibration rather than writing the frequency again
+    int writes = freq->writes;
+    int hop = 0;
+    for (int count = 0; count < TEST_HOPS * 2; count++)
+    {
+        int next = (hop + 1) % TEST_HOPS;
+        if (adalm_recall_profile(next) < 0 || freq->value != hop_freqs[next])
+        {
+            fprintf(stderr, "Fastlock: Hop %d to profile %d left %0.0f Hz\n", count, next, freq->value);
+            failures++;
+        }
+        hop = next;
+    }
+    if (freq->writes != writes)
+    {
+        fprintf(stderr, "Fastlock: Hopping wrote the frequency %d times\n", freq->writes - writes);
+        failures++;
+    }
+    if (adalm_recall_profile(TEST_HOPS) >= 0)
+    {
+        fprintf(stderr, "Fastlock: Recalling a profile that was never stored succeeded\n");
+        failures++;
+    }
+
+    // A failed store is reported to the caller instead of exiting
+    fail_store = true;
+    if (adalm_store_profiles(hop_freqs, TEST_HOPS) >= 0)
+    {
+        fprintf(stderr, "Fastlock: A failed store was not reported\n");
+        failures++;
+    }
+    fail_store = false;
+    adalm_shutdown();
+    printf("Fastlock: %s\n", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    reset_device(TEST_TX_FREQ, TEST_ATTENUATION, TEST_SAMP_RATE, true);
+    failures += check_init("Unchanged settings", 0);
+    reset_device(TEST_TX_FREQ + 1000000, TEST_ATTENUATION - 10, TEST_SAMP_RATE / 2, true);
+    failures += check_init("Changed settings", 1);
+    reset_device(TEST_TX_FREQ, TEST_ATTENUATION, TEST_SAMP_RATE, false);
+    failures += check_init("Unreadable settings", 1);
+    failures += check_no_context();
+    failures += check_fastlock();
+    return failures == 0 ? 0 : 1;
+}
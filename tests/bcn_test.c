@@ -0,0 +1,136 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Checks that a .bcn file gives back the samples written to it, read in order and after seeking. */
+
+#include "bcn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SAMP_RATE 200000
+#define TEST_SECONDS 6
+#define TEST_SEEKS 200
+
+/** Write one rendered message to a .bcn file and read it back.  Returns the number of failures. */
+static int round_trip(enum iq_format format, enum modulation modulation)
+{
+    struct beacon_params params = {
+        .samp_rate = TEST_SAMP_RATE,
+        .carrier_freq = 10000,
+        .tone_freq = 800,
+        .wpm = 30,
+        .message = "VVV DE NU8W",
+        .padding = 1,
+        .modulation = modulation,
+        .modulation_index = 500,
+    };
+    long len = TEST_SAMP_RATE * TEST_SECONDS;
+    size_t sample_size = iq_sample_size(format);
+    unsigned char *rendered = malloc(sample_size * len);
+    unsigned char *decoded = malloc(sample_size * len);
+    struct beacon *ctx = beacon_create(&params);
+    FILE *file = tmpfile();
+    if (rendered == NULL || decoded == NULL || ctx == NULL || file == NULL)
+    {
+        fprintf(stderr, "Error: Could not set up the test\n");
+        exit(1);
+    }
+    beacon_render(ctx, rendered, len, format);
+    beacon_destroy(ctx);
+
+    int failures = 0;
+    struct bcn_writer *writer = bcn_create(file, format, TEST_SAMP_RATE);
+    if (writer == NULL || bcn_write(writer, rendered, len) < 0 || bcn_close(writer) < 0)
+    {
+        fprintf(stderr, "%s: Could not write the file\n", iq_format_name(format));
+        exit(1);
+    }
+    long written = ftell(file);
+
+    rewind(file);
+    struct bcn_reader *reader = bcn_open(file);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "%s: Could not open the file\n", iq_format_name(format));
+        exit(1);
+    }
+    struct bcn_info info = bcn_reader_info(reader);
+    if (info.format != format || info.samp_rate != TEST_SAMP_RATE || info.samples != (uint64_t)len)
+    {
+        fprintf(stderr, "%s: Header holds the wrong format, rate or length\n", iq_format_name(format));
+        failures++;
+    }
+    long got = 0, read;
+    while (got < len && (read = bcn_read(reader, decoded + sample_size * got, len - got)) > 0)
+    {
+        got += read;
+    }
+    if (got != len || memcmp(rendered, decoded, sample_size * len) != 0)
+    {
+        fprintf(stderr, "%s: Read %ld of %ld samples, or they differ\n", iq_format_name(format), got, len);
+        failures++;
+    }
+
+    // Seek to random samples and read a short run from each
+    srand(format + 1);
+    for (int seek = 0; seek < TEST_SEEKS; seek++)
+    {
+        long sample = rand() % len;
+        long run = len - sample < 5000 ? len - sample : 5000;
+        got = 0;
+        if (bcn_seek(reader, sample) == 0)
+        {
+            while (got < run && (read = bcn_read(reader, decoded + sample_size * got, run - got)) > 0)
+            {
+                got += read;
+            }
+        }
+        if (got != run || memcmp(rendered + sample_size * sample, decoded, sample_size * run) != 0)
+        {
+            fprintf(stderr, "%s: Seek to sample %ld gave the wrong samples\n", iq_format_name(format), sample);
+            failures++;
+            break;
+        }
+    }
+    printf("%s %s: %ld samples in %ld bytes (%0.1f%%), %s\n", iq_format_name(format),
+           modulation == MOD_CW ? "CW" : "AM", len, written, 100.0 * written / (sample_size * len),
+           failures == 0 ? "ok" : "FAILED");
+
+    bcn_free(reader);
+    fclose(file);
+    free(decoded);
+    free(rendered);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    enum iq_format formats[] = {FORMAT_CI32, FORMAT_CS16, FORMAT_CF32};
+    for (int index = 0; index < 3; index++)
+    {
+        failures += round_trip(formats[index], MOD_CW);
+        failures += round_trip(formats[index], MOD_AM);
+    }
+    return failures == 0 ? 0 : 1;
+}
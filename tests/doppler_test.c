@@ -0,0 +1,132 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Checks the Doppler profile of a known pass against the closed form, and the frequency the shift produces. */
+
+#include "doppler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define TEST_SAMP_RATE 50000
+#define TEST_BLOCK_LEN 4096
+
+/* A pass at 432.32 MHz, closest after 300 s at 600 km, moving at 7.5 km/s */
+#define TEST_TX_FREQ 432320000
+#define TEST_TCA 300.0
+#define TEST_RANGE 600.0
+#define TEST_SPEED 7.5
+
+/** The pre-compensation offset for the test pass, worked out directly. */
+static double expected_offset(double seconds)
+{
+    double along = TEST_SPEED * (seconds - TEST_TCA);
+    double range_rate = TEST_SPEED * along / sqrt(TEST_RANGE * TEST_RANGE + along * along);
+    return TEST_TX_FREQ * range_rate / DOPPLER_C;
+}
+
+/** Check the profile points.  Returns the number of failures. */
+static int check_profile(const struct doppler *doppler)
+{
+    int failures = 0;
+    if (doppler->count != (int)(2 * TEST_TCA / DOPPLER_PASS_STEP) + 1)
+    {
+        fprintf(stderr, "Profile has %d points\n", doppler->count);
+        failures++;
+    }
+    for (int index = 0; index < doppler->count; index++)
+    {
+        double expected = expected_offset(doppler->times[index]);
+        if (fabs(doppler->offsets[index] - expected) > 1e-6)
+        {
+            fprintf(stderr, "Offset at %0.1f s is %0.6f Hz, expected %0.6f Hz\n", doppler->times[index], doppler->offsets[index], expected);
+            failures++;
+            break;
+        }
+    }
+
+    // Pre-compensation sends low while the receiver approaches
+    double start = doppler_offset_at(doppler, 0), middle = doppler_offset_at(doppler, TEST_TCA);
+    double end = doppler_offset_at(doppler, 2 * TEST_TCA);
+    if (start > -10000 || fabs(middle) > 1e-9 || fabs(start + end) > 1e-6)
+    {
+        fprintf(stderr, "Offsets at the start, closest approach and end are %0.3f, %0.3f and %0.3f Hz\n", start, middle, end);
+        failures++;
+    }
+    printf("Profile: %d points from %0.3f Hz to %0.3f Hz, %s\n", doppler->count, start, end, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/** Shift a constant signal through the whole pass and check its frequency against the profile.  Returns the number of failures. */
+static int check_shift(struct doppler *doppler)
+{
+    complex *iq = malloc(sizeof(complex) * TEST_BLOCK_LEN);
+    if (iq == NULL)
+    {
+        fprintf(stderr, "Error: Could not allocate the block\n");
+        return 1;
+    }
+    int failures = 0;
+    double worst_freq = 0, worst_level = 0;
+    long long total = (long long)(2 * TEST_TCA * TEST_SAMP_RATE);
+    for (long long sample = 0; sample < total; sample += TEST_BLOCK_LEN)
+    {
+        // I in the imaginary part: a constant I of 1 is a tone at 0 Hz
+        for (long index = 0; index < TEST_BLOCK_LEN; index++)
+        {
+            iq[index] = I;
+        }
+        doppler_apply(doppler, iq, TEST_BLOCK_LEN);
+
+        for (long index = 0; index + 1 < TEST_BLOCK_LEN; index += 997)
+        {
+            complex a = cimag(iq[index]) + creal(iq[index]) * I;
+            complex b = cimag(iq[index + 1]) + creal(iq[index + 1]) * I;
+            double freq = carg(b * conj(a)) * TEST_SAMP_RATE / (2 * M_PI);
+            double expected = doppler_offset_at(doppler, (sample + index + 0.5) / TEST_SAMP_RATE);
+            worst_freq = fmax(worst_freq, fabs(freq - expected));
+            worst_level = fmax(worst_level, fabs(cabs(a) - 1));
+        }
+    }
+    if (worst_freq > 1e-3 || worst_level > 1e-6)
+    {
+        failures++;
+    }
+    printf("Shift: %lld samples, Max Frequency Error: %0.2e Hz, Max Level Error: %0.2e, %s\n", total, worst_freq,
+           worst_level, failures == 0 ? "ok" : "FAILED");
+    free(iq);
+    return failures;
+}
+
+int main(void)
+{
+    struct doppler doppler;
+    if (doppler_pass(&doppler, TEST_TCA, TEST_RANGE, TEST_SPEED, TEST_TX_FREQ, TEST_SAMP_RATE) < 0)
+    {
+        fprintf(stderr, "Error: Could not build the pass\n");
+        return 1;
+    }
+    int failures = check_profile(&doppler);
+    failures += check_shift(&doppler);
+    doppler_free(&doppler);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,352 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Scrapes the metrics server over loopback and parses the exposition as an OpenMetrics reader would. */
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TEST_RESPONSE_LEN 16384
+#define TEST_MAX_FAMILIES 32
+#define TEST_NAME_LEN 128
+
+/* A label value that needs every escape */
+static const char test_message[] = "CQ \"DE\" \\ TEST\nK";
+
+/** A metric family declared by a TYPE line. */
+struct family
+{
+    char name[TEST_NAME_LEN];
+    char type[16];
+    int samples;
+};
+
+/** Find a loopback port nothing is listening on.  Returns the port, or -1 on error. */
+static int free_port(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0)
+    {
+        perror("Error: Could not find a free port");
+        return -1;
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/** Fetch a path from the server.  Returns the length of the response, or -1 on error. */
+static long fetch(int port, const char *path, char *response, size_t response_len)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("Error: Could not connect to the metrics server");
+        return -1;
+    }
+    char request[128];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\n\r\n", path);
+    send(fd, request, request_len, MSG_NOSIGNAL);
+
+    size_t len = 0;
+    ssize_t got;
+    while (len < response_len - 1 && (got = recv(fd, response + len, response_len - 1 - len, 0)) > 0)
+    {
+        len += got;
+    }
+    response[len] = '\0';
+    close(fd);
+    return len;
+}
+
+/** Length of the metric or label name at text, or 0 if there is none. */
+static size_t name_len(const char *text, bool metric)
+{
+    size_t len = 0;
+    while ((text[len] >= 'a' && text[len] <= 'z') || (text[len] >= 'A' && text[len] <= 'Z') || text[len] == '_' ||
+           (metric && text[len] == ':') || (len > 0 && text[len] >= '0' && text[len] <= '9'))
+    {
+        len++;
+    }
+    return len;
+}
+
+/** Parse a label set after the opening brace, unescaping the message label into message.  Returns the text after the closing brace, or NULL if it is malformed. */
+static const char *parse_labels(const char *text, char *message, size_t message_len)
+{
+    while (*text != '}')
+    {
+        size_t len = name_len(text, false);
+        if (len == 0 || text[len] != '=' || text[len + 1] != '"')
+        {
+            return NULL;
+        }
+        bool is_message = len == 7 && strncmp(text, "message", 7) == 0;
+        text += len + 2;
+        size_t out = 0;
+        for (; *text != '"'; text++)
+        {
+            char value = *text;
+            if (value == '\0' || value == '\n')
+            {
+                return NULL;
+            }
+            if (value == '\\')
+            {
+                text++;
+                if (*text != '\\' && *text != '"' && *text != 'n')
+                {
+                    return NULL;
+                }
+                value = *text == 'n' ? '\n' : *text;
+            }
+            if (is_message && out < message_len - 1)
+            {
+                message[out++] = value;
+            }
+        }
+        if (is_message)
+        {
+            message[out] = '\0';
+        }
+        text++;
+        if (*text == ',')
+        {
+            text++;
+        }
+        else if (*text != '}')
+        {
+            return NULL;
+        }
+    }
+    return text + 1;
+}
+
+/** Whether a sample name belongs to the family, given the suffixes its type allows. */
+static bool in_family(const struct family *family, const char *name, size_t len)
+{
+    size_t base = strlen(family->name);
+    if (len < base || strncmp(name, family->name, base) != 0)
+    {
+        return false;
+    }
+    const char *suffix = name + base;
+    size_t suffix_len = len - base;
+    if (strcmp(family->type, "gauge") == 0)
+    {
+        return suffix_len == 0;
+    }
+    if (strcmp(family->type, "counter") == 0)
+    {
+        return (suffix_len == 6 && strncmp(suffix, "_total", 6) == 0) || (suffix_len == 8 && strncmp(suffix, "_created", 8) == 0);
+    }
+    if (strcmp(family->type, "info") == 0)
+    {
+        return suffix_len == 5 && strncmp(suffix, "_info", 5) == 0;
+    }
+    return false;
+}
+
+/** Parse the exposition line by line.  Returns the number of failures. */
+static int check_exposition(char *body)
+{
+    struct family families[TEST_MAX_FAMILIES];
+    int family_count = 0;
+    struct family *current = NULL;
+    char message[sizeof(test_message) + 16] = "";
+    double samples_pushed = -1;
+    int failures = 0;
+    int line_number = 0;
+    bool ended = false;
+
+    for (char *line = body, *next; *line != '\0'; line = next)
+    {
+        char *end = strchr(line, '\n');
+        if (end == NULL)
+        {
+            fprintf(stderr, "Line %d: Missing a newline\n", line_number + 1);
+            return failures + 1;
+        }
+        *end = '\0';
+        next = end + 1;
+        line_number++;
+
+        if (ended)
+        {
+            fprintf(stderr, "Line %d: Text after # EOF\n", line_number);
+            return failures + 1;
+        }
+        if (strcmp(line, "# EOF") == 0)
+        {
+            ended = true;
+            continue;
+        }
+
+        char name[TEST_NAME_LEN];
+        char word[TEST_NAME_LEN];
+        if (strncmp(line, "# TYPE ", 7) == 0)
+        {
+            if (sscanf(line + 7, "%127s %127s", name, word) != 2 || family_count == TEST_MAX_FAMILIES || strlen(word) >= sizeof(families[0].type))
+            {
+                fprintf(stderr, "Line %d: Malformed TYPE: %s\n", line_number, line);
+                failures++;
+                continue;
+            }
+            for (int index = 0; index < family_count; index++)
+            {
+                if (strcmp(families[index].name, name) == 0)
+                {
+                    fprintf(stderr, "Line %d: Family %s is declared twice\n", line_number, name);
+                    failures++;
+                }
+            }
+            current = &families[family_count++];
+            strcpy(current->name, name);
+            strcpy(current->type, word);
+            current->samples = 0;
+        }
+        else if (strncmp(line, "# HELP ", 7) == 0 || strncmp(line, "# UNIT ", 7) == 0)
+        {
+            if (sscanf(line + 7, "%127s %127s", name, word) != 2 || current == NULL || strcmp(name, current->name) != 0 || current->samples > 0)
+            {
+                fprintf(stderr, "Line %d: Metadata outside its family: %s\n", line_number, line);
+                failures++;
+                continue;
+            }
+            size_t unit_at = strlen(name) - strlen(word);
+            if (line[2] == 'U' && (strlen(name) <= strlen(word) || name[unit_at - 1] != '_' || strcmp(name + unit_at, word) != 0))
+            {
+                fprintf(stderr, "Line %d: Family %s does not end in its unit %s\n", line_number, name, word);
+                failures++;
+            }
+        }
+        else
+        {
+            size_t len = name_len(line, true);
+            const char *rest = line + len;
+            if (*rest == '{')
+            {
+                rest = parse_labels(rest + 1, message, sizeof(message));
+            }
+            char *value_end = NULL;
+            double value = rest != NULL && *rest == ' ' ? strtod(rest + 1, &value_end) : 0;
+            if (len == 0 || value_end == NULL || value_end == rest + 1 || *value_end != '\0')
+            {
+                fprintf(stderr, "Line %d: Malformed sample: %s\n", line_number, line);
+                failures++;
+                continue;
+            }
+            if (current == NULL || !in_family(current, line, len))
+            {
+                fprintf(stderr, "Line %d: Sample %.*s does not belong to family %s\n", line_number, (int)len, line,
+                        current != NULL ? current->name : "(none)");
+                failures++;
+                continue;
+            }
+            current->samples++;
+            if (strcmp(current->name, "beacon_samples_pushed") == 0)
+            {
+                samples_pushed = value;
+            }
+        }
+    }
+
+    if (!ended)
+    {
+        fprintf(stderr, "The exposition does not end with # EOF\n");
+        failures++;
+    }
+    for (int index = 0; index < family_count; index++)
+    {
+        if (families[index].samples == 0)
+        {
+            fprintf(stderr, "Family %s has no samples\n", families[index].name);
+            failures++;
+        }
+    }
+    if (strcmp(message, test_message) != 0)
+    {
+        fprintf(stderr, "The message label reads back as \"%s\"\n", message);
+        failures++;
+    }
+    if (samples_pushed != 3000)
+    {
+        fprintf(stderr, "beacon_samples_pushed_total is %g, expected 3000\n", samples_pushed);
+        failures++;
+    }
+    printf("Exposition: %d lines, %d families, %s\n", line_number, family_count, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main(void)
+{
+    struct metrics_info info = {"file", test_message, 20, 432000000, -10, 2000000};
+    int port = free_port();
+    if (port < 0 || metrics_start(port, info) < 0)
+    {
+        return 1;
+    }
+    metrics_block(1000, 0.001);
+    metrics_block(2000, 0.002);
+    metrics_push_error();
+
+    char *response = malloc(TEST_RESPONSE_LEN);
+    int failures = 0;
+    long len = fetch(port, "/metrics", response, TEST_RESPONSE_LEN);
+    char *body = len > 0 ? strstr(response, "\r\n\r\n") : NULL;
+    if (body == NULL || strncmp(response, "HTTP/1.0 200 ", 13) != 0 ||
+        strstr(response, "Content-Type: application/openmetrics-text; version=1.0.0") == NULL)
+    {
+        fprintf(stderr, "Unexpected response:\n%s\n", response);
+        failures++;
+    }
+    else
+    {
+        failures += check_exposition(body + 4);
+    }
+
+    len = fetch(port, "/other", response, TEST_RESPONSE_LEN);
+    if (len <= 0 || strncmp(response, "HTTP/1.0 404 ", 13) != 0)
+    {
+        fprintf(stderr, "Unknown paths should get 404:\n%s\n", response);
+        failures++;
+    }
+
+    metrics_shutdown();
+    free(response);
+    return failures == 0 ? 0 : 1;
+}
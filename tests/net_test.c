@@ -0,0 +1,237 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Sends blocks through the network sink to a loopback receiver and checks the frames that arrive. */
+
+#include "net.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TEST_SAMP_RATE 1000000
+#define TEST_INIT_LEN 4096
+#define TEST_FORMAT FORMAT_CS16
+#define TEST_MAX_FRAME (sizeof(struct net_frame_header) + 65536 * 4)
+
+/* A full block, a short one like the end of a recording, and one longer than at init */
+static const long block_lens[] = {4096, 1000, 10000, 4096};
+#define TEST_BLOCKS 4
+
+/** What the receiver expects next, carried across frames. */
+struct expect
+{
+    int block;
+    long offset;
+    uint64_t sequence;
+    uint64_t sample;
+    int frames;
+    int failures;
+};
+
+/** Fill a block with samples that differ from every other block's. */
+static void fill_block(complex *iq, long len, uint64_t start)
+{
+    for (long index = 0; index < len; index++)
+    {
+        long value = (start + index) % 4000 - 2000;
+        iq[index] = value + (1000 - value / 2) * I;
+    }
+}
+
+/** Open a receiving socket on a free loopback port.  Returns the socket, or -1 on error. */
+static int open_receiver(int type, char *address, size_t address_len)
+{
+    int fd = socket(AF_INET, type, 0);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0 || (type == SOCK_STREAM && listen(fd, 1) < 0))
+    {
+        perror("Error: Could not open the receiver");
+        return -1;
+    }
+    int rcvbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    snprintf(address, address_len, "%s:127.0.0.1:%d", type == SOCK_STREAM ? "tcp" : "udp", ntohs(addr.sin_port));
+    return fd;
+}
+
+/** Check one received frame against the block it should hold part of. */
+static void check_frame(struct expect *expect, const unsigned char *frame, size_t len, long max_samples, bool whole_blocks)
+{
+    size_t sample_size = iq_sample_size(TEST_FORMAT);
+    const struct net_frame_header *header = (const struct net_frame_header *)frame;
+    long samples = le32toh(header->samples);
+    long block_len = expect->block < TEST_BLOCKS ? block_lens[expect->block] : 0;
+    long wanted = block_len - expect->offset < max_samples ? block_len - expect->offset : max_samples;
+    if (whole_blocks)
+    {
+        wanted = block_len;
+    }
+
+    complex iq[TEST_INIT_LEN * 4];
+    unsigned char packed[sizeof(iq)];
+    if (len < sizeof(struct net_frame_header) || le32toh(header->magic) != NET_FRAME_MAGIC ||
+        le16toh(header->format) != TEST_FORMAT || le64toh(header->sequence) != expect->sequence ||
+        le64toh(header->sample) != expect->sample || samples != wanted || samples <= 0 ||
+        len != sizeof(struct net_frame_header) + samples * sample_size)
+    {
+        fprintf(stderr, "Frame %d: %zu bytes, sequence %llu, sample %llu, %ld samples, expected sequence %llu, sample %llu, %ld samples\n",
+                expect->frames, len, (unsigned long long)le64toh(header->sequence), (unsigned long long)le64toh(header->sample),
+                samples, (unsigned long long)expect->sequence, (unsigned long long)expect->sample, wanted);
+        expect->failures++;
+        return;
+    }
+    fill_block(iq, samples, expect->sample);
+    pack_iq(TEST_FORMAT, packed, iq, samples);
+    if (memcmp(packed, header + 1, samples * sample_size) != 0)
+    {
+        fprintf(stderr, "Frame %d: The samples differ from the ones sent\n", expect->frames);
+        expect->failures++;
+    }
+
+    expect->frames++;
+    expect->sequence++;
+    expect->sample += samples;
+    expect->offset += samples;
+    if (expect->offset == block_len)
+    {
+        expect->block++;
+        expect->offset = 0;
+    }
+}
+
+/** Send every test block through the sink. */
+static int send_blocks(void)
+{
+    complex *iq = malloc(sizeof(complex) * block_lens[2]);
+    uint64_t start = 0;
+    for (int block = 0; block < TEST_BLOCKS; block++)
+    {
+        fill_block(iq, block_lens[block], start);
+        if (net_send(iq, block_lens[block]) != block_lens[block])
+        {
+            free(iq);
+            return -1;
+        }
+        start += block_lens[block];
+    }
+    free(iq);
+    return 0;
+}
+
+static int check_udp(void)
+{
+    char address[64];
+    int fd = open_receiver(SOCK_DGRAM, address, sizeof(address));
+    if (fd < 0 || net_init(address, TEST_FORMAT, TEST_SAMP_RATE, TEST_INIT_LEN) < 0 || send_blocks() < 0)
+    {
+        return 1;
+    }
+
+    struct expect expect = {0};
+    long max_samples = (NET_UDP_PAYLOAD - sizeof(struct net_frame_header)) / iq_sample_size(TEST_FORMAT);
+    unsigned char *frame = malloc(TEST_MAX_FRAME);
+    ssize_t len;
+    while ((len = recv(fd, frame, TEST_MAX_FRAME, MSG_DONTWAIT)) >= 0)
+    {
+        if (len > NET_UDP_PAYLOAD)
+        {
+            fprintf(stderr, "UDP: A %zd byte datagram is larger than %d bytes\n", len, NET_UDP_PAYLOAD);
+            expect.failures++;
+        }
+        if (expect.failures == 0)
+        {
+            check_frame(&expect, frame, len, max_samples, false);
+        }
+    }
+    if (expect.block != TEST_BLOCKS)
+    {
+        fprintf(stderr, "UDP: Got %d of %d blocks\n", expect.block, TEST_BLOCKS);
+        expect.failures++;
+    }
+    printf("UDP: %d frames, %s\n", expect.frames, expect.failures == 0 ? "ok" : "FAILED");
+    net_shutdown();
+    free(frame);
+    close(fd);
+    return expect.failures;
+}
+
+static int check_tcp(void)
+{
+    char address[64];
+    int listener = open_receiver(SOCK_STREAM, address, sizeof(address));
+    if (listener < 0 || net_init(address, TEST_FORMAT, TEST_SAMP_RATE, TEST_INIT_LEN) < 0)
+    {
+        return 1;
+    }
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0 || send_blocks() < 0)
+    {
+        return 1;
+    }
+    net_shutdown();
+
+    // Read the whole stream, then split it into frames
+    size_t size = 0, capacity = TEST_MAX_FRAME * TEST_BLOCKS;
+    unsigned char *stream = malloc(capacity);
+    ssize_t len;
+    while (size < capacity && (len = recv(fd, stream + size, capacity - size, 0)) > 0)
+    {
+        size += len;
+    }
+
+    struct expect expect = {0};
+    size_t offset = 0;
+    while (offset + sizeof(struct net_frame_header) <= size && expect.failures == 0)
+    {
+        const struct net_frame_header *header = (const struct net_frame_header *)(stream + offset);
+        size_t frame_len = sizeof(struct net_frame_header) + le32toh(header->samples) * iq_sample_size(TEST_FORMAT);
+        check_frame(&expect, stream + offset, offset + frame_len <= size ? frame_len : size - offset, 0, true);
+        offset += frame_len;
+    }
+    if (expect.block != TEST_BLOCKS || offset != size)
+    {
+        fprintf(stderr, "TCP: Got %d of %d blocks, %zu of %zu bytes in whole frames\n", expect.block, TEST_BLOCKS, offset, size);
+        expect.failures++;
+    }
+    printf("TCP: %d frames, %s\n", expect.frames, expect.failures == 0 ? "ok" : "FAILED");
+    free(stream);
+    close(fd);
+    close(listener);
+    return expect.failures;
+}
+
+int main(void)
+{
+    int failures = check_udp();
+    failures += check_tcp();
+    return failures == 0 ? 0 : 1;
+}
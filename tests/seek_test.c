@@ -0,0 +1,130 @@
+/*
+    Copyright 2018, Andrew C. Young <andrew@vaelen.org>
+
+    This file is part of Beacon
+
+    Beacon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Beacon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Beacon.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+/* Checks that rendering from a seek gives the same samples as rendering up to it from the start. */
+
+#include "beacon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SAMP_RATE 200000
+#define TEST_SECONDS 8
+#define TEST_SEEKS 100
+#define TEST_RUN 20000
+
+/** Render a message in one pass, then from random seeks and in odd sized blocks.  Returns the number of failures. */
+static int check_seek(enum modulation modulation, const char *name)
+{
+    struct beacon_params params = {
+        .samp_rate = TEST_SAMP_RATE,
+        .carrier_freq = 10000,
+        .tone_freq = 800,
+        .wpm = 25,
+        .message = "CQ DE NU8W",
+        .padding = 1,
+        .modulation = modulation,
+        .modulation_index = 500,
+    };
+    long len = TEST_SAMP_RATE * TEST_SECONDS;
+    beacon_iq *sequential = malloc(sizeof(beacon_iq) * len);
+    beacon_iq *seeked = malloc(sizeof(beacon_iq) * len);
+    struct beacon *ctx = beacon_create(&params);
+    if (sequential == NULL || seeked == NULL || ctx == NULL)
+    {
+        fprintf(stderr, "Error: Could not set up the test\n");
+        exit(1);
+    }
+    beacon_render_iq(ctx, sequential, len);
+
+    int failures = 0;
+    srand(modulation + 1);
+    for (int seek = 0; seek < TEST_SEEKS && failures == 0; seek++)
+    {
+        long sample = rand() % (len - TEST_RUN);
+        beacon_seek(ctx, sample);
+        if (beacon_tell(ctx) != sample)
+        {
+            fprintf(stderr, "%s: Seek to %ld left the context at %lld\n", name, sample, beacon_tell(ctx));
+            failures++;
+        }
+        beacon_render_iq(ctx, seeked, TEST_RUN);
+        if (memcmp(sequential + sample, seeked, sizeof(beacon_iq) * TEST_RUN) != 0)
+        {
+            fprintf(stderr, "%s: Rendering from sample %ld differs from the sequential render\n", name, sample);
+            failures++;
+        }
+    }
+
+    // Blocks that end mid-element, mid-edge and mid-period
+    beacon_seek(ctx, 0);
+    for (long done = 0, block = 1; done < len; block = block * 7 % 4099 + 1)
+    {
+        long run = len - done < block ? len - done : block;
+        beacon_render_iq(ctx, seeked + done, run);
+        done += run;
+    }
+    if (memcmp(sequential, seeked, sizeof(beacon_iq) * len) != 0)
+    {
+        fprintf(stderr, "%s: Rendering in small blocks differs from one pass\n", name);
+        failures++;
+    }
+    printf("%s: %d seeks and a block-wise render, %s\n", name, TEST_SEEKS, failures == 0 ? "ok" : "FAILED");
+
+    beacon_destroy(ctx);
+    free(seeked);
+    free(sequential);
+    return failures;
+}
+
+/** A message with nothing to key and no padding has no length, so it must be refused.  Returns the number of failures. */
+static int check_empty(void)
+{
+    struct beacon_params params = {
+        .samp_rate = TEST_SAMP_RATE,
+        .carrier_freq = 10000,
+        .tone_freq = 800,
+        .wpm = 25,
+        .message = "#",
+        .padding = 0,
+        .modulation = MOD_AM,
+        .modulation_index = 500,
+    };
+    struct beacon *ctx = beacon_create(&params);
+    if (ctx != NULL)
+    {
+        fprintf(stderr, "Empty: A message with no Morse and no padding was accepted\n");
+        beacon_destroy(ctx);
+        return 1;
+    }
+    printf("Empty: refused, ok\n");
+    return 0;
+}
+
+int main(void)
+{
+    int failures = check_empty();
+    failures += check_seek(MOD_AM, "AM");
+    failures += check_seek(MOD_FM, "FM");
+    failures += check_seek(MOD_CW, "CW");
+    return failures == 0 ? 0 : 1;
+}